@@ -15,14 +15,16 @@ typedef struct ocl_res{
     cl_kernel kernel;
 } ocl_res_t;
 
-void get_platform(ocl_res_t *ocl);
-void get_device(ocl_res_t *ocl);
-void create_context(ocl_res_t *ocl);
-void load_kernel_code(ocl_res_t *ocl, const char *path);
-void create_program(ocl_res_t *ocl);
-void build_program(ocl_res_t *ocl, const char *opitons);
-void create_kernel(ocl_res_t *ocl, const char *kernel_name);
-void init_opencl(ocl_res_t *ocl);
+// every helper prints what went wrong and returns 0 on failure, 1 on success,
+// the OpenCL error code is left in ocl->err
+int get_platform(ocl_res_t *ocl);
+int get_device(ocl_res_t *ocl);
+int create_context(ocl_res_t *ocl);
+int load_kernel_code(ocl_res_t *ocl, const char *path);
+int create_program(ocl_res_t *ocl);
+int build_program(ocl_res_t *ocl, const char *opitons);
+int create_kernel(ocl_res_t *ocl, const char *kernel_name);
+int init_opencl(ocl_res_t *ocl);
 
 const char *get_error_msg(int error);
 
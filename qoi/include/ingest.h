@@ -0,0 +1,71 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <pthread.h>
+
+/**
+ * Decode one input file.
+ *
+ * Returns the pixels (released with free) or NULL on failure,
+ * width, height and channels are set on success
+ */
+typedef void *(*ingest_load_fn)(const char *path, int *width, int *height, int *channels);
+
+typedef struct ingest_image {
+    const char *path;
+    int index;
+    void *pixels;
+    int width;
+    int height;
+    int channels;
+} ingest_image_t;
+
+/**
+ * Pool of decoder threads filling a bounded queue of ready pixel buffers.
+ *
+ * Images come out in the order they finish decoding, index tells
+ * their position in the input list.
+ */
+typedef struct ingest {
+    const char **paths;
+    int n_paths;
+    int next_path;
+    int delivered;
+    ingest_load_fn load;
+
+    ingest_image_t *queue;
+    int capacity;
+    int head;
+    int count;
+
+    pthread_t *workers;
+    int n_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+} ingest_t;
+
+/**
+ * Start decoding the input files in the background.
+ *
+ * n_workers: decoder threads, 0 for one per processor
+ * capacity: decoded images allowed to wait in the queue, bounds the memory use
+ *
+ * Returns 0 on success
+ */
+int ingest_start(ingest_t *ingest, const char **paths, int n_paths, int n_workers, int capacity, ingest_load_fn load);
+
+/**
+ * Take the next decoded image, blocks until one is ready.
+ * A failed decode is delivered with pixels set to NULL.
+ *
+ * Returns 0 when every input has been delivered
+ */
+int ingest_next(ingest_t *ingest, ingest_image_t *image);
+
+/**
+ * Stop the workers and drop the images still in the queue.
+ */
+void ingest_stop(ingest_t *ingest);
+
+#endif
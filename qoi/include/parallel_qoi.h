@@ -4,218 +4,2547 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 #define CL_TARGET_OPENCL_VERSION 220
 #include <CL/cl.h>
 #include "kernel_loader.h"
 #include "compact_types.h"
+#include "qoi_tiles.h"
+#include "qoi_sequence.h"
+#include "pqoi_verify.h"
+#include "qoi_color.h"
+#include "pqoi_perf.h"
+#include "pqoi_trace.h"
+#include "pqoi_bands.h"
+
+#define PQOI_STREAM_CPU     0  // one thread, the state runs on across rows: plain QOI output
+#define PQOI_STREAM_THREADS 1  // every row encoded on its own, rows of a batch spread over threads
+#define PQOI_STREAM_OPENCL  2  // every row encoded on its own by the encode kernel, one launch per batch
+
+// device buffers and host scratch of one encode in flight
+// they are kept between encodes and only grow when an image needs more
+typedef struct pqoi_frame {
+    cl_mem pixel_buffer;
+    cl_mem bytes_buffer;
+    cl_mem segment_lengths_buffer;
+    cl_mem segment_offsets_buffer;
+    cl_mem stats_buffer;
+    size_t pixel_capacity;
+    size_t bytes_capacity;
+    size_t segments_capacity;
+    size_t offsets_capacity;
+    size_t stats_capacity;
+
+    // strided segments read back from the device, one row every width * (channels + 1) bytes
+    unsigned char *bytes;
+    unsigned int *segment_lengths;
+    size_t host_bytes_capacity;
+    size_t host_segments_capacity;
+
+    // PQOI_STAT_COUNT op counters of every segment when the session has PQOI_STATS
+    unsigned int *stats;
+    size_t host_stats_capacity;
+
+    // start of every segment in a decoded stream, one more entry than segments for the end
+    unsigned int *segment_offsets;
+    size_t host_offsets_capacity;
+
+    // with shared virtual memory (pqoi_session_enable_svm) bytes and segment_lengths are SVM
+    // allocations the kernel writes in place, coarse-grained ones stay mapped for the host
+    // except while a kernel runs
+    int svm;  // PQOI_SVM_COARSE or PQOI_SVM_FINE, 0 for plain host memory
+    cl_context svm_context;
+    cl_command_queue svm_queue;
+    unsigned char *svm_pixels;  // staging for source pixels that don't live in SVM
+    size_t svm_pixels_capacity;
+} pqoi_frame_t;
+
+#define PQOI_SVM_COARSE 1  // clSVMAlloc buffers, mapped and unmapped around every kernel
+#define PQOI_SVM_FINE   2  // fine-grained buffers, host and device use them without maps
+
+// a pqoi_svm_alloc allocation, the encoder reads pixels inside one in place
+typedef struct pqoi_svm_block {
+    unsigned char *data;
+    size_t size;
+    int mapped;
+    struct pqoi_svm_block *next;
+} pqoi_svm_block_t;
+
+#define PQOI_WRITE_INDEX 1  // append the segment index after the padding
+#define PQOI_VERIFY      2  // decode the rows again and compare them with the source before handing the bytes out
+#define PQOI_YCOCG       4  // encode the pixels in the reversible color transform of qoi_color.h, flagged in the header
+#define PQOI_STATS       8  // count the ops of every row into frame.stats, see PQOI_STAT_RUN
+
+// op counters of a row with PQOI_STATS, PQOI_STAT_COUNT of them per row in frame.stats.
+// RUN_PIXELS is the number of pixels the runs cover, every other pixel takes one of the other ops
+enum {
+    PQOI_STAT_RUN,
+    PQOI_STAT_INDEX,
+    PQOI_STAT_DIFF,
+    PQOI_STAT_LUMA,
+    PQOI_STAT_RGB,
+    PQOI_STAT_RGBA,
+    PQOI_STAT_RUN_PIXELS,
+    PQOI_STAT_COUNT
+};
+
+// segment index trailer: the offset of every segment relative to the end of the header,
+// the number of segments and this magic, all 32 bit big endian like the header.
+// Plain QOI decoders stop at the padding and never look at it
+#define PQOI_INDEX_MAGIC \
+    (((unsigned int)'p') << 24 | ((unsigned int)'q') << 16 | \
+     ((unsigned int)'s') <<  8 | ((unsigned int)'i'))
+
+// in-order queues of the stripe pipeline: uploads, kernels and downloads
+#define PQOI_STRIPE_QUEUES 3
+
+// reusable encoder state: the built kernels, the command queue and the frame of the blocking calls
+typedef struct pqoi_session {
+    ocl_res_t ocl;
+    cl_kernel decode_kernel;
+    cl_kernel tiles_kernel;
+    cl_kernel sequence_kernel;
+    cl_command_queue queue;
+    pqoi_frame_t frame;
+    int flags;  // PQOI_WRITE_INDEX, PQOI_VERIFY, PQOI_YCOCG, PQOI_STATS
+
+    // parallel_process splits an image into this many row stripes when it is above 1,
+    // their transfers and kernels overlap on the stripe queues (created on first use)
+    unsigned int stripes;
+    cl_command_queue stripe_queues[PQOI_STRIPE_QUEUES];
+
+    pqoi_svm_block_t *svm_blocks;
+    pqoi_mismatch_t mismatch;  // why the last encode failed PQOI_VERIFY
+    cl_int error;  // the OpenCL error that made the session or its last encode fall back, CL_SUCCESS if none did
+    pqoi_perf_t *perf;  // optional, counts the cpu stages of the encodes (set after pqoi_session_init)
+    pqoi_trace_t *trace;  // optional, traces the host stages and every command (set after pqoi_session_init)
+} pqoi_session_t;
+
+// QOI encoder state carried from one pixel to the next
+typedef struct pqoi_pixel_state {
+    qoi_rgba_t index[64];
+    unsigned long long written;  // index slots an INDEX op may refer to
+    qoi_rgba_t prev;
+    int run;
+    int literal;  // the next pixel is written as RGB / RGBA
+} pqoi_pixel_state_t;
+
+// receives the encoded bytes of a stream in order, returns 1 to go on and 0 to abort the stream
+typedef int (*pqoi_sink)(const void *bytes, size_t len, void *user_data);
+
+// row-at-a-time encoder, memory depends on the rows pushed at once but not on the image height
+typedef struct pqoi_stream_encoder {
+    qoi_desc desc;
+    int backend;
+    pqoi_session_t *session;  // PQOI_STREAM_OPENCL only
+    int n_threads;            // PQOI_STREAM_THREADS only
+
+    pqoi_sink sink;
+    void *user_data;
+
+    pqoi_pixel_state_t state;
+    unsigned int rows_done;
+    int failed;
+
+    // scratch of one batch of rows
+    unsigned char *bytes;
+    unsigned int *lengths;
+    size_t bytes_capacity;
+    size_t lengths_capacity;
+} pqoi_stream_encoder_t;
+
+// frame sequence encoder, the frame before stays on the device to find the rows that changed,
+// or on the host for a session without OpenCL
+typedef struct pqoi_sequence {
+    pqoi_session_t *session;
+    qoi_desc desc;
+
+    pqoi_sink sink;
+    void *user_data;
+
+    cl_mem frames[2];  // the current and the previous frame, swapped after every frame
+    int current;
+    unsigned char *prev;  // the previous frame of a session without OpenCL
+    unsigned int n_frames;
+    int failed;
+
+    // record length, changed row bitmap and row lengths of a frame
+    unsigned char *head;
+    size_t head_capacity;
+} pqoi_sequence_t;
+
+typedef struct pqoi_job pqoi_job_t;
+typedef void (*pqoi_encode_callback)(pqoi_job_t *job, void *user_data);
+
+// an asynchronous encode, owns its frame so many of them can be in flight on one session
+struct pqoi_job {
+    pqoi_session_t *session;
+    pqoi_frame_t frame;
+    qoi_desc desc;
+    const unsigned char *data;  // the pixels, checked against the segments with PQOI_VERIFY
+    unsigned char *dst;
+    int dst_capacity;
+    pqoi_mismatch_t mismatch;  // why the job failed PQOI_VERIFY
+
+    pqoi_encode_callback callback;
+    void *user_data;
+
+    cl_event done;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int status;  // 0 while in flight, 1 when the merged bytes are ready, -1 on failure
+    int size;
+    int settled;  // 1 once the callback has returned, the job can't be freed before
+};
 
+int pqoi_session_init(pqoi_session_t *session);
+void pqoi_session_release(pqoi_session_t *session);
+int pqoi_session_enable_svm(pqoi_session_t *session);
+void *pqoi_svm_alloc(pqoi_session_t *session, size_t size);
+void pqoi_svm_free(pqoi_session_t *session, void *data);
+int pqoi_max_encoded_size(const qoi_desc *desc);
+int pqoi_encode_into(pqoi_session_t *session, const void *data, const qoi_desc *desc, void *dst, int dst_capacity);
+int pqoi_encode_channels_into(pqoi_session_t *session, const void *data, int src_channels, const qoi_desc *desc, void *dst, int dst_capacity);
+pqoi_job_t *pqoi_encode_async(pqoi_session_t *session, const void *data, const qoi_desc *desc, void *dst, int dst_capacity, pqoi_encode_callback callback, void *user_data);
+int pqoi_job_done(pqoi_job_t *job);
+int pqoi_job_wait(pqoi_job_t *job);
+void pqoi_job_release(pqoi_job_t *job);
 void *parallel_qoi_encode(const void *data, const qoi_desc *desc, int *out_len);
-void parallel_process(unsigned char *bytes, int bytes_len, const unsigned char *pixels, int pixels_len, unsigned int *segment_lengths, const qoi_desc *desc, ocl_res_t *ocl);
-static inline unsigned char *merge_segments(unsigned char *bytes, unsigned int *segment_lengths, const qoi_desc *desc, int *total_size);
+cl_int parallel_enqueue(pqoi_session_t *session, pqoi_frame_t *frame, const unsigned char *pixels, int src_channels, const qoi_desc *desc, cl_event *kernel_event, cl_event *read_event);
+int parallel_process(pqoi_session_t *session, const unsigned char *pixels, int src_channels, const qoi_desc *desc);
+int pqoi_cpu_encode(const unsigned char *pixels, int src_channels, const qoi_desc *desc, unsigned char *bytes, unsigned int *segment_lengths, int n_threads);
+int pqoi_cpu_encode_tiles(const unsigned char *pixels, const qoi_desc *desc, unsigned int tile_size, unsigned char *bytes, unsigned int *tile_lengths, int n_threads);
+void pqoi_count_ops(const unsigned char *segment, unsigned int len, unsigned int *stats);
+void pqoi_stats_total(const unsigned int *stats, unsigned int n_rows, unsigned long long *totals);
+static inline int merge_segments(const unsigned char *bytes, const unsigned int *segment_lengths, const qoi_desc *desc, int flags, unsigned char *merged, int merged_capacity);
+int write_segments(const char *filename, const unsigned char *bytes, const unsigned int *segment_lengths, const qoi_desc *desc, int flags);
+int pqoi_write(pqoi_session_t *session, const char *filename, const void *data, const qoi_desc *desc);
+int pqoi_write_channels(pqoi_session_t *session, const char *filename, const void *data, int src_channels, const qoi_desc *desc);
 int parallel_qoi_write(const char *filename, const void *data, const qoi_desc *desc);
+int pqoi_read_index(const void *data, int size, const qoi_desc *desc, unsigned int *offsets);
+cl_mem pqoi_decode_device(pqoi_session_t *session, const void *data, int size, qoi_desc *desc);
+int pqoi_decode_into(pqoi_session_t *session, const void *data, int size, qoi_desc *desc, void *dst, size_t dst_capacity);
+void *pqoi_decode(pqoi_session_t *session, const void *data, int size, qoi_desc *desc);
+void *parallel_qoi_decode(const void *data, int size, qoi_desc *desc);
+int pqoi_write_tiled(pqoi_session_t *session, const char *filename, const void *data, const qoi_desc *desc, unsigned int tile_size);
+int pqoi_stream_begin(pqoi_stream_encoder_t *encoder, const qoi_desc *desc, int backend, pqoi_session_t *session, int n_threads, pqoi_sink sink, void *user_data);
+int pqoi_stream_push_rows(pqoi_stream_encoder_t *encoder, const void *pixels, unsigned int n_rows);
+int pqoi_stream_finish(pqoi_stream_encoder_t *encoder);
+int pqoi_sequence_begin(pqoi_sequence_t *sequence, pqoi_session_t *session, const qoi_desc *desc, pqoi_sink sink, void *user_data);
+int pqoi_sequence_push(pqoi_sequence_t *sequence, const void *pixels);
+int pqoi_sequence_finish(pqoi_sequence_t *sequence);
 
-// encode target image using opencl parallel computing
-// returns the size of the data written or 0 on failure
- void *parallel_qoi_encode(const void *data, const qoi_desc *desc, int *out_len){
-    // prepare opencl
-    ocl_res_t ocl;
-    init_opencl(&ocl);
+// QOI channels of an image with 1 (gray), 2 (gray + alpha), 3 or 4 source channels
+#define PQOI_QOI_CHANNELS(src_channels) ((src_channels) & 1 ? 3 : 4)
+
+// size of one row slot in the strided segment buffer, the worst case of a row
+#define PQOI_SEGMENT_STRIDE(desc) ((size_t)(desc)->width * ((desc)->channels + 1))
+
+// size of the segment index trailer
+#define PQOI_INDEX_SIZE(desc) (((size_t)(desc)->height + 2) * sizeof(unsigned int))
+
+// create a kernel of the session program
+// returns 1 on success
+static inline int pqoi_create_kernel(pqoi_session_t *session, cl_kernel *kernel, const char *name){
+    *kernel = clCreateKernel(session->ocl.program, name, &session->ocl.err);
+    if (session->ocl.err != CL_SUCCESS) {
+        *kernel = NULL;
+        printf("[ERROR] Error creating kernel %s. Error code: %d :: %s\n", name, session->ocl.err, get_error_msg(session->ocl.err));
+        return 0;
+    }
+    return 1;
+}
+
+// build the encoder kernel and create the command queue
+// a session that fails here is left without a queue and still encodes, on the cpu (parallel_process),
+// the error is kept in session->error
+// returns 1 on success
+int pqoi_session_init(pqoi_session_t *session){
+    memset(session, 0, sizeof(*session));
 
     const char *kernel_source = "kernels/codec.cl";
     const char *options = "-D SET_ME=1234";
     const char *kernel_name = "encode";
 
-    load_kernel_code(&ocl, kernel_source);
-    create_program(&ocl);
-    build_program(&ocl, options);
-    create_kernel(&ocl, kernel_name);
+    int ok =
+        init_opencl(&session->ocl) &&
+        load_kernel_code(&session->ocl, kernel_source) &&
+        create_program(&session->ocl) &&
+        build_program(&session->ocl, options) &&
+        create_kernel(&session->ocl, kernel_name) &&
+        pqoi_create_kernel(session, &session->decode_kernel, "decode") &&
+        pqoi_create_kernel(session, &session->tiles_kernel, "encode_tiles") &&
+        pqoi_create_kernel(session, &session->sequence_kernel, "encode_sequence");
+
+    // the program keeps its own copy of the source
+    free((void *)session->ocl.kernel_code);
+    session->ocl.kernel_code = NULL;
+
+    if (ok) {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+        session->queue = clCreateCommandQueue(session->ocl.context, session->ocl.device_id, CL_QUEUE_PROFILING_ENABLE, &session->ocl.err);
+        #pragma GCC diagnostic pop
+        ok = session->ocl.err == CL_SUCCESS;
+    }
+
+    if (!ok) {
+        cl_int err = session->ocl.err != CL_SUCCESS ? session->ocl.err : CL_INVALID_PROGRAM;
+        pqoi_session_release(session);
+        session->error = err;
+        fprintf(stderr, "OpenCL is unavailable (%d :: %s), the session encodes on the cpu\n", err, get_error_msg(err));
+    }
+    return ok;
+}
+
+// hand a coarse-grained SVM region to the host (map) or back to the device, fine-grained ones need neither
+// returns CL_SUCCESS or the error of the map, the host must not touch the region after a failed one
+static inline cl_int pqoi_svm_map(cl_command_queue queue, int svm, void *data, size_t size, int map){
+    if (svm != PQOI_SVM_COARSE || data == NULL) {
+        return CL_SUCCESS;
+    }
+    if (map) {
+        return clEnqueueSVMMap(queue, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, data, size, 0, NULL, NULL);
+    }
+    return clEnqueueSVMUnmap(queue, data, 0, NULL, NULL);
+}
+
+// free a host scratch buffer of frame, plain or SVM
+static inline void pqoi_frame_free_host(pqoi_frame_t *frame, void *buffer, size_t capacity){
+    if (!frame->svm) {
+        free(buffer);
+    }
+    else if (buffer) {
+        pqoi_svm_map(frame->svm_queue, frame->svm, buffer, capacity, 0);
+        clFinish(frame->svm_queue);
+        clSVMFree(frame->svm_context, buffer);
+    }
+}
+
+// free an SVM scratch buffer of frame the host didn't get back, the next reserve allocates it again
+static inline void pqoi_frame_drop_svm(pqoi_frame_t *frame, void **buffer, size_t *capacity){
+    clFinish(frame->svm_queue);
+    clSVMFree(frame->svm_context, *buffer);
+    *buffer = NULL;
+    *capacity = 0;
+}
+
+// release the device buffers of frame, the next encode creates them again
+static inline void pqoi_frame_release_device(pqoi_frame_t *frame){
+    if (frame->pixel_buffer) clReleaseMemObject(frame->pixel_buffer);
+    if (frame->bytes_buffer) clReleaseMemObject(frame->bytes_buffer);
+    if (frame->segment_lengths_buffer) clReleaseMemObject(frame->segment_lengths_buffer);
+    if (frame->segment_offsets_buffer) clReleaseMemObject(frame->segment_offsets_buffer);
+    if (frame->stats_buffer) clReleaseMemObject(frame->stats_buffer);
+    frame->pixel_buffer = frame->bytes_buffer = frame->segment_lengths_buffer = frame->segment_offsets_buffer = frame->stats_buffer = NULL;
+    frame->pixel_capacity = frame->bytes_capacity = frame->segments_capacity = frame->offsets_capacity = frame->stats_capacity = 0;
+}
+
+static inline void pqoi_frame_release(pqoi_frame_t *frame){
+    pqoi_frame_release_device(frame);
+
+    pqoi_frame_free_host(frame, frame->bytes, frame->host_bytes_capacity);
+    pqoi_frame_free_host(frame, frame->segment_lengths, frame->host_segments_capacity);
+    pqoi_frame_free_host(frame, frame->svm_pixels, frame->svm_pixels_capacity);
+    free(frame->segment_offsets);
+    free(frame->stats);
+    memset(frame, 0, sizeof(*frame));
+}
+
+void pqoi_session_release(pqoi_session_t *session){
+    if (session->queue) {
+        clFinish(session->queue);
+    }
+    while (session->svm_blocks) {
+        pqoi_svm_free(session, session->svm_blocks->data);
+    }
+    for (int i = 0; i < PQOI_STRIPE_QUEUES; i++) {
+        if (session->stripe_queues[i]) {
+            clFinish(session->stripe_queues[i]);
+            clReleaseCommandQueue(session->stripe_queues[i]);
+        }
+    }
+    pqoi_frame_release(&session->frame);
+
+    // a session that failed pqoi_session_init has only some of these
+    if (session->queue) clReleaseCommandQueue(session->queue);
+    if (session->decode_kernel) clReleaseKernel(session->decode_kernel);
+    if (session->tiles_kernel) clReleaseKernel(session->tiles_kernel);
+    if (session->sequence_kernel) clReleaseKernel(session->sequence_kernel);
+    if (session->ocl.kernel) clReleaseKernel(session->ocl.kernel);
+    if (session->ocl.program) clReleaseProgram(session->ocl.program);
+    if (session->ocl.context) clReleaseContext(session->ocl.context);
+    if (session->ocl.device_id) clReleaseDevice(session->ocl.device_id);
+    memset(session, 0, sizeof(*session));
+}
+
+// worst case size of an encoded image with its segment index, dst buffers of this size never overflow
+// returns 0 for descriptions the encoder doesn't accept
+int pqoi_max_encoded_size(const qoi_desc *desc){
+    if (
+        desc == NULL ||
+        desc->width == 0 || desc->height == 0 ||
+        desc->channels < 3 || desc->channels > 4 ||
+        desc->colorspace > 1 ||
+        desc->height >= QOI_PIXELS_MAX / desc->width
+    ) {
+        return 0;
+    }
+
+    size_t max_size = desc->height * PQOI_SEGMENT_STRIDE(desc) + QOI_HEADER_SIZE + sizeof(qoi_padding) + PQOI_INDEX_SIZE(desc);
+    return max_size > INT_MAX ? 0 : (int)max_size;
+}
+
+// grow a device buffer, the old contents are not kept
+// returns CL_SUCCESS or the error of clCreateBuffer, the buffer is gone then
+static inline cl_int pqoi_reserve_buffer(pqoi_session_t *session, cl_mem *buffer, size_t *capacity, size_t size, cl_mem_flags flags){
+    if (*capacity >= size) {
+        return CL_SUCCESS;
+    }
+    if (*buffer) {
+        clReleaseMemObject(*buffer);
+    }
+    *buffer = clCreateBuffer(session->ocl.context, flags, size, NULL, &session->ocl.err);
+    if (session->ocl.err != CL_SUCCESS) {
+        *buffer = NULL;
+        *capacity = 0;
+        return session->ocl.err;
+    }
+    *capacity = size;
+    return CL_SUCCESS;
+}
+
+// grow a host scratch buffer, the old contents are not kept
+static inline int pqoi_reserve_host(void **buffer, size_t *capacity, size_t size){
+    if (*capacity >= size) {
+        return 1;
+    }
+    free(*buffer);
+    *buffer = malloc(size);
+    *capacity = *buffer ? size : 0;
+    return *buffer != NULL;
+}
+
+// grow a host scratch buffer of frame, in SVM when the frame uses it, the old contents are not kept
+static inline int pqoi_reserve_frame_host(pqoi_frame_t *frame, void **buffer, size_t *capacity, size_t size){
+    if (!frame->svm) {
+        return pqoi_reserve_host(buffer, capacity, size);
+    }
+    if (*capacity >= size) {
+        return 1;
+    }
+
+    pqoi_frame_free_host(frame, *buffer, *capacity);
+    *buffer = clSVMAlloc(frame->svm_context, CL_MEM_READ_WRITE | (frame->svm == PQOI_SVM_FINE ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0), size, 0);
+    *capacity = *buffer ? size : 0;
+    if (*buffer && pqoi_svm_map(frame->svm_queue, frame->svm, *buffer, size, 1) != CL_SUCCESS) {
+        pqoi_frame_drop_svm(frame, buffer, capacity);
+    }
+    return *buffer != NULL;
+}
+
+// make sure the frame can hold the host side of an image
+// the op counters are small next to the segments and always have room, the kernel never writes them in place
+static inline int pqoi_reserve_frame(pqoi_frame_t *frame, const qoi_desc *desc){
+    return
+        pqoi_reserve_frame_host(frame, (void **)&frame->bytes, &frame->host_bytes_capacity, desc->height * PQOI_SEGMENT_STRIDE(desc)) &&
+        pqoi_reserve_frame_host(frame, (void **)&frame->segment_lengths, &frame->host_segments_capacity, desc->height * sizeof(unsigned int)) &&
+        pqoi_reserve_host((void **)&frame->stats, &frame->host_stats_capacity, desc->height * PQOI_STAT_COUNT * sizeof(unsigned int));
+}
+
+// move the host side of the session frame into shared virtual memory, fine-grained if the device
+// has it and coarse-grained otherwise, and encode through clSetKernelArgSVMPointer from then on
+// returns PQOI_SVM_FINE, PQOI_SVM_COARSE or 0 if the device has no SVM (OpenCL 1.x)
+int pqoi_session_enable_svm(pqoi_session_t *session){
+    cl_device_svm_capabilities caps = 0;
+    if (clGetDeviceInfo(session->ocl.device_id, CL_DEVICE_SVM_CAPABILITIES, sizeof(caps), &caps, NULL) != CL_SUCCESS) {
+        caps = 0;
+    }
+
+    int svm = (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) ? PQOI_SVM_FINE : (caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) ? PQOI_SVM_COARSE : 0;
+    if (svm && !session->frame.svm) {
+        // the scratch is allocated again in SVM by the next encode
+        clFinish(session->queue);
+        pqoi_frame_release(&session->frame);
+        session->frame.svm = svm;
+        session->frame.svm_context = session->ocl.context;
+        session->frame.svm_queue = session->queue;
+    }
+    return svm;
+}
+
+// allocate size bytes of SVM on a session with pqoi_session_enable_svm, pixels placed here are
+// encoded without any copy. Coarse-grained memory is mapped for the host between encodes
+// returns the memory (pqoi_svm_free) or NULL
+void *pqoi_svm_alloc(pqoi_session_t *session, size_t size){
+    pqoi_frame_t *frame = &session->frame;
+    if (!frame->svm || size == 0) {
+        return NULL;
+    }
+
+    pqoi_svm_block_t *block = (pqoi_svm_block_t *)calloc(1, sizeof(pqoi_svm_block_t));
+    if (!block) {
+        return NULL;
+    }
+    block->data = (unsigned char *)clSVMAlloc(frame->svm_context, CL_MEM_READ_WRITE | (frame->svm == PQOI_SVM_FINE ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0), size, 0);
+    if (!block->data) {
+        free(block);
+        return NULL;
+    }
+
+    if (pqoi_svm_map(frame->svm_queue, frame->svm, block->data, size, 1) != CL_SUCCESS) {
+        clFinish(frame->svm_queue);
+        clSVMFree(frame->svm_context, block->data);
+        free(block);
+        return NULL;
+    }
+    block->size = size;
+    block->mapped = 1;
+    block->next = session->svm_blocks;
+    session->svm_blocks = block;
+    return block->data;
+}
+
+void pqoi_svm_free(pqoi_session_t *session, void *data){
+    for (pqoi_svm_block_t **link = &session->svm_blocks; *link; link = &(*link)->next) {
+        pqoi_svm_block_t *block = *link;
+        if (block->data == data) {
+            if (block->mapped) {
+                pqoi_svm_map(session->frame.svm_queue, session->frame.svm, block->data, block->size, 0);
+            }
+            clFinish(session->queue);
+            clSVMFree(session->ocl.context, block->data);
+            *link = block->next;
+            free(block);
+            return;
+        }
+    }
+}
+
+// the description an image is encoded with on the session: desc with QOI_COLOR_YCOCG in its colorspace
+// when PQOI_YCOCG is set, so the kernel transforms the pixels and the header says so
+static inline qoi_desc pqoi_coded_desc(const pqoi_session_t *session, const qoi_desc *desc){
+    qoi_desc coded = *desc;
+    if (session->flags & PQOI_YCOCG) {
+        coded.colorspace |= QOI_COLOR_YCOCG;
+    }
+    return coded;
+}
+
+// the event slot of a command that is only kept for the trace, NULL without a trace
+static inline cl_event *pqoi_trace_slot(const pqoi_session_t *session, cl_event *event){
+    *event = NULL;
+    return session->trace ? event : NULL;
+}
+
+// hand a command from pqoi_trace_slot to the trace and drop the event, NULL does nothing
+static inline void pqoi_trace_take(pqoi_session_t *session, cl_event *event, const char *name, const char *track){
+    if (*event) {
+        pqoi_trace_command(session->trace, *event, name, track);
+        clReleaseEvent(*event);
+        *event = NULL;
+    }
+}
+
+// monotonic wall clock seconds, clock() would add up the time of every thread
+static inline double pqoi_wall_time(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+// check the segments of frame against the pixels they came from, the first failure goes to *m and stderr
+// returns 1 if they check out
+static inline int pqoi_check_frame(const pqoi_frame_t *frame, const void *data, int src_channels, const qoi_desc *desc, pqoi_mismatch_t *m){
+    double begin = pqoi_wall_time();
+    int ok = pqoi_verify_segments(frame->bytes, PQOI_SEGMENT_STRIDE(desc), frame->segment_lengths, desc,
+        (const unsigned char *)data, src_channels, 0, m);
+    printf("CPU QOI verify time: %lfs\n", pqoi_wall_time() - begin);
+
+    if (!ok) {
+        fprintf(stderr, "Verification failed at pixel (%u, %u): %s, expected %u %u %u %u, decoded %u %u %u %u\n",
+            m->x, m->y, m->reason,
+            m->expected[0], m->expected[1], m->expected[2], m->expected[3],
+            m->actual[0], m->actual[1], m->actual[2], m->actual[3]);
+    }
+    return ok;
+}
 
+// check the segments of the session frame against the pixels they came from when PQOI_VERIFY is set
+// returns 1 if they check out or verification is off
+static inline int pqoi_verify_frame(pqoi_session_t *session, const void *data, int src_channels, const qoi_desc *desc){
+    if (!(session->flags & PQOI_VERIFY)) {
+        return 1;
+    }
 
-	// prepare image and kernels
-    int max_size =
-        desc->width * desc->height * (desc->channels + 1) +
-        QOI_HEADER_SIZE + sizeof(qoi_padding);
+    pqoi_perf_begin(session->perf, "verify");
+    int ok = pqoi_check_frame(&session->frame, data, src_channels, desc, &session->mismatch);
+    pqoi_perf_end(session->perf, NULL);
+    return ok;
+}
 
-    // calloc instead of QOI_MALLOC for cleanly separated data after compression
-    unsigned char *bytes = (unsigned char *) calloc(max_size, sizeof(unsigned char));
+// encode target image using opencl parallel computing into dst
+// dst_capacity should be at least pqoi_max_encoded_size(desc)
+// returns the size of the data written or 0 on failure
+int pqoi_encode_into(pqoi_session_t *session, const void *data, const qoi_desc *desc, void *dst, int dst_capacity){
+    return pqoi_encode_channels_into(session, data, desc->channels, desc, dst, dst_capacity);
+}
 
-    const unsigned char *pixels = (const unsigned char *)data;
-    int px_len = desc->width * desc->height * desc->channels;
+// encode target image like pqoi_encode_into from pixels with src_channels channels
+// (1 gray, 2 gray + alpha, 3 RGB, 4 RGBA), desc->channels must be PQOI_QOI_CHANNELS(src_channels)
+// gray is expanded by the kernel, only the source bytes are uploaded
+// returns the size of the data written or 0 on failure
+int pqoi_encode_channels_into(pqoi_session_t *session, const void *data, int src_channels, const qoi_desc *desc, void *dst, int dst_capacity){
+    if (data == NULL || dst == NULL || pqoi_max_encoded_size(desc) == 0 ||
+        src_channels < 1 || src_channels > 4 || PQOI_QOI_CHANNELS(src_channels) != desc->channels) {
+        return 0;
+    }
 
-    // length of each compressed segment
-	unsigned int segment_lengths[desc->height];
+    if (!pqoi_reserve_frame(&session->frame, desc)) {
+        return 0;
+    }
 
-    // add header info
-    // merge compressed segments
-    // remove artifacts and redundant chunks
-    parallel_process(bytes, max_size, pixels, px_len, segment_lengths, desc, &ocl);
+    // compress every row (segment) independently
+    qoi_desc coded = pqoi_coded_desc(session, desc);
+    if (!parallel_process(session, (const unsigned char *)data, src_channels, &coded)) {
+        return 0;
+    }
+    if (!pqoi_verify_frame(session, data, src_channels, &coded)) {
+        return 0;
+    }
 
-    int merged_size;
+    pqoi_perf_begin(session->perf, "merge");
+    double traced = pqoi_trace_begin(session->trace);
     clock_t begin = clock();
-    unsigned char *merged = merge_segments(bytes, segment_lengths, desc, &merged_size);
-    free(bytes);
+    int size = merge_segments(session->frame.bytes, session->frame.segment_lengths, &coded, session->flags, (unsigned char *)dst, dst_capacity);
     clock_t end = clock();
-
+    pqoi_trace_span(session->trace, "merge", NULL, traced);
+    pqoi_perf_end(session->perf, NULL);
 
     double time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
     printf("OpenCL QOI encoder merge time: %lfs\n", time_spent);
 
-    // don't need segments anymore
-    *out_len = merged_size;
-        
-    return merged;
+    return size;
+}
+
+// runs on an OpenCL runtime thread once the last read of the job has finished
+// the result is published before the callback runs, so it sees the job done
+static void CL_CALLBACK pqoi_job_complete(cl_event event, cl_int event_status, void *user_data){
+    pqoi_job_t *job = (pqoi_job_t *)user_data;
+    (void)event;
+
+    int size = 0;
+    int flags = job->session->flags;
+    if (event_status == CL_COMPLETE &&
+        (!(flags & PQOI_VERIFY) || pqoi_check_frame(&job->frame, job->data, job->desc.channels, &job->desc, &job->mismatch))) {
+        double traced = pqoi_trace_begin(job->session->trace);
+        size = merge_segments(job->frame.bytes, job->frame.segment_lengths, &job->desc, flags, job->dst, job->dst_capacity);
+        pqoi_trace_span(job->session->trace, "merge", NULL, traced);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->size = size;
+    job->status = size ? 1 : -1;
+    pthread_cond_broadcast(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+
+    if (job->callback) {
+        job->callback(job, job->user_data);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->settled = 1;
+    pthread_cond_broadcast(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+}
+
+// start encoding target image and return without waiting for the device
+// data must stay valid and unchanged until the job is done, PQOI_VERIFY checks the segments against it
+// callback (optional) is called from an OpenCL runtime thread once the job is done (pqoi_job_wait returns
+// right away then), it must not release the job itself
+// returns the job handle or NULL if the job couldn't be submitted, the blocking calls fall back where this can't
+pqoi_job_t *pqoi_encode_async(pqoi_session_t *session, const void *data, const qoi_desc *desc, void *dst, int dst_capacity,
+    pqoi_encode_callback callback, void *user_data) {
+
+    if (data == NULL || dst == NULL || pqoi_max_encoded_size(desc) == 0) {
+        return NULL;
+    }
+
+    pqoi_job_t *job = (pqoi_job_t *)calloc(1, sizeof(pqoi_job_t));
+    if (!job) {
+        return NULL;
+    }
+    if (!pqoi_reserve_frame(&job->frame, desc)) {
+        pqoi_frame_release(&job->frame);
+        free(job);
+        return NULL;
+    }
+
+    job->session = session;
+    job->desc = pqoi_coded_desc(session, desc);
+    job->data = (const unsigned char *)data;
+    job->dst = (unsigned char *)dst;
+    job->dst_capacity = dst_capacity;
+    job->callback = callback;
+    job->user_data = user_data;
+
+    cl_event kernel_event;
+    cl_int err = parallel_enqueue(session, &job->frame, (const unsigned char *)data, desc->channels, &job->desc, &kernel_event, &job->done);
+    if (err == CL_SUCCESS) {
+        clReleaseEvent(kernel_event);
+        pthread_mutex_init(&job->lock, NULL);
+        pthread_cond_init(&job->finished, NULL);
+        err = clSetEventCallback(job->done, CL_COMPLETE, pqoi_job_complete, job);
+        if (err != CL_SUCCESS) {
+            clWaitForEvents(1, &job->done);
+            clReleaseEvent(job->done);
+            pthread_mutex_destroy(&job->lock);
+            pthread_cond_destroy(&job->finished);
+        }
+    }
+    if (err != CL_SUCCESS) {
+        session->error = err;
+        pqoi_frame_release(&job->frame);
+        free(job);
+        return NULL;
+    }
+    clFlush(session->queue);
+
+    return job;
+}
+
+// returns 1 once the job has finished (successfully or not), 0 while it is in flight
+int pqoi_job_done(pqoi_job_t *job){
+    pthread_mutex_lock(&job->lock);
+    int done = job->status != 0;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+// block until the job has finished
+// returns the size of the encoded image or 0 on failure
+int pqoi_job_wait(pqoi_job_t *job){
+    pthread_mutex_lock(&job->lock);
+    while (job->status == 0) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    }
+    int size = job->size;
+    pthread_mutex_unlock(&job->lock);
+    return size;
+}
+
+// wait for the job and its callback and free its resources, dst stays with the caller
+void pqoi_job_release(pqoi_job_t *job){
+    pthread_mutex_lock(&job->lock);
+    while (!job->settled) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    clReleaseEvent(job->done);
+    pqoi_frame_release(&job->frame);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->finished);
+    free(job);
+}
+
+// encode target image using opencl parallel computing
+// returns the encoded data or NULL on failure, out_len is set to its size
+void *parallel_qoi_encode(const void *data, const qoi_desc *desc, int *out_len){
+    int max_size = pqoi_max_encoded_size(desc);
+    if (max_size == 0) {
+        return NULL;
+    }
+
+    // QOI_MALLOC instead of calloc, only the written pages are ever touched
+    unsigned char *encoded = (unsigned char *) QOI_MALLOC(max_size);
+    if (!encoded) {
+        return NULL;
+    }
+
+    pqoi_session_t session;
+    pqoi_session_init(&session);
+    int size = pqoi_encode_into(&session, data, desc, encoded, max_size);
+    pqoi_session_release(&session);
+
+    if (size == 0) {
+        QOI_FREE(encoded);
+        return NULL;
+    }
+
+    *out_len = size;
+    return encoded;
 }
 
-void parallel_process(unsigned char *bytes, int bytes_len, const unsigned char *pixels, int pixels_len, unsigned int *segment_lengths,
-    const qoi_desc *desc, ocl_res_t *ocl) {
-    
-    // bind opencl buffers and launch kernel
-    cl_mem pixel_buffer = clCreateBuffer(ocl->context, CL_MEM_READ_ONLY, pixels_len * sizeof(unsigned char), NULL, NULL);
-    cl_mem bytes_buffer = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, bytes_len * sizeof(unsigned char), NULL, NULL);
-    cl_mem segment_lengths_buffer = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, desc->height * sizeof(unsigned int), NULL, NULL);
+// size the device buffers of frame for an image and bind them to the encode kernel
+// returns CL_SUCCESS or the first error
+static inline cl_int pqoi_bind_encode(pqoi_session_t *session, pqoi_frame_t *frame, int src_channels, const qoi_desc *desc){
+    ocl_res_t *ocl = &session->ocl;
+    size_t pixels_len = (size_t)desc->width * desc->height * src_channels;
+    size_t bytes_len = desc->height * PQOI_SEGMENT_STRIDE(desc);
+    size_t n_segments = desc->height;
+
+    // read and write, the decoder reuses it for its output
+    cl_int err = pqoi_reserve_buffer(session, &frame->pixel_buffer, &frame->pixel_capacity, pixels_len, CL_MEM_READ_WRITE);
+    if (err == CL_SUCCESS) err = pqoi_reserve_buffer(session, &frame->bytes_buffer, &frame->bytes_capacity, bytes_len, CL_MEM_READ_WRITE);
+    if (err == CL_SUCCESS) err = pqoi_reserve_buffer(session, &frame->segment_lengths_buffer, &frame->segments_capacity, n_segments * sizeof(unsigned int), CL_MEM_READ_WRITE);
+
+    // without PQOI_STATS the kernel gets no counter buffer and skips the stores
+    cl_mem stats = NULL;
+    if (err == CL_SUCCESS && (session->flags & PQOI_STATS)) {
+        err = pqoi_reserve_buffer(session, &frame->stats_buffer, &frame->stats_capacity, n_segments * PQOI_STAT_COUNT * sizeof(unsigned int), CL_MEM_WRITE_ONLY);
+        stats = frame->stats_buffer;
+    }
 
+    // the arguments are captured when the kernel is enqueued, so frames can share the kernel
     // TODO: adjust work item sizes in case img_height > CL_DEVICE_MAX_WORK_ITEM_SIZES
-    clSetKernelArg(ocl->kernel, 0, sizeof(cl_mem), (void*)&pixel_buffer);
-    clSetKernelArg(ocl->kernel, 1, sizeof(cl_mem), (void*)&bytes_buffer);
-    clSetKernelArg(ocl->kernel, 2, sizeof(cl_mem), (void*)&segment_lengths_buffer);
-    clSetKernelArg(ocl->kernel, 3, sizeof(int), (void*)&desc->width);
-    clSetKernelArg(ocl->kernel, 4, sizeof(int), (void*)&desc->channels);
-
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    #pragma GCC diagnostic ignored "-Wint-conversion"
-    cl_command_queue command_queue = clCreateCommandQueue(ocl->context, ocl->device_id, CL_QUEUE_PROFILING_ENABLE, NULL);
-    #pragma GCC diagnostic pop
+    // channels is an unsigned char in qoi_desc, the kernel takes ints
+    int width = desc->width;
+    int channels = desc->channels;
+    int transform = (desc->colorspace & QOI_COLOR_YCOCG) != 0;
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 0, sizeof(cl_mem), (void*)&frame->pixel_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 1, sizeof(cl_mem), (void*)&frame->bytes_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 2, sizeof(cl_mem), (void*)&frame->segment_lengths_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 3, sizeof(int), (void*)&width);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 4, sizeof(int), (void*)&channels);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 5, sizeof(int), (void*)&src_channels);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 6, sizeof(int), (void*)&transform);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 7, sizeof(cl_mem), (void*)&stats);
+    return err;
+}
+
+// queue the upload, the kernel and the reads of one image without waiting for any of them
+// pixels have src_channels channels, the upload is only as large as the source
+// kernel_event and read_event are set to the kernel launch and the last read, the caller releases them
+// returns CL_SUCCESS or the first error, nothing is left in flight and both events are NULL then
+cl_int parallel_enqueue(pqoi_session_t *session, pqoi_frame_t *frame, const unsigned char *pixels, int src_channels, const qoi_desc *desc,
+    cl_event *kernel_event, cl_event *read_event) {
+
+    ocl_res_t *ocl = &session->ocl;
+    size_t pixels_len = (size_t)desc->width * desc->height * src_channels;
+    size_t bytes_len = desc->height * PQOI_SEGMENT_STRIDE(desc);
+    size_t n_segments = desc->height;
+
+    *kernel_event = NULL;
+    *read_event = NULL;
+    if (session->queue == NULL) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    cl_int err = pqoi_bind_encode(session, frame, src_channels, desc);
+    cl_event traced = NULL;
 
     // pixels --> pixel_buffer
-    clEnqueueWriteBuffer(
-        command_queue,
-        pixel_buffer,
+    if (err == CL_SUCCESS) err = clEnqueueWriteBuffer(
+        session->queue,
+        frame->pixel_buffer,
         CL_FALSE,
         0,
         pixels_len * sizeof(unsigned char),
         pixels,
         0,
         NULL,
-        NULL
+        pqoi_trace_slot(session, &traced)
     );
-    
+    pqoi_trace_take(session, &traced, "upload", "queue");
+
     // apply kernel to every line (segment) of the image
-    cl_event event;
-    clEnqueueNDRangeKernel(
-        command_queue,
+    if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(
+        session->queue,
         ocl->kernel,
         1,
         NULL,
-        &desc->height,
+        &n_segments,
         NULL,
         0,
         NULL,
-        &event
+        kernel_event
     );
+    pqoi_trace_command(session->trace, *kernel_event, "encode", "queue");
 
     // bytes_buffer --> bytes
-    clEnqueueReadBuffer(
-        command_queue,
-        bytes_buffer,
-        CL_TRUE,
+    if (err == CL_SUCCESS) err = clEnqueueReadBuffer(
+        session->queue,
+        frame->bytes_buffer,
+        CL_FALSE,
         0,
         bytes_len * sizeof(unsigned char),
-        bytes,
+        frame->bytes,
+        0,
+        NULL,
+        pqoi_trace_slot(session, &traced)
+    );
+    pqoi_trace_take(session, &traced, "read bytes", "queue");
+
+    // stats_buffer --> stats, ahead of the last read so read_event covers it
+    if (err == CL_SUCCESS && (session->flags & PQOI_STATS)) err = clEnqueueReadBuffer(
+        session->queue,
+        frame->stats_buffer,
+        CL_FALSE,
+        0,
+        n_segments * PQOI_STAT_COUNT * sizeof(unsigned int),
+        frame->stats,
         0,
         NULL,
-        NULL
+        pqoi_trace_slot(session, &traced)
     );
+    pqoi_trace_take(session, &traced, "read stats", "queue");
 
     // segments_buffer --> segments
-    clEnqueueReadBuffer(
-        command_queue,
-        segment_lengths_buffer,
-        CL_TRUE,
+    if (err == CL_SUCCESS) err = clEnqueueReadBuffer(
+        session->queue,
+        frame->segment_lengths_buffer,
+        CL_FALSE,
         0,
-        desc->height * sizeof(unsigned int),
-        segment_lengths,
+        n_segments * sizeof(unsigned int),
+        frame->segment_lengths,
         0,
         NULL,
-        NULL
+        read_event
     );
+    pqoi_trace_command(session->trace, *read_event, "read lengths", "queue");
 
-    // measure kernel execution time
-    clWaitForEvents(1, &event);
-    clFinish(command_queue);
+    if (err != CL_SUCCESS) {
+        // whatever made it into the queue still reads pixels and writes the frame
+        clFinish(session->queue);
+        if (*kernel_event) {
+            clReleaseEvent(*kernel_event);
+        }
+        *kernel_event = NULL;
+        *read_event = NULL;
+    }
+    return err;
+}
 
+// time between the start of one event and the end of another, in seconds
+static inline double pqoi_event_span(cl_event first, cl_event last){
     cl_ulong time_start;
     cl_ulong time_end;
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+    clGetEventProfilingInfo(first, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+    clGetEventProfilingInfo(last, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+    return (double)(time_end - time_start) / 1.0e9;
+}
 
-    double ns = time_end-time_start;
-    printf("OpenCL kernel execution time: %lfs\n", ns/1.0e9);
+// parallel_process in session->stripes row stripes: every stripe is uploaded, encoded and read back
+// on its own, chained by events across the upload, kernel and download queue, so stripe i + 1
+// uploads while stripe i runs and stripe i - 1 comes back. The kernel sees the absolute rows
+// through the global work offset and the buffers are addressed by offset, no sub-buffers needed
+// returns CL_SUCCESS or the first error, nothing is left in flight then
+static cl_int pqoi_process_striped(pqoi_session_t *session, const unsigned char *pixels, int src_channels, const qoi_desc *desc){
+    ocl_res_t *ocl = &session->ocl;
+    pqoi_frame_t *frame = &session->frame;
 
-    // release resources
-    clReleaseKernel(ocl->kernel);
-    clReleaseProgram(ocl->program);
-    clReleaseContext(ocl->context);
-    clReleaseDevice(ocl->device_id);
+    for (int i = 0; i < PQOI_STRIPE_QUEUES; i++) {
+        if (session->stripe_queues[i] == NULL) {
+            #pragma GCC diagnostic push
+            #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+            session->stripe_queues[i] = clCreateCommandQueue(ocl->context, ocl->device_id, CL_QUEUE_PROFILING_ENABLE, &ocl->err);
+            #pragma GCC diagnostic pop
+            if (ocl->err != CL_SUCCESS) {
+                session->stripe_queues[i] = NULL;
+                return ocl->err;
+            }
+        }
+    }
+    cl_command_queue upload = session->stripe_queues[0];
+    cl_command_queue compute = session->stripe_queues[1];
+    cl_command_queue download = session->stripe_queues[2];
 
-    clReleaseMemObject(pixel_buffer);
-    clReleaseMemObject(bytes_buffer);
-    clReleaseMemObject(segment_lengths_buffer);
-}
+    unsigned int n_stripes = session->stripes < desc->height ? session->stripes : desc->height;
+    cl_event *events = (cl_event *)calloc(n_stripes * 3, sizeof(cl_event));
+    if (!events) {
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+    cl_event *written = events;
+    cl_event *encoded = events + n_stripes;
+    cl_event *read = events + 2 * n_stripes;
 
-static inline unsigned char *merge_segments(unsigned char *bytes, unsigned int *segment_lengths, const qoi_desc *desc, int *total_size){
-    int merged_size = 0;
-    for (int i = 0; i < desc->height; i++){
-        merged_size += segment_lengths[i];
+    cl_int err = pqoi_bind_encode(session, frame, src_channels, desc);
+    size_t row_pixels = (size_t)desc->width * src_channels;
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
+    cl_event traced = NULL;
+
+    for (unsigned int i = 0; i < n_stripes && err == CL_SUCCESS; i++) {
+        size_t first = (size_t)desc->height * i / n_stripes;
+        size_t rows = (size_t)desc->height * (i + 1) / n_stripes - first;
+
+        // pixels --> pixel_buffer, this stripe only
+        err = clEnqueueWriteBuffer(upload, frame->pixel_buffer, CL_FALSE, first * row_pixels, rows * row_pixels,
+            pixels + first * row_pixels, 0, NULL, &written[i]);
+        pqoi_trace_command(session->trace, written[i], "upload", "upload");
+
+        // the work item ids stay the absolute row numbers
+        if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(compute, ocl->kernel, 1, &first, &rows, NULL, 1, &written[i], &encoded[i]);
+        pqoi_trace_command(session->trace, encoded[i], "encode", "compute");
+
+        // bytes_buffer --> bytes, stats_buffer --> stats, segments_buffer --> segments
+        if (err == CL_SUCCESS) err = clEnqueueReadBuffer(download, frame->bytes_buffer, CL_FALSE, first * stride, rows * stride,
+            frame->bytes + first * stride, 1, &encoded[i], pqoi_trace_slot(session, &traced));
+        pqoi_trace_take(session, &traced, "read bytes", "download");
+        if (err == CL_SUCCESS && (session->flags & PQOI_STATS)) {
+            size_t counters = PQOI_STAT_COUNT * sizeof(unsigned int);
+            err = clEnqueueReadBuffer(download, frame->stats_buffer, CL_FALSE, first * counters, rows * counters,
+                frame->stats + first * PQOI_STAT_COUNT, 1, &encoded[i], pqoi_trace_slot(session, &traced));
+            pqoi_trace_take(session, &traced, "read stats", "download");
+        }
+        if (err == CL_SUCCESS) err = clEnqueueReadBuffer(download, frame->segment_lengths_buffer, CL_FALSE, first * sizeof(unsigned int), rows * sizeof(unsigned int),
+            frame->segment_lengths + first, 1, &encoded[i], &read[i]);
+        pqoi_trace_command(session->trace, read[i], "read lengths", "download");
+
+        // hand every stripe over as soon as it is queued
+        clFlush(upload);
+        clFlush(compute);
+        clFlush(download);
     }
-    merged_size += QOI_HEADER_SIZE + sizeof(qoi_padding);
-    unsigned char *merged = (unsigned char*)calloc(merged_size, sizeof(unsigned char));
 
-    int p = 0;
+    if (err == CL_SUCCESS) {
+        err = clWaitForEvents(n_stripes, read);
+    }
+    if (err == CL_SUCCESS) {
+        printf("OpenCL kernel execution time: %lfs\n", pqoi_event_span(encoded[0], encoded[n_stripes - 1]));
+        printf("OpenCL stripe pipeline time: %lfs (%u stripes)\n", pqoi_event_span(written[0], read[n_stripes - 1]), n_stripes);
+    }
+    else {
+        for (int i = 0; i < PQOI_STRIPE_QUEUES; i++) {
+            clFinish(session->stripe_queues[i]);
+        }
+    }
 
-    // add header
-    qoi_write_32(merged, &p, QOI_MAGIC);
-    qoi_write_32(merged, &p, desc->width);
-    qoi_write_32(merged, &p, desc->height);
-    merged[p++] = desc->channels;
-    merged[p++] = desc->colorspace;
+    for (unsigned int i = 0; i < 3 * n_stripes; i++) {
+        if (events[i]) {
+            clReleaseEvent(events[i]);
+        }
+    }
+    free(events);
+    return err;
+}
 
-    // merge segments
-    int k;
-    for (int i = 0; i < desc->height; i++){
-        k = i * desc->width * (desc->channels + 1);
-        memcpy(&merged[p], &bytes[k], segment_lengths[i]);
-        p += segment_lengths[i];
+// count the ops of the segments of frame from first_row on into frame->stats, for rows the kernel didn't count
+static inline void pqoi_count_frame(pqoi_frame_t *frame, const qoi_desc *desc, unsigned int first_row){
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
+    for (unsigned int row = first_row; row < desc->height; row++){
+        pqoi_count_ops(frame->bytes + row * stride, frame->segment_lengths[row], frame->stats + row * PQOI_STAT_COUNT);
     }
+}
 
-    *total_size = merged_size;
-    return merged;
+// the pqoi_svm_alloc block holding pixels_len bytes at pixels, or NULL if they aren't in one
+static inline pqoi_svm_block_t *pqoi_find_svm_block(pqoi_session_t *session, const unsigned char *pixels, size_t pixels_len){
+    pqoi_svm_block_t *block = session->svm_blocks;
+    while (block && !(pixels >= block->data && pixels_len <= block->size && (size_t)(pixels - block->data) <= block->size - pixels_len)) {
+        block = block->next;
+    }
+    return block;
 }
 
-int parallel_qoi_write(const char *filename, const void *data, const qoi_desc *desc){
-    FILE *f = fopen(filename, "wb");
-    int size, err;
-    void *encoded;
+// parallel_process with shared virtual memory: the kernel reads the pixels and writes the segments
+// in place, pixels from pqoi_svm_alloc aren't copied at all, others are staged in SVM on the host
+// returns CL_SUCCESS or the first error. A region the host doesn't get back is never touched again:
+// the scratch of the frame is freed (NULL until the next reserve), a pqoi_svm_alloc block is left unmapped
+static cl_int pqoi_process_svm(pqoi_session_t *session, const unsigned char *pixels, int src_channels, const qoi_desc *desc){
+    ocl_res_t *ocl = &session->ocl;
+    pqoi_frame_t *frame = &session->frame;
+    size_t pixels_len = (size_t)desc->width * desc->height * src_channels;
+    size_t n_segments = desc->height;
 
-    if (!f) {
-        return 0;
+    pqoi_svm_block_t *block = pqoi_find_svm_block(session, pixels, pixels_len);
+
+    unsigned char *source;
+    size_t source_len;
+    if (block) {
+        source = block->data;
+        source_len = block->size;
+    }
+    else {
+        if (!pqoi_reserve_frame_host(frame, (void **)&frame->svm_pixels, &frame->svm_pixels_capacity, pixels_len)) {
+            return CL_OUT_OF_HOST_MEMORY;
+        }
+        memcpy(frame->svm_pixels, pixels, pixels_len);
+        source = frame->svm_pixels;
+        source_len = frame->svm_pixels_capacity;
     }
 
-    encoded = parallel_qoi_encode(data, desc, &size);
+    // the device owns every region the kernel touches until it is done
+    void *regions[3] = { source, frame->bytes, frame->segment_lengths };
+    size_t sizes[3] = { source_len, frame->host_bytes_capacity, frame->host_segments_capacity };
+    int unmapped = 0;
+    cl_int err = CL_SUCCESS;
+    while (unmapped < 3 && err == CL_SUCCESS) {
+        err = pqoi_svm_map(session->queue, frame->svm, regions[unmapped], sizes[unmapped], 0);
+        unmapped += err == CL_SUCCESS;
+    }
 
-    if (!encoded) {
-        fclose(f);
-        return 0;
+    int width = desc->width;
+    int channels = desc->channels;
+    int transform = (desc->colorspace & QOI_COLOR_YCOCG) != 0;
+    cl_mem no_stats = NULL;
+    if (err == CL_SUCCESS) err = clSetKernelArgSVMPointer(ocl->kernel, 0, block ? pixels : source);
+    if (err == CL_SUCCESS) err = clSetKernelArgSVMPointer(ocl->kernel, 1, frame->bytes);
+    if (err == CL_SUCCESS) err = clSetKernelArgSVMPointer(ocl->kernel, 2, frame->segment_lengths);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 3, sizeof(int), (void*)&width);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 4, sizeof(int), (void*)&channels);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 5, sizeof(int), (void*)&src_channels);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 6, sizeof(int), (void*)&transform);
+    if (err == CL_SUCCESS) err = clSetKernelArg(ocl->kernel, 7, sizeof(cl_mem), (void*)&no_stats);
+
+    cl_event event = NULL;
+    if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(session->queue, ocl->kernel, 1, NULL, &n_segments, NULL, 0, NULL, &event);
+    pqoi_trace_command(session->trace, event, "encode", "queue");
+
+    // and the host gets them back, the maps wait for the kernel on the in-order queue
+    int lost[3] = { 0, 0, 0 };
+    for (int i = 0; i < unmapped; i++) {
+        cl_int status = pqoi_svm_map(session->queue, frame->svm, regions[i], sizes[i], 1);
+        lost[i] = status != CL_SUCCESS;
+        if (err == CL_SUCCESS) err = status;
+    }
+    if (event) {
+        cl_int status = clWaitForEvents(1, &event);
+        if (err == CL_SUCCESS) err = status;
+        if (err == CL_SUCCESS) {
+            printf("OpenCL kernel execution time: %lfs\n", pqoi_event_span(event, event));
+        }
+        clReleaseEvent(event);
     }
 
-    fwrite(encoded, 1, size, f);
-    fflush(f);
-    err = ferror(f);
-    fclose(f);
+    if (lost[0] && block) {
+        block->mapped = 0;
+    }
+    else if (lost[0]) {
+        pqoi_frame_drop_svm(frame, (void **)&frame->svm_pixels, &frame->svm_pixels_capacity);
+    }
+    if (lost[1]) {
+        pqoi_frame_drop_svm(frame, (void **)&frame->bytes, &frame->host_bytes_capacity);
+    }
+    if (lost[2]) {
+        pqoi_frame_drop_svm(frame, (void **)&frame->segment_lengths, &frame->host_segments_capacity);
+    }
+    return err;
+}
+
+// parallel_process in one pass on the session queue
+// returns CL_SUCCESS or the first error
+static cl_int pqoi_process_single(pqoi_session_t *session, const unsigned char *pixels, int src_channels, const qoi_desc *desc){
+    cl_event event;
+    cl_event read_event;
+    cl_int err = parallel_enqueue(session, &session->frame, pixels, src_channels, desc, &event, &read_event);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    // measure kernel execution time
+    err = clWaitForEvents(1, &read_event);
+    clReleaseEvent(read_event);
+
+    if (err == CL_SUCCESS) {
+        cl_ulong time_start;
+        cl_ulong time_end;
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+
+        double ns = time_end-time_start;
+        printf("OpenCL kernel execution time: %lfs\n", ns/1.0e9);
+    }
+    clReleaseEvent(event);
+    return err;
+}
+
+// encode the rows from *row on as sub-images of stripe_rows rows, one after the other on the session
+// queue, into the session frame. Device buffers only hold one stripe, so devices short of memory or
+// with a watchdog on long kernels get through where the whole image didn't
+// returns CL_SUCCESS or the first error, *row is the first row that isn't encoded yet
+static cl_int pqoi_process_stripes(pqoi_session_t *session, const unsigned char *pixels, int src_channels, const qoi_desc *desc,
+    unsigned int stripe_rows, unsigned int *row) {
+
+    size_t row_pixels = (size_t)desc->width * src_channels;
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
 
-    QOI_FREE(encoded);
-    return err ? 0 : size;
+    pqoi_frame_t stripe;
+    memset(&stripe, 0, sizeof(stripe));
+    cl_int err = CL_SUCCESS;
+
+    while (*row < desc->height && err == CL_SUCCESS) {
+        qoi_desc sub = *desc;
+        sub.height = desc->height - *row < stripe_rows ? desc->height - *row : stripe_rows;
+
+        // the stripe writes straight into its rows of the session frame
+        stripe.bytes = session->frame.bytes + *row * stride;
+        stripe.segment_lengths = session->frame.segment_lengths + *row;
+        stripe.stats = session->frame.stats + *row * PQOI_STAT_COUNT;
+
+        cl_event event;
+        cl_event read_event;
+        err = parallel_enqueue(session, &stripe, pixels + *row * row_pixels, src_channels, &sub, &event, &read_event);
+        if (err == CL_SUCCESS) {
+            err = clWaitForEvents(1, &read_event);
+            clReleaseEvent(event);
+            clReleaseEvent(read_event);
+        }
+        if (err == CL_SUCCESS) {
+            *row += sub.height;
+        }
+    }
+
+    // the host side belongs to the session frame
+    stripe.bytes = NULL;
+    stripe.segment_lengths = NULL;
+    stripe.stats = NULL;
+    pqoi_frame_release(&stripe);
+    return err;
+}
+
+// encode every row (segment) of the image into the session frame, which pqoi_reserve_frame sized for it
+// a device error doesn't lose the image: the rows that are left are encoded again in ever smaller
+// stripes and on the cpu once a stripe of one row fails too, or right away without a device.
+// The error is kept in session->error
+// returns 1 on success, 0 if the cpu fallback runs out of memory or the pixels are in SVM the device didn't hand back
+int parallel_process(pqoi_session_t *session, const unsigned char *pixels, int src_channels, const qoi_desc *desc) {
+    session->error = CL_SUCCESS;
+    cl_int err = CL_INVALID_COMMAND_QUEUE;
+    if (session->queue) {
+        if (session->frame.svm) {
+            // the SVM kernel writes no counters, the host reads them off the segments
+            err = pqoi_process_svm(session, pixels, src_channels, desc);
+            if (err == CL_SUCCESS && (session->flags & PQOI_STATS)) {
+                pqoi_count_frame(&session->frame, desc, 0);
+            }
+
+            // the fallback only reads and writes memory the host has back
+            pqoi_svm_block_t *block = pqoi_find_svm_block(session, pixels, (size_t)desc->width * desc->height * src_channels);
+            if (err != CL_SUCCESS && ((block && !block->mapped) || !pqoi_reserve_frame(&session->frame, desc))) {
+                session->error = err;
+                fprintf(stderr, "OpenCL SVM encode failed (%d :: %s), the host didn't get its memory back\n", err, get_error_msg(err));
+                return 0;
+            }
+        }
+        else if (session->stripes > 1 && desc->height > 1) {
+            err = pqoi_process_striped(session, pixels, src_channels, desc);
+        }
+        else {
+            err = pqoi_process_single(session, pixels, src_channels, desc);
+        }
+        if (err == CL_SUCCESS) {
+            return 1;
+        }
+    }
+    session->error = err;
+
+    unsigned int row = 0;
+    if (session->queue) {
+        // the buffers of the whole image may be what the device couldn't take
+        pqoi_frame_release_device(&session->frame);
+
+        unsigned int n_stripes = session->stripes > 1 ? session->stripes : 1;
+        while (err != CL_SUCCESS && n_stripes < desc->height) {
+            n_stripes = desc->height / n_stripes < 4 ? desc->height : n_stripes * 4;
+            unsigned int stripe_rows = (desc->height + n_stripes - 1) / n_stripes;
+            fprintf(stderr, "OpenCL encode failed (%d :: %s), retrying from row %u in stripes of %u rows\n",
+                err, get_error_msg(err), row, stripe_rows);
+            err = pqoi_process_stripes(session, pixels, src_channels, desc, stripe_rows, &row);
+        }
+        if (err == CL_SUCCESS) {
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "OpenCL encode failed (%d :: %s), encoding rows %u to %u on the cpu\n",
+        err, get_error_msg(err), row, desc->height - 1);
+    qoi_desc rest = *desc;
+    rest.height = desc->height - row;
+    pqoi_perf_begin(session->perf, "cpu encode");
+    int ok = pqoi_cpu_encode(pixels + (size_t)row * desc->width * src_channels, src_channels, &rest,
+        session->frame.bytes + row * PQOI_SEGMENT_STRIDE(desc), session->frame.segment_lengths + row, 0);
+    pqoi_perf_end(session->perf, NULL);
+    if (!ok) {
+        return 0;
+    }
+    if (session->flags & PQOI_STATS) {
+        pqoi_count_frame(&session->frame, desc, row);
+    }
+    return 1;
+}
+
+// write the segment index trailer of the given segments into dst (PQOI_INDEX_SIZE bytes)
+static inline void pqoi_write_index(const unsigned int *segment_lengths, const qoi_desc *desc, unsigned char *dst){
+    int p = 0;
+    unsigned int offset = 0;
+    for (unsigned int i = 0; i < desc->height; i++){
+        qoi_write_32(dst, &p, offset);
+        offset += segment_lengths[i];
+    }
+    qoi_write_32(dst, &p, desc->height);
+    qoi_write_32(dst, &p, PQOI_INDEX_MAGIC);
+}
+
+// write the header, the compressed segments, the padding and with PQOI_WRITE_INDEX the index into merged
+// returns the size of the merged image or 0 if it doesn't fit into merged_capacity
+static inline int merge_segments(const unsigned char *bytes, const unsigned int *segment_lengths, const qoi_desc *desc, int flags, unsigned char *merged, int merged_capacity){
+    size_t merged_size = 0;
+    for (unsigned int i = 0; i < desc->height; i++){
+        merged_size += segment_lengths[i];
+    }
+    merged_size += QOI_HEADER_SIZE + sizeof(qoi_padding);
+    if (flags & PQOI_WRITE_INDEX) {
+        merged_size += PQOI_INDEX_SIZE(desc);
+    }
+    if (merged_size > (size_t)merged_capacity) {
+        return 0;
+    }
+
+    int p = 0;
+
+    // add header
+    qoi_write_32(merged, &p, QOI_MAGIC);
+    qoi_write_32(merged, &p, desc->width);
+    qoi_write_32(merged, &p, desc->height);
+    merged[p++] = desc->channels;
+    merged[p++] = desc->colorspace;
+
+    // merge segments
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
+    for (unsigned int i = 0; i < desc->height; i++){
+        memcpy(&merged[p], &bytes[i * stride], segment_lengths[i]);
+        p += segment_lengths[i];
+    }
+
+    // add padding
+    memcpy(&merged[p], qoi_padding, sizeof(qoi_padding));
+    p += sizeof(qoi_padding);
+
+    if (flags & PQOI_WRITE_INDEX) {
+        pqoi_write_index(segment_lengths, desc, &merged[p]);
+        p += PQOI_INDEX_SIZE(desc);
+    }
+
+    return p;
+}
+
+#ifndef _WIN32
+// write every iovec, picking up after partial writes
+static inline int pqoi_writev_all(int fd, struct iovec *iov, int count){
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 1;
+}
+#endif
+
+// write head, the chunks straight out of a strided buffer (chunk i is chunk_lengths[i] bytes at i * stride)
+// and tail to a file, without merging them into one buffer first
+// returns 1 on success
+static inline int pqoi_write_chunks(const char *filename, const void *head, size_t head_len,
+    const unsigned char *bytes, size_t stride, const unsigned int *chunk_lengths, size_t n_chunks,
+    const void *tail, size_t tail_len) {
+
+#ifdef _WIN32
+    // no writev, still skip the merged copy
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        return 0;
+    }
+
+    fwrite(head, 1, head_len, f);
+    for (size_t i = 0; i < n_chunks; i++){
+        fwrite(&bytes[i * stride], 1, chunk_lengths[i], f);
+    }
+    fwrite(tail, 1, tail_len, f);
+    fflush(f);
+    int err = ferror(f);
+    fclose(f);
+    return !err;
+#else
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+
+    // one iovec per chunk, flushed every IOV_MAX entries
+    struct iovec iov[IOV_MAX];
+    int count = 0;
+    int ok = 1;
+
+    iov[count].iov_base = (void *)head;
+    iov[count++].iov_len = head_len;
+
+    for (size_t i = 0; i < n_chunks && ok; i++){
+        if (chunk_lengths[i] == 0) {
+            continue;
+        }
+        iov[count].iov_base = (void *)&bytes[i * stride];
+        iov[count++].iov_len = chunk_lengths[i];
+
+        if (count == IOV_MAX) {
+            ok = pqoi_writev_all(fd, iov, count);
+            count = 0;
+        }
+    }
+
+    if (ok) {
+        iov[count].iov_base = (void *)tail;
+        iov[count++].iov_len = tail_len;
+        ok = pqoi_writev_all(fd, iov, count);
+    }
+
+    return close(fd) == 0 && ok;
+#endif
+}
+
+// write the header, the compressed segments straight out of the strided buffer, the padding
+// and with PQOI_WRITE_INDEX the index, without merging them into one buffer first
+// returns the size of the file or 0 on failure
+int write_segments(const char *filename, const unsigned char *bytes, const unsigned int *segment_lengths, const qoi_desc *desc, int flags){
+    unsigned char header[QOI_HEADER_SIZE];
+    int p = 0;
+    qoi_write_32(header, &p, QOI_MAGIC);
+    qoi_write_32(header, &p, desc->width);
+    qoi_write_32(header, &p, desc->height);
+    header[p++] = desc->channels;
+    header[p++] = desc->colorspace;
+
+    size_t size = QOI_HEADER_SIZE;
+    for (unsigned int i = 0; i < desc->height; i++){
+        size += segment_lengths[i];
+    }
+
+    // the padding and the index go out as one piece
+    size_t tail_len = sizeof(qoi_padding) + ((flags & PQOI_WRITE_INDEX) ? PQOI_INDEX_SIZE(desc) : 0);
+    size += tail_len;
+    if (size > INT_MAX) {
+        return 0;
+    }
+
+    unsigned char *tail = (unsigned char *)malloc(tail_len);
+    if (!tail) {
+        return 0;
+    }
+    memcpy(tail, qoi_padding, sizeof(qoi_padding));
+    if (flags & PQOI_WRITE_INDEX) {
+        pqoi_write_index(segment_lengths, desc, tail + sizeof(qoi_padding));
+    }
+
+    int ok = pqoi_write_chunks(filename, header, sizeof(header), bytes, PQOI_SEGMENT_STRIDE(desc), segment_lengths, desc->height, tail, tail_len);
+    free(tail);
+    return ok ? (int)size : 0;
+}
+
+// encode target image on the session and write it to a file without the merge copy
+// returns the size of the data written or 0 on failure
+int pqoi_write(pqoi_session_t *session, const char *filename, const void *data, const qoi_desc *desc){
+    return pqoi_write_channels(session, filename, data, desc->channels, desc);
+}
+
+// encode target image like pqoi_write from pixels with src_channels channels,
+// see pqoi_encode_channels_into
+// returns the size of the data written or 0 on failure
+int pqoi_write_channels(pqoi_session_t *session, const char *filename, const void *data, int src_channels, const qoi_desc *desc){
+    if (data == NULL || pqoi_max_encoded_size(desc) == 0 ||
+        src_channels < 1 || src_channels > 4 || PQOI_QOI_CHANNELS(src_channels) != desc->channels) {
+        return 0;
+    }
+
+    if (!pqoi_reserve_frame(&session->frame, desc)) {
+        return 0;
+    }
+
+    qoi_desc coded = pqoi_coded_desc(session, desc);
+    if (!parallel_process(session, (const unsigned char *)data, src_channels, &coded)) {
+        return 0;
+    }
+    if (!pqoi_verify_frame(session, data, src_channels, &coded)) {
+        return 0;
+    }
+
+    pqoi_perf_begin(session->perf, "file write");
+    double traced = pqoi_trace_begin(session->trace);
+    int size = write_segments(filename, session->frame.bytes, session->frame.segment_lengths, &coded, session->flags);
+    pqoi_trace_span(session->trace, "file write", filename, traced);
+    pqoi_perf_end(session->perf, NULL);
+    return size;
+}
+
+int parallel_qoi_write(const char *filename, const void *data, const qoi_desc *desc){
+    pqoi_session_t session;
+    pqoi_session_init(&session);
+    int size = pqoi_write(&session, filename, data, desc);
+    pqoi_session_release(&session);
+    return size;
+}
+
+// read the header of an encoded image into desc, QOI_COLOR_YCOCG stays in its colorspace
+// returns 1 if it is a QOI header the decoder accepts
+static inline int pqoi_read_header(const unsigned char *bytes, int size, qoi_desc *desc){
+    if (bytes == NULL || size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)) {
+        return 0;
+    }
+
+    int p = 0;
+    unsigned int header_magic = qoi_read_32(bytes, &p);
+    desc->width = qoi_read_32(bytes, &p);
+    desc->height = qoi_read_32(bytes, &p);
+    desc->channels = bytes[p++];
+    desc->colorspace = bytes[p++];
+
+    qoi_desc plain = *desc;
+    plain.colorspace &= ~QOI_COLOR_YCOCG;
+    return header_magic == QOI_MAGIC && pqoi_max_encoded_size(&plain) != 0;
+}
+
+// read the segment index trailer of an image written with PQOI_WRITE_INDEX
+// offsets must hold desc->height + 1 entries, the last one is set to the end of the last segment
+// returns 1 if the image carries a valid index, 0 otherwise (e.g. it was encoded by qoi_encode)
+int pqoi_read_index(const void *data, int size, const qoi_desc *desc, unsigned int *offsets){
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t index_size = PQOI_INDEX_SIZE(desc);
+    if (size < 0 || (size_t)size < QOI_HEADER_SIZE + sizeof(qoi_padding) + index_size) {
+        return 0;
+    }
+
+    int p = size - 2 * sizeof(unsigned int);
+    unsigned int count = qoi_read_32(bytes, &p);
+    unsigned int magic = qoi_read_32(bytes, &p);
+    if (magic != PQOI_INDEX_MAGIC || count != desc->height) {
+        return 0;
+    }
+
+    unsigned int chunks_len = size - QOI_HEADER_SIZE - sizeof(qoi_padding) - index_size;
+    p = size - index_size;
+    for (unsigned int i = 0; i < count; i++){
+        offsets[i] = qoi_read_32(bytes, &p);
+        if (offsets[i] > chunks_len || (i == 0 ? offsets[i] != 0 : offsets[i] < offsets[i - 1])) {
+            return 0;
+        }
+    }
+    offsets[count] = chunks_len;
+
+    return 1;
+}
+
+// queue the upload of an indexed image and the decode kernel writing its pixels into pixel_buffer
+// bytes must stay valid until the kernel has finished
+// returns 1 once everything is queued, 0 if the image can't be decoded in parallel, *kernel_event is NULL
+// and nothing is left in flight then, a failing OpenCL call is kept in session->error
+static int pqoi_decode_enqueue(pqoi_session_t *session, const unsigned char *bytes, int size, const qoi_desc *desc,
+    cl_mem pixel_buffer, cl_event *kernel_event) {
+
+    pqoi_frame_t *frame = &session->frame;
+    size_t n_segments = desc->height;
+    *kernel_event = NULL;
+
+    if (!pqoi_reserve_host((void **)&frame->segment_offsets, &frame->host_offsets_capacity, (n_segments + 1) * sizeof(unsigned int)) ||
+        !pqoi_read_index(bytes, size, desc, frame->segment_offsets)) {
+        return 0;
+    }
+
+    // the padding goes up with the segments, a truncated op at the very end never reads past the buffer
+    size_t bytes_len = frame->segment_offsets[n_segments] + sizeof(qoi_padding);
+    cl_int err = pqoi_reserve_buffer(session, &frame->bytes_buffer, &frame->bytes_capacity, bytes_len, CL_MEM_READ_WRITE);
+    if (err == CL_SUCCESS) err = pqoi_reserve_buffer(session, &frame->segment_offsets_buffer, &frame->offsets_capacity, (n_segments + 1) * sizeof(unsigned int), CL_MEM_READ_ONLY);
+
+    // the kernel undoes the color transform as it stores the pixels
+    int width = desc->width;
+    int channels = desc->channels;
+    int transform = (desc->colorspace & QOI_COLOR_YCOCG) != 0;
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->decode_kernel, 0, sizeof(cl_mem), (void*)&frame->bytes_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->decode_kernel, 1, sizeof(cl_mem), (void*)&frame->segment_offsets_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->decode_kernel, 2, sizeof(cl_mem), (void*)&pixel_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->decode_kernel, 3, sizeof(int), (void*)&width);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->decode_kernel, 4, sizeof(int), (void*)&channels);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->decode_kernel, 5, sizeof(int), (void*)&transform);
+
+    // bytes --> bytes_buffer
+    cl_event traced = NULL;
+    if (err == CL_SUCCESS) err = clEnqueueWriteBuffer(session->queue, frame->bytes_buffer, CL_FALSE, 0, bytes_len, bytes + QOI_HEADER_SIZE, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "upload", "queue");
+
+    // segment_offsets --> segment_offsets_buffer
+    if (err == CL_SUCCESS) err = clEnqueueWriteBuffer(session->queue, frame->segment_offsets_buffer, CL_FALSE, 0, (n_segments + 1) * sizeof(unsigned int), frame->segment_offsets, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "upload offsets", "queue");
+
+    // apply kernel to every segment of the stream
+    if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(session->queue, session->decode_kernel, 1, NULL, &n_segments, NULL, 0, NULL, kernel_event);
+    pqoi_trace_command(session->trace, *kernel_event, "decode", "queue");
+
+    if (err != CL_SUCCESS) {
+        // the uploads that made it into the queue still read bytes
+        clFinish(session->queue);
+        session->error = err;
+        fprintf(stderr, "OpenCL decode failed (%d :: %s)\n", err, get_error_msg(err));
+        return 0;
+    }
+    return 1;
+}
+
+static inline void pqoi_print_decode_time(cl_event event){
+    cl_ulong time_start;
+    cl_ulong time_end;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+
+    double ns = time_end-time_start;
+    printf("OpenCL decode kernel execution time: %lfs\n", ns/1.0e9);
+}
+
+// decode an image written with PQOI_WRITE_INDEX and leave its pixels on the device,
+// ready to be passed to further kernels on the session
+// desc is set from the header, without QOI_COLOR_YCOCG once the pixels are back in RGB
+// returns a buffer of width * height * channels bytes owned by the caller (clReleaseMemObject)
+// or NULL if the image has no segment index or the device failed (session->error)
+cl_mem pqoi_decode_device(pqoi_session_t *session, const void *data, int size, qoi_desc *desc){
+    const unsigned char *bytes = (const unsigned char *)data;
+    session->error = CL_SUCCESS;
+    if (session->queue == NULL || !pqoi_read_header(bytes, size, desc)) {
+        return NULL;
+    }
+
+    size_t pixels_len = (size_t)desc->width * desc->height * desc->channels;
+    cl_mem pixels = clCreateBuffer(session->ocl.context, CL_MEM_READ_WRITE, pixels_len, NULL, &session->ocl.err);
+    if (session->ocl.err != CL_SUCCESS) {
+        session->error = session->ocl.err;
+        return NULL;
+    }
+
+    cl_event event;
+    if (!pqoi_decode_enqueue(session, bytes, size, desc, pixels, &event)) {
+        clReleaseMemObject(pixels);
+        return NULL;
+    }
+
+    // the upload reads from data, don't hand control back before it's done
+    cl_int err = clWaitForEvents(1, &event);
+    if (err == CL_SUCCESS) {
+        pqoi_print_decode_time(event);
+    }
+    clReleaseEvent(event);
+    if (err != CL_SUCCESS) {
+        clFinish(session->queue);
+        session->error = err;
+        clReleaseMemObject(pixels);
+        return NULL;
+    }
+
+    desc->colorspace &= ~QOI_COLOR_YCOCG;
+    return pixels;
+}
+
+// decode an image written with PQOI_WRITE_INDEX into dst, one work item per segment
+// desc is set from the header, without QOI_COLOR_YCOCG on success, dst must hold width * height * channels bytes
+// returns 1 on success, 0 if the image has no segment index, dst is too small or the device failed (session->error)
+int pqoi_decode_into(pqoi_session_t *session, const void *data, int size, qoi_desc *desc, void *dst, size_t dst_capacity){
+    const unsigned char *bytes = (const unsigned char *)data;
+    session->error = CL_SUCCESS;
+    if (session->queue == NULL || dst == NULL || !pqoi_read_header(bytes, size, desc)) {
+        return 0;
+    }
+
+    size_t pixels_len = (size_t)desc->width * desc->height * desc->channels;
+    if (pixels_len > dst_capacity) {
+        return 0;
+    }
+
+    pqoi_frame_t *frame = &session->frame;
+    cl_event event;
+    session->error = pqoi_reserve_buffer(session, &frame->pixel_buffer, &frame->pixel_capacity, pixels_len, CL_MEM_READ_WRITE);
+    if (session->error != CL_SUCCESS || !pqoi_decode_enqueue(session, bytes, size, desc, frame->pixel_buffer, &event)) {
+        return 0;
+    }
+
+    // pixel_buffer --> dst
+    cl_event traced;
+    cl_int err = clEnqueueReadBuffer(session->queue, frame->pixel_buffer, CL_TRUE, 0, pixels_len, dst, 1, &event, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "read pixels", "queue");
+    if (err == CL_SUCCESS) {
+        pqoi_print_decode_time(event);
+    }
+    clReleaseEvent(event);
+    if (err != CL_SUCCESS) {
+        // the kernel may still write pixel_buffer, dst is left alone
+        clFinish(session->queue);
+        session->error = err;
+        fprintf(stderr, "OpenCL decode failed (%d :: %s)\n", err, get_error_msg(err));
+        return 0;
+    }
+
+    desc->colorspace &= ~QOI_COLOR_YCOCG;
+    return 1;
+}
+
+// decode an image written with PQOI_WRITE_INDEX, one work item per segment
+// desc is set from the header
+// returns the pixels (released with QOI_FREE) or NULL if the image has no segment index or the device failed (session->error)
+void *pqoi_decode(pqoi_session_t *session, const void *data, int size, qoi_desc *desc){
+    if (!pqoi_read_header((const unsigned char *)data, size, desc)) {
+        return NULL;
+    }
+
+    size_t pixels_len = (size_t)desc->width * desc->height * desc->channels;
+    unsigned char *pixels = (unsigned char *) QOI_MALLOC(pixels_len);
+    if (!pixels) {
+        return NULL;
+    }
+
+    if (!pqoi_decode_into(session, data, size, desc, pixels, pixels_len)) {
+        QOI_FREE(pixels);
+        return NULL;
+    }
+    return pixels;
+}
+
+void *parallel_qoi_decode(const void *data, int size, qoi_desc *desc){
+    pqoi_session_t session;
+    pqoi_session_init(&session);
+    void *pixels = pqoi_decode(&session, data, size, desc);
+    pqoi_session_release(&session);
+    return pixels;
+}
+
+// run the tile kernel over the image into the session frame, which holds n_tiles slots of bytes_len in all
+// returns CL_SUCCESS or the error of the failing call
+static cl_int pqoi_encode_tiles_device(pqoi_session_t *session, const void *data, const qoi_desc *desc, unsigned int tile_size, size_t n_tiles, size_t bytes_len){
+    pqoi_frame_t *frame = &session->frame;
+    size_t pixels_len = (size_t)desc->width * desc->height * desc->channels;
+
+    cl_int err = pqoi_reserve_buffer(session, &frame->pixel_buffer, &frame->pixel_capacity, pixels_len, CL_MEM_READ_WRITE);
+    if (err == CL_SUCCESS) err = pqoi_reserve_buffer(session, &frame->bytes_buffer, &frame->bytes_capacity, bytes_len, CL_MEM_READ_WRITE);
+    if (err == CL_SUCCESS) err = pqoi_reserve_buffer(session, &frame->segment_lengths_buffer, &frame->segments_capacity, n_tiles * sizeof(unsigned int), CL_MEM_READ_WRITE);
+
+    int width = desc->width;
+    int height = desc->height;
+    int channels = desc->channels;
+    int tile = tile_size;
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->tiles_kernel, 0, sizeof(cl_mem), (void*)&frame->pixel_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->tiles_kernel, 1, sizeof(cl_mem), (void*)&frame->bytes_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->tiles_kernel, 2, sizeof(cl_mem), (void*)&frame->segment_lengths_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->tiles_kernel, 3, sizeof(int), (void*)&width);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->tiles_kernel, 4, sizeof(int), (void*)&height);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->tiles_kernel, 5, sizeof(int), (void*)&channels);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->tiles_kernel, 6, sizeof(int), (void*)&tile);
+
+    cl_event event = NULL;
+    cl_event traced = NULL;
+    if (err == CL_SUCCESS) err = clEnqueueWriteBuffer(session->queue, frame->pixel_buffer, CL_FALSE, 0, pixels_len, data, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "upload", "queue");
+    if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(session->queue, session->tiles_kernel, 1, NULL, &n_tiles, NULL, 0, NULL, &event);
+    pqoi_trace_command(session->trace, event, "encode tiles", "queue");
+    if (err == CL_SUCCESS) err = clEnqueueReadBuffer(session->queue, frame->bytes_buffer, CL_FALSE, 0, bytes_len, frame->bytes, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "read bytes", "queue");
+    if (err == CL_SUCCESS) err = clEnqueueReadBuffer(session->queue, frame->segment_lengths_buffer, CL_TRUE, 0, n_tiles * sizeof(unsigned int), frame->segment_lengths, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "read lengths", "queue");
+
+    if (err != CL_SUCCESS) {
+        // whatever made it into the queue still reads data and writes the frame
+        clFinish(session->queue);
+        if (event) {
+            clReleaseEvent(event);
+        }
+        return err;
+    }
+
+    cl_ulong time_start;
+    cl_ulong time_end;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+    clReleaseEvent(event);
+
+    double ns = time_end-time_start;
+    printf("OpenCL tile kernel execution time: %lfs\n", ns/1.0e9);
+    return CL_SUCCESS;
+}
+
+// encode target image as independent tile_size x tile_size tiles, one work item per tile,
+// and write them as a tiled container (see qoi_tiles.h)
+// without a device, or when the device fails, the tiles are encoded on the cpu
+// returns the size of the file or 0 on failure, nothing is written then and a failing OpenCL call
+// is kept in session->error
+int pqoi_write_tiled(pqoi_session_t *session, const char *filename, const void *data, const qoi_desc *desc, unsigned int tile_size){
+    if (data == NULL || tile_size == 0 || tile_size > QOI_TILES_MAX_SIZE || pqoi_max_encoded_size(desc) == 0) {
+        return 0;
+    }
+
+    pqoi_frame_t *frame = &session->frame;
+    size_t n_tiles = (size_t)QOI_TILES_X(desc, tile_size) * QOI_TILES_Y(desc, tile_size);
+    size_t tile_stride = (size_t)tile_size * tile_size * (desc->channels + 1);
+    size_t bytes_len = n_tiles * tile_stride;
+    if (bytes_len > UINT_MAX) {
+        return 0;
+    }
+
+    // SVM scratch the host can't map counts as out of host memory
+    session->error = CL_SUCCESS;
+    if (!pqoi_reserve_frame_host(frame, (void **)&frame->bytes, &frame->host_bytes_capacity, bytes_len) ||
+        !pqoi_reserve_frame_host(frame, (void **)&frame->segment_lengths, &frame->host_segments_capacity, n_tiles * sizeof(unsigned int))) {
+        session->error = CL_OUT_OF_HOST_MEMORY;
+        return 0;
+    }
+
+    cl_int err = session->queue ? pqoi_encode_tiles_device(session, data, desc, tile_size, n_tiles, bytes_len) : CL_INVALID_COMMAND_QUEUE;
+    if (err != CL_SUCCESS) {
+        session->error = err;
+        fprintf(stderr, "OpenCL tile encode failed (%d :: %s), encoding the tiles on the cpu\n", err, get_error_msg(err));
+        pqoi_perf_begin(session->perf, "cpu encode");
+        int ok = pqoi_cpu_encode_tiles((const unsigned char *)data, desc, tile_size, frame->bytes, frame->segment_lengths, 0);
+        pqoi_perf_end(session->perf, NULL);
+        if (!ok) {
+            return 0;
+        }
+    }
+
+    // header and tile offset table
+    size_t head_len = QOI_TILES_HEADER_SIZE + (n_tiles + 1) * 8;
+    unsigned char *head = (unsigned char *)malloc(head_len);
+    if (!head) {
+        return 0;
+    }
+    qoi_tiles_write_header(head, desc, tile_size);
+
+    unsigned long long offset = 0;
+    int p = QOI_TILES_HEADER_SIZE;
+    for (size_t i = 0; i <= n_tiles; i++){
+        qoi_write_32(head, &p, (unsigned int)(offset >> 32));
+        qoi_write_32(head, &p, (unsigned int)offset);
+        if (i < n_tiles) {
+            offset += frame->segment_lengths[i];
+        }
+    }
+
+    size_t size = head_len + offset + sizeof(qoi_padding);
+    int ok = size <= INT_MAX && pqoi_write_chunks(filename, head, head_len, frame->bytes, tile_stride, frame->segment_lengths, n_tiles, qoi_padding, sizeof(qoi_padding));
+    free(head);
+    return ok ? (int)size : 0;
+}
+
+static inline void pqoi_pixel_state_reset(pqoi_pixel_state_t *state){
+    memset(state->index, 0, sizeof(state->index));
+    state->written = ~0ULL;
+    state->prev.rgba.r = 0;
+    state->prev.rgba.g = 0;
+    state->prev.rgba.b = 0;
+    state->prev.rgba.a = 255;
+    state->run = 0;
+    state->literal = 0;
+}
+
+// reset state of a row encoded on its own like the encode kernel does it: the first pixel is a
+// literal and only slots set in the row are referenced, so a plain decoder that reaches the row
+// with the state of the rows before decodes it the same
+static inline void pqoi_pixel_state_reset_row(pqoi_pixel_state_t *state){
+    pqoi_pixel_state_reset(state);
+    state->written = 0;
+    state->literal = 1;
+}
+
+// encode n_px pixels on the cpu, the same ops as qoi_encode and the encode kernel
+// a pending run is flushed after the last pixel when flush is set, otherwise it carries over
+// returns the number of bytes written, at most n_px * (channels + 1) + 1
+static inline size_t pqoi_encode_pixels(pqoi_pixel_state_t *state, const unsigned char *pixels, size_t n_px, int channels, int flush, unsigned char *bytes){
+    size_t p = 0;
+    qoi_rgba_t px = state->prev;
+    qoi_rgba_t px_prev = state->prev;
+    int run = state->run;
+
+    for (size_t i = 0; i < n_px; i++){
+        const unsigned char *src = pixels + i * channels;
+        px.rgba.r = src[0];
+        px.rgba.g = src[1];
+        px.rgba.b = src[2];
+        if (channels == 4) {
+            px.rgba.a = src[3];
+        }
+
+        if (state->literal) {
+            int index_pos = QOI_COLOR_HASH(px) % 64;
+            state->index[index_pos] = px;
+            state->written |= 1ULL << index_pos;
+            state->literal = 0;
+
+            bytes[p++] = channels == 4 ? QOI_OP_RGBA : QOI_OP_RGB;
+            bytes[p++] = px.rgba.r;
+            bytes[p++] = px.rgba.g;
+            bytes[p++] = px.rgba.b;
+            if (channels == 4) {
+                bytes[p++] = px.rgba.a;
+            }
+        }
+        else if (px.v == px_prev.v) {
+            run++;
+            if (run == 62 || (flush && i == n_px - 1)) {
+                bytes[p++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+        }
+        else {
+            if (run > 0) {
+                bytes[p++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            int index_pos = QOI_COLOR_HASH(px) % 64;
+            if (((state->written >> index_pos) & 1) && state->index[index_pos].v == px.v) {
+                bytes[p++] = QOI_OP_INDEX | index_pos;
+            }
+            else {
+                state->index[index_pos] = px;
+                state->written |= 1ULL << index_pos;
+
+                if (px.rgba.a == px_prev.rgba.a) {
+                    signed char vr = px.rgba.r - px_prev.rgba.r;
+                    signed char vg = px.rgba.g - px_prev.rgba.g;
+                    signed char vb = px.rgba.b - px_prev.rgba.b;
+
+                    signed char vg_r = vr - vg;
+                    signed char vg_b = vb - vg;
+
+                    if (
+                        vr > -3 && vr < 2 &&
+                        vg > -3 && vg < 2 &&
+                        vb > -3 && vb < 2
+                    ) {
+                        bytes[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    }
+                    else if (
+                        vg_r >  -9 && vg_r <  8 &&
+                        vg   > -33 && vg   < 32 &&
+                        vg_b >  -9 && vg_b <  8
+                    ) {
+                        bytes[p++] = QOI_OP_LUMA     | (vg   + 32);
+                        bytes[p++] = (vg_r + 8) << 4 | (vg_b +  8);
+                    }
+                    else {
+                        bytes[p++] = QOI_OP_RGB;
+                        bytes[p++] = px.rgba.r;
+                        bytes[p++] = px.rgba.g;
+                        bytes[p++] = px.rgba.b;
+                    }
+                }
+                else {
+                    bytes[p++] = QOI_OP_RGBA;
+                    bytes[p++] = px.rgba.r;
+                    bytes[p++] = px.rgba.g;
+                    bytes[p++] = px.rgba.b;
+                    bytes[p++] = px.rgba.a;
+                }
+            }
+        }
+
+        px_prev = px;
+    }
+
+    state->prev = px_prev;
+    state->run = run;
+    return p;
+}
+
+// rows of an image handed to one thread of pqoi_cpu_encode
+typedef struct pqoi_cpu_band {
+    const unsigned char *pixels;
+    int src_channels;
+    const qoi_desc *desc;
+    unsigned char *bytes;
+    unsigned int *segment_lengths;
+    unsigned int first_row;
+    unsigned int n_rows;
+    int failed;
+} pqoi_cpu_band_t;
+
+static void *pqoi_cpu_encode_band(void *arg){
+    pqoi_cpu_band_t *band = (pqoi_cpu_band_t *)arg;
+    const qoi_desc *desc = band->desc;
+    size_t row_len = (size_t)desc->width * band->src_channels;
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
+
+    // gray rows are expanded and transformed rows copied like the kernel does it
+    int transform = (desc->colorspace & QOI_COLOR_YCOCG) != 0;
+    unsigned char *expanded = NULL;
+    if (band->src_channels < 3 || transform) {
+        expanded = (unsigned char *)malloc((size_t)desc->width * desc->channels);
+        if (!expanded) {
+            band->failed = 1;
+            return NULL;
+        }
+    }
+
+    pqoi_pixel_state_t state;
+    for (unsigned int row = band->first_row; row < band->first_row + band->n_rows; row++){
+        const unsigned char *src = band->pixels + row * row_len;
+        if (band->src_channels < 3) {
+            unsigned char *out = expanded;
+            for (unsigned int x = 0; x < desc->width; x++, src += band->src_channels) {
+                out[0] = out[1] = out[2] = src[0];
+                out += 3;
+                if (band->src_channels == 2) {
+                    *out++ = src[1];
+                }
+            }
+            src = expanded;
+        }
+        if (transform) {
+            qoi_color_forward(src, expanded, desc->width, desc->channels);
+            src = expanded;
+        }
+
+        pqoi_pixel_state_reset_row(&state);
+        band->segment_lengths[row] = pqoi_encode_pixels(&state, src, desc->width, desc->channels, 1, band->bytes + row * stride);
+    }
+
+    free(expanded);
+    return NULL;
+}
+
+// encode every row (segment) of an image on its own on n_threads threads (0 for one per processor),
+// the same bytes as the encode kernel in the same strided layout
+// pixels have src_channels channels, desc->channels must be PQOI_QOI_CHANNELS(src_channels)
+// returns 1 on success
+int pqoi_cpu_encode(const unsigned char *pixels, int src_channels, const qoi_desc *desc, unsigned char *bytes, unsigned int *segment_lengths, int n_threads){
+    if (desc->height == 0) {
+        return 1;
+    }
+    int n_bands = pqoi_band_count(desc->height, n_threads);
+    pqoi_cpu_band_t one;
+    pqoi_cpu_band_t *bands = n_bands > 1 ? (pqoi_cpu_band_t *)calloc(n_bands, sizeof(pqoi_cpu_band_t)) : NULL;
+    if (!bands) {
+        bands = &one;
+        n_bands = 1;
+    }
+
+    for (int i = 0; i < n_bands; i++) {
+        bands[i] = (pqoi_cpu_band_t){
+            .pixels = pixels,
+            .src_channels = src_channels,
+            .desc = desc,
+            .bytes = bytes,
+            .segment_lengths = segment_lengths,
+            .first_row = (unsigned long long)desc->height * i / n_bands,
+            .n_rows = (unsigned long long)desc->height * (i + 1) / n_bands - (unsigned long long)desc->height * i / n_bands
+        };
+    }
+    pqoi_run_bands(pqoi_cpu_encode_band, bands, sizeof(pqoi_cpu_band_t), n_bands);
+
+    int ok = 1;
+    for (int i = 0; i < n_bands; i++) {
+        ok &= !bands[i].failed;
+    }
+    if (bands != &one) {
+        free(bands);
+    }
+    return ok;
+}
+
+typedef struct pqoi_cpu_tiles_band {
+    const unsigned char *pixels;
+    const qoi_desc *desc;
+    unsigned int tile_size;
+    unsigned char *bytes;
+    unsigned int *tile_lengths;
+    size_t first_tile;
+    size_t n_tiles;
+} pqoi_cpu_tiles_band_t;
+
+static void *pqoi_cpu_encode_tiles_band(void *arg){
+    pqoi_cpu_tiles_band_t *band = (pqoi_cpu_tiles_band_t *)arg;
+    const qoi_desc *desc = band->desc;
+    unsigned int tile_size = band->tile_size;
+    unsigned int tiles_x = QOI_TILES_X(desc, tile_size);
+    size_t tile_stride = (size_t)tile_size * tile_size * (desc->channels + 1);
+
+    pqoi_pixel_state_t state;
+    for (size_t tile = band->first_tile; tile < band->first_tile + band->n_tiles; tile++){
+        unsigned int x0 = tile % tiles_x * tile_size;
+        unsigned int y0 = tile / tiles_x * tile_size;
+        unsigned int tile_w = desc->width - x0 < tile_size ? desc->width - x0 : tile_size;
+        unsigned int tile_h = desc->height - y0 < tile_size ? desc->height - y0 : tile_size;
+
+        // a plain QOI stream, the state runs on across the rows of the tile
+        unsigned char *out = band->bytes + tile * tile_stride;
+        size_t len = 0;
+        pqoi_pixel_state_reset(&state);
+        for (unsigned int y = 0; y < tile_h; y++){
+            const unsigned char *src = band->pixels + ((size_t)(y0 + y) * desc->width + x0) * desc->channels;
+            len += pqoi_encode_pixels(&state, src, tile_w, desc->channels, y == tile_h - 1, out + len);
+        }
+        band->tile_lengths[tile] = len;
+    }
+    return NULL;
+}
+
+// encode the tiles of an image on n_threads threads (0 for one per processor), the same bytes
+// as the tile kernel in the same layout: tile_size * tile_size * (channels + 1) bytes a tile
+// pixels have desc->channels channels, 3 or 4
+// returns 1 on success
+int pqoi_cpu_encode_tiles(const unsigned char *pixels, const qoi_desc *desc, unsigned int tile_size, unsigned char *bytes, unsigned int *tile_lengths, int n_threads){
+    size_t n_tiles = (size_t)QOI_TILES_X(desc, tile_size) * QOI_TILES_Y(desc, tile_size);
+    int n_bands = pqoi_band_count(n_tiles, n_threads);
+    pqoi_cpu_tiles_band_t one;
+    pqoi_cpu_tiles_band_t *bands = n_bands > 1 ? (pqoi_cpu_tiles_band_t *)calloc(n_bands, sizeof(pqoi_cpu_tiles_band_t)) : NULL;
+    if (!bands) {
+        bands = &one;
+        n_bands = 1;
+    }
+
+    for (int i = 0; i < n_bands; i++) {
+        size_t first = (unsigned long long)n_tiles * i / n_bands;
+        size_t last = (unsigned long long)n_tiles * (i + 1) / n_bands;
+        bands[i] = (pqoi_cpu_tiles_band_t){
+            .pixels = pixels,
+            .desc = desc,
+            .tile_size = tile_size,
+            .bytes = bytes,
+            .tile_lengths = tile_lengths,
+            .first_tile = first,
+            .n_tiles = last - first
+        };
+    }
+    pqoi_run_bands(pqoi_cpu_encode_tiles_band, bands, sizeof(pqoi_cpu_tiles_band_t), n_bands);
+
+    if (bands != &one) {
+        free(bands);
+    }
+    return 1;
+}
+
+// count the ops of one encoded segment into PQOI_STAT_COUNT counters, the same numbers as the kernel
+void pqoi_count_ops(const unsigned char *segment, unsigned int len, unsigned int *stats){
+    memset(stats, 0, PQOI_STAT_COUNT * sizeof(unsigned int));
+    unsigned int p = 0;
+    while (p < len) {
+        int b1 = segment[p++];
+        if (b1 == QOI_OP_RGB) {
+            stats[PQOI_STAT_RGB]++;
+            p += 3;
+        }
+        else if (b1 == QOI_OP_RGBA) {
+            stats[PQOI_STAT_RGBA]++;
+            p += 4;
+        }
+        else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+            stats[PQOI_STAT_INDEX]++;
+        }
+        else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+            stats[PQOI_STAT_DIFF]++;
+        }
+        else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+            stats[PQOI_STAT_LUMA]++;
+            p++;
+        }
+        else {
+            stats[PQOI_STAT_RUN]++;
+            stats[PQOI_STAT_RUN_PIXELS] += (b1 & 0x3f) + 1;
+        }
+    }
+}
+
+// add up the counters of n_rows rows into PQOI_STAT_COUNT totals
+void pqoi_stats_total(const unsigned int *stats, unsigned int n_rows, unsigned long long *totals){
+    memset(totals, 0, PQOI_STAT_COUNT * sizeof(unsigned long long));
+    for (unsigned int row = 0; row < n_rows; row++){
+        for (int i = 0; i < PQOI_STAT_COUNT; i++){
+            totals[i] += stats[row * PQOI_STAT_COUNT + i];
+        }
+    }
+}
+
+// start a streamed image and hand its header to the sink
+// backend: PQOI_STREAM_CPU, PQOI_STREAM_THREADS (n_threads, 0 for one per processor)
+// or PQOI_STREAM_OPENCL (on session), the last two write rows that start from a reset state like pqoi_write
+// returns 1 on success
+int pqoi_stream_begin(pqoi_stream_encoder_t *encoder, const qoi_desc *desc, int backend, pqoi_session_t *session, int n_threads,
+    pqoi_sink sink, void *user_data) {
+
+    memset(encoder, 0, sizeof(*encoder));
+    if (sink == NULL || pqoi_max_encoded_size(desc) == 0 || (backend == PQOI_STREAM_OPENCL && session == NULL)) {
+        return 0;
+    }
+
+    encoder->desc = *desc;
+    encoder->backend = backend;
+    encoder->session = session;
+    encoder->n_threads = n_threads > 0 ? n_threads : pqoi_cpu_count();
+    encoder->sink = sink;
+    encoder->user_data = user_data;
+    pqoi_pixel_state_reset(&encoder->state);
+
+    unsigned char header[QOI_HEADER_SIZE];
+    int p = 0;
+    qoi_write_32(header, &p, QOI_MAGIC);
+    qoi_write_32(header, &p, desc->width);
+    qoi_write_32(header, &p, desc->height);
+    header[p++] = desc->channels;
+    header[p++] = desc->colorspace;
+
+    encoder->failed = !sink(header, sizeof(header), user_data);
+    return !encoder->failed;
+}
+
+// encode every row of a batch on its own into the strided scratch, on threads or on the device
+// *bytes and *lengths are set to where the rows ended up
+static int pqoi_stream_encode_rows(pqoi_stream_encoder_t *encoder, const unsigned char *pixels, unsigned int n_rows,
+    const unsigned char **bytes, const unsigned int **lengths) {
+
+    qoi_desc batch = encoder->desc;
+    batch.height = n_rows;
+
+    if (encoder->backend == PQOI_STREAM_OPENCL) {
+        pqoi_session_t *session = encoder->session;
+        if (!pqoi_reserve_frame(&session->frame, &batch)) {
+            return 0;
+        }
+
+        cl_event kernel_event;
+        cl_event read_event;
+        cl_int err = parallel_enqueue(session, &session->frame, pixels, batch.channels, &batch, &kernel_event, &read_event);
+        if (err == CL_SUCCESS) {
+            err = clWaitForEvents(1, &read_event);
+            clReleaseEvent(kernel_event);
+            clReleaseEvent(read_event);
+        }
+        if (err == CL_SUCCESS) {
+            *bytes = session->frame.bytes;
+            *lengths = session->frame.segment_lengths;
+            return 1;
+        }
+
+        // the batch goes to the threads below, the stream goes on
+        if (session->error == CL_SUCCESS) {
+            fprintf(stderr, "OpenCL stream encode failed (%d :: %s), encoding on the cpu\n", err, get_error_msg(err));
+        }
+        session->error = err;
+    }
+
+    if (!pqoi_reserve_host((void **)&encoder->bytes, &encoder->bytes_capacity, n_rows * PQOI_SEGMENT_STRIDE(&batch)) ||
+        !pqoi_reserve_host((void **)&encoder->lengths, &encoder->lengths_capacity, n_rows * sizeof(unsigned int)) ||
+        !pqoi_cpu_encode(pixels, batch.channels, &batch, encoder->bytes, encoder->lengths, encoder->n_threads)) {
+        return 0;
+    }
+    *bytes = encoder->bytes;
+    *lengths = encoder->lengths;
+    return 1;
+}
+
+// encode the next n_rows rows of the image and hand their bytes to the sink
+// pixels can be reused as soon as this returns
+// returns 1 on success, 0 once the stream has failed or would get more rows than the image has
+int pqoi_stream_push_rows(pqoi_stream_encoder_t *encoder, const void *pixels, unsigned int n_rows){
+    if (encoder->failed || pixels == NULL || n_rows > encoder->desc.height - encoder->rows_done) {
+        encoder->failed = 1;
+        return 0;
+    }
+    if (n_rows == 0) {
+        return 1;
+    }
+
+    const qoi_desc *desc = &encoder->desc;
+    size_t n_px = (size_t)desc->width * n_rows;
+
+    if (encoder->backend == PQOI_STREAM_CPU) {
+        // one more byte for a run carried in from the previous push
+        if (!pqoi_reserve_host((void **)&encoder->bytes, &encoder->bytes_capacity, n_px * (desc->channels + 1) + 1)) {
+            encoder->failed = 1;
+            return 0;
+        }
+
+        int last = encoder->rows_done + n_rows == desc->height;
+        size_t len = pqoi_encode_pixels(&encoder->state, (const unsigned char *)pixels, n_px, desc->channels, last, encoder->bytes);
+        encoder->failed = !encoder->sink(encoder->bytes, len, encoder->user_data);
+    }
+    else {
+        // the OpenCL rows live in the session frame
+        const unsigned char *bytes;
+        const unsigned int *lengths;
+        if (!pqoi_stream_encode_rows(encoder, (const unsigned char *)pixels, n_rows, &bytes, &lengths)) {
+            encoder->failed = 1;
+            return 0;
+        }
+
+        size_t stride = PQOI_SEGMENT_STRIDE(desc);
+        for (unsigned int i = 0; i < n_rows && !encoder->failed; i++){
+            encoder->failed = !encoder->sink(bytes + i * stride, lengths[i], encoder->user_data);
+        }
+    }
+
+    encoder->rows_done += n_rows;
+    return !encoder->failed;
+}
+
+// hand the padding to the sink and release the scratch
+// returns 1 if every row of the image made it to the sink
+int pqoi_stream_finish(pqoi_stream_encoder_t *encoder){
+    int ok = !encoder->failed && encoder->rows_done == encoder->desc.height &&
+        encoder->sink(qoi_padding, sizeof(qoi_padding), encoder->user_data);
+
+    free(encoder->bytes);
+    free(encoder->lengths);
+    encoder->bytes = NULL;
+    encoder->lengths = NULL;
+    encoder->bytes_capacity = 0;
+    encoder->lengths_capacity = 0;
+    return ok;
+}
+
+// start a frame sequence (see qoi_sequence.h) and hand its header to the sink
+// every frame has the size and channels of desc
+// returns 1 on success
+int pqoi_sequence_begin(pqoi_sequence_t *sequence, pqoi_session_t *session, const qoi_desc *desc, pqoi_sink sink, void *user_data){
+    memset(sequence, 0, sizeof(*sequence));
+    // a sequence that didn't start is failed, finish then skips the padding
+    sequence->failed = 1;
+    if (session == NULL || sink == NULL || pqoi_max_encoded_size(desc) == 0) {
+        return 0;
+    }
+
+    sequence->session = session;
+    sequence->desc = *desc;
+    sequence->sink = sink;
+    sequence->user_data = user_data;
+
+    size_t pixels_len = (size_t)desc->width * desc->height * desc->channels;
+    if (session->queue == NULL) {
+        sequence->prev = (unsigned char *)malloc(pixels_len);
+        if (!sequence->prev) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < 2 && session->queue; i++) {
+        sequence->frames[i] = clCreateBuffer(session->ocl.context, CL_MEM_READ_WRITE, pixels_len, NULL, &session->ocl.err);
+        if (session->ocl.err != CL_SUCCESS) {
+            session->error = session->ocl.err;
+            fprintf(stderr, "OpenCL sequence buffers failed (%d :: %s)\n", session->ocl.err, get_error_msg(session->ocl.err));
+            return 0;
+        }
+    }
+
+    unsigned char header[QOI_SEQUENCE_HEADER_SIZE];
+    qoi_sequence_write_header(header, desc);
+    sequence->failed = !sink(header, sizeof(header), user_data);
+    return !sequence->failed;
+}
+
+// encode the rows of the next frame that differ from the frame before on the device into the session
+// frame, unchanged rows get a length of 0, only the changed rows are read back
+// returns CL_SUCCESS or the error of the failing call
+static cl_int pqoi_sequence_encode_device(pqoi_sequence_t *sequence, const void *pixels){
+    pqoi_session_t *session = sequence->session;
+    pqoi_frame_t *frame = &session->frame;
+    const qoi_desc *desc = &sequence->desc;
+
+    size_t pixels_len = (size_t)desc->width * desc->height * desc->channels;
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
+    size_t n_segments = desc->height;
+    cl_int err = pqoi_reserve_buffer(session, &frame->bytes_buffer, &frame->bytes_capacity, n_segments * stride, CL_MEM_READ_WRITE);
+    if (err == CL_SUCCESS) {
+        err = pqoi_reserve_buffer(session, &frame->segment_lengths_buffer, &frame->segments_capacity, n_segments * sizeof(unsigned int), CL_MEM_READ_WRITE);
+    }
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    cl_mem current = sequence->frames[sequence->current];
+    cl_mem previous = sequence->frames[!sequence->current];
+    int width = desc->width;
+    int channels = desc->channels;
+    int has_prev = sequence->n_frames > 0;
+    err = clSetKernelArg(session->sequence_kernel, 0, sizeof(cl_mem), (void*)&current);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->sequence_kernel, 1, sizeof(cl_mem), (void*)&previous);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->sequence_kernel, 2, sizeof(cl_mem), (void*)&frame->bytes_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->sequence_kernel, 3, sizeof(cl_mem), (void*)&frame->segment_lengths_buffer);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->sequence_kernel, 4, sizeof(int), (void*)&width);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->sequence_kernel, 5, sizeof(int), (void*)&channels);
+    if (err == CL_SUCCESS) err = clSetKernelArg(session->sequence_kernel, 6, sizeof(int), (void*)&has_prev);
+
+    cl_event traced = NULL;
+    if (err == CL_SUCCESS) err = clEnqueueWriteBuffer(session->queue, current, CL_FALSE, 0, pixels_len, pixels, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "upload", "queue");
+    if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel(session->queue, session->sequence_kernel, 1, NULL, &n_segments, NULL, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "encode sequence", "queue");
+    if (err == CL_SUCCESS) err = clEnqueueReadBuffer(session->queue, frame->segment_lengths_buffer, CL_TRUE, 0, n_segments * sizeof(unsigned int), frame->segment_lengths, 0, NULL, pqoi_trace_slot(session, &traced));
+    pqoi_trace_take(session, &traced, "read lengths", "queue");
+
+    unsigned int n_changed = 0;
+    for (unsigned int y = 0; y < desc->height && err == CL_SUCCESS; y++){
+        n_changed += frame->segment_lengths[y] != 0;
+    }
+
+    // read back only the changed rows, or everything in one go when most of them changed
+    if (err == CL_SUCCESS && n_changed * 2 > desc->height) {
+        err = clEnqueueReadBuffer(session->queue, frame->bytes_buffer, CL_TRUE, 0, n_segments * stride, frame->bytes, 0, NULL, pqoi_trace_slot(session, &traced));
+        pqoi_trace_take(session, &traced, "read bytes", "queue");
+    }
+    else if (err == CL_SUCCESS && n_changed > 0) {
+        for (unsigned int y = 0; y < desc->height && err == CL_SUCCESS; y++){
+            if (frame->segment_lengths[y]) {
+                err = clEnqueueReadBuffer(session->queue, frame->bytes_buffer, CL_FALSE, y * stride, frame->segment_lengths[y], frame->bytes + y * stride, 0, NULL, pqoi_trace_slot(session, &traced));
+                pqoi_trace_take(session, &traced, "read row", "queue");
+            }
+        }
+        cl_int finished = clFinish(session->queue);
+        if (err == CL_SUCCESS) err = finished;
+    }
+
+    if (err != CL_SUCCESS) {
+        // the upload may still read pixels, don't hand them back before it's done
+        clFinish(session->queue);
+        fprintf(stderr, "OpenCL sequence encode failed (%d :: %s)\n", err, get_error_msg(err));
+    }
+    return err;
+}
+
+static int pqoi_sequence_row_same(const pqoi_sequence_t *sequence, const unsigned char *pixels, unsigned int y){
+    size_t row_len = (size_t)sequence->desc.width * sequence->desc.channels;
+    return sequence->n_frames > 0 && memcmp(pixels + y * row_len, sequence->prev + y * row_len, row_len) == 0;
+}
+
+// the same on the cpu, against the frame before kept on the host
+// every run of changed rows is encoded like an image of its own, spread over the threads
+// returns 1 on success, 0 if the encode runs out of memory
+static int pqoi_sequence_encode_cpu(pqoi_sequence_t *sequence, const unsigned char *pixels){
+    pqoi_frame_t *frame = &sequence->session->frame;
+    const qoi_desc *desc = &sequence->desc;
+    size_t row_len = (size_t)desc->width * desc->channels;
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
+
+    // the encode kernel of sequences doesn't apply the color transform either
+    qoi_desc rows = *desc;
+    rows.colorspace &= ~QOI_COLOR_YCOCG;
+
+    unsigned int y = 0;
+    while (y < desc->height) {
+        unsigned int first = y;
+        while (y < desc->height && !pqoi_sequence_row_same(sequence, pixels, y)) {
+            y++;
+        }
+        rows.height = y - first;
+        if (rows.height > 0 && !pqoi_cpu_encode(pixels + first * row_len, desc->channels, &rows,
+                frame->bytes + first * stride, frame->segment_lengths + first, 0)) {
+            return 0;
+        }
+        while (y < desc->height && pqoi_sequence_row_same(sequence, pixels, y)) {
+            frame->segment_lengths[y++] = 0;
+        }
+    }
+
+    memcpy(sequence->prev, pixels, row_len * desc->height);
+    return 1;
+}
+
+// encode the next frame, only the rows that differ from the frame before are encoded and read back
+// pixels can be reused as soon as this returns
+// returns the number of changed rows or -1 on failure, a failing OpenCL call is kept in session->error
+int pqoi_sequence_push(pqoi_sequence_t *sequence, const void *pixels){
+    pqoi_session_t *session = sequence->session;
+    pqoi_frame_t *frame = &session->frame;
+    const qoi_desc *desc = &sequence->desc;
+
+    if (sequence->failed || pixels == NULL) {
+        sequence->failed = 1;
+        return -1;
+    }
+    if (!pqoi_reserve_frame(frame, desc)) {
+        // SVM scratch the host can't map counts as out of host memory
+        session->error = CL_OUT_OF_HOST_MEMORY;
+        sequence->failed = 1;
+        return -1;
+    }
+
+    if (sequence->prev) {
+        pqoi_perf_begin(session->perf, "cpu encode");
+        sequence->failed = !pqoi_sequence_encode_cpu(sequence, (const unsigned char *)pixels);
+        pqoi_perf_end(session->perf, NULL);
+    }
+    else {
+        session->error = pqoi_sequence_encode_device(sequence, pixels);
+        sequence->failed = session->error != CL_SUCCESS;
+    }
+    if (sequence->failed) {
+        return -1;
+    }
+
+    size_t stride = PQOI_SEGMENT_STRIDE(desc);
+    unsigned int n_changed = 0;
+    size_t payload = 0;
+    for (unsigned int y = 0; y < desc->height; y++){
+        n_changed += frame->segment_lengths[y] != 0;
+        payload += frame->segment_lengths[y];
+    }
+
+    size_t bitmap_len = QOI_SEQUENCE_BITMAP_SIZE(desc);
+    size_t head_len = 4 + bitmap_len + (size_t)n_changed * 4;
+    size_t record_len = head_len - 4 + payload;
+    if (record_len > UINT_MAX || !pqoi_reserve_host((void **)&sequence->head, &sequence->head_capacity, head_len)) {
+        sequence->failed = 1;
+        return -1;
+    }
+
+    unsigned char *head = sequence->head;
+    int p = 0;
+    qoi_write_32(head, &p, (unsigned int)record_len);
+    memset(head + p, 0, bitmap_len);
+    for (unsigned int y = 0; y < desc->height; y++){
+        if (frame->segment_lengths[y]) {
+            head[p + (y >> 3)] |= 0x80 >> (y & 7);
+        }
+    }
+    p += bitmap_len;
+    for (unsigned int y = 0; y < desc->height; y++){
+        if (frame->segment_lengths[y]) {
+            qoi_write_32(head, &p, frame->segment_lengths[y]);
+        }
+    }
+
+    int ok = sequence->sink(head, head_len, sequence->user_data);
+    for (unsigned int y = 0; y < desc->height && ok; y++){
+        if (frame->segment_lengths[y]) {
+            ok = sequence->sink(frame->bytes + y * stride, frame->segment_lengths[y], sequence->user_data);
+        }
+    }
+
+    // this frame is the reference of the next one
+    sequence->current = !sequence->current;
+    sequence->n_frames++;
+    sequence->failed = !ok;
+    return ok ? (int)n_changed : -1;
+}
+
+// hand the padding to the sink and release the frames kept for the next one
+// returns 1 if every frame made it to the sink
+int pqoi_sequence_finish(pqoi_sequence_t *sequence){
+    int ok = !sequence->failed && sequence->sink && sequence->sink(qoi_padding, sizeof(qoi_padding), sequence->user_data);
+
+    for (int i = 0; i < 2; i++) {
+        if (sequence->frames[i]) {
+            clReleaseMemObject(sequence->frames[i]);
+        }
+    }
+    free(sequence->prev);
+    free(sequence->head);
+    memset(sequence, 0, sizeof(*sequence));
+    return ok;
 }
 
-#endif
\ No newline at end of file
+#endif
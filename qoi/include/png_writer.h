@@ -0,0 +1,60 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#define PNG_FILTER_ADAPTIVE  -1  // try all five filters per row, keep the smallest
+#define PNG_FILTER_HEURISTIC -2  // pick one filter per row from a sparse sample of it
+
+#define PNG_LEVEL_DEFAULT 0
+#define PNG_LEVEL_FAST    1  // short match search, no lazy matching
+
+/**
+ * n_threads: 0 for one per processor
+ * filter: PNG_FILTER_ADAPTIVE, PNG_FILTER_HEURISTIC or a fixed PNG filter type 0-4
+ * level: PNG_LEVEL_DEFAULT or PNG_LEVEL_FAST
+ */
+typedef struct png_options {
+    int n_threads;
+    int filter;
+    int level;
+} png_options_t;
+
+/**
+ * Encode 8 bit pixels (1 = gray, 2 = gray + alpha, 3 = RGB, 4 = RGBA channels)
+ * into a PNG in memory.
+ *
+ * The rows are split into bands, every band is filtered and deflated on its
+ * own thread into an independent run of deflate blocks ending on a sync flush,
+ * with the previous 32K of filtered data as a preset dictionary. Each band is
+ * emitted as its own IDAT chunk, so the chunk CRCs come from the band threads
+ * and only the Adler-32 of the zlib stream has to be combined.
+ *
+ * n_threads: 0 for one per processor
+ * out_len: set to the size of the PNG
+ *
+ * Returns the PNG (released with free) or NULL on failure
+ */
+unsigned char *png_encode_parallel(const void *pixels, int width, int height, int channels, int n_threads, int *out_len);
+
+/**
+ * Encode pixels like png_encode_parallel with the given filter and deflate settings.
+ * Fixed filters, the heuristic and the fast level trade file size for latency.
+ *
+ * Returns the PNG (released with free) or NULL on failure
+ */
+unsigned char *png_encode(const void *pixels, int width, int height, int channels, const png_options_t *options, int *out_len);
+
+/**
+ * Encode pixels like png_encode_parallel and write them to a file.
+ *
+ * Returns the number of bytes written or 0 on failure
+ */
+int png_write_parallel(const char *filename, const void *pixels, int width, int height, int channels, int n_threads);
+
+/**
+ * Encode pixels like png_encode and write them to a file.
+ *
+ * Returns the number of bytes written or 0 on failure
+ */
+int png_write(const char *filename, const void *pixels, int width, int height, int channels, const png_options_t *options);
+
+#endif
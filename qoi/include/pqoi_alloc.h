@@ -0,0 +1,79 @@
+#ifndef PQOI_ALLOC_H
+#define PQOI_ALLOC_H
+
+#include <stddef.h>
+
+/**
+ * Pluggable allocator for the per-image host memory
+ * (decoded pixels, encoded output, the qoi and stb internal buffers).
+ *
+ * alloc: returns size bytes aligned to 16 or NULL
+ * realloc: resizes an allocation of the same allocator, may move it
+ * free: releases an allocation, allowed to be a no-op
+ * ctx: passed to every callback
+ */
+typedef struct pqoi_allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+} pqoi_allocator_t;
+
+typedef struct pqoi_arena_block {
+    struct pqoi_arena_block *next;
+    size_t size;
+    size_t used;
+    int mapped;
+} pqoi_arena_block_t;
+
+/**
+ * Growable bump allocator, reset between images.
+ *
+ * Allocations are carved from the current block, when it runs out a bigger
+ * block is chained in front of it. Resetting folds all blocks into a single
+ * one of the combined size, so once the largest image went through no more
+ * system allocations happen.
+ */
+typedef struct pqoi_arena {
+    pqoi_arena_block_t *head;
+    size_t total;
+    int huge_pages;
+    void *last;
+    pqoi_allocator_t allocator;
+} pqoi_arena_t;
+
+/**
+ * Prepare an arena.
+ *
+ * initial_size: bytes reserved up front, 0 to reserve on the first allocation
+ * huge_pages: back the blocks by transparent huge pages where supported
+ */
+void pqoi_arena_init(pqoi_arena_t *arena, size_t initial_size, int huge_pages);
+
+/**
+ * Release every allocation of the arena at once and keep the memory for reuse.
+ */
+void pqoi_arena_reset(pqoi_arena_t *arena);
+
+/**
+ * Return all blocks of the arena to the system.
+ */
+void pqoi_arena_destroy(pqoi_arena_t *arena);
+
+/**
+ * Select the allocator behind pqoi_malloc/pqoi_realloc/pqoi_free for the
+ * calling thread. NULL selects the system allocator.
+ *
+ * Returns the previously selected allocator
+ */
+const pqoi_allocator_t *pqoi_set_allocator(const pqoi_allocator_t *allocator);
+
+/**
+ * Allocation functions routed to the selected allocator,
+ * used as the QOI_MALLOC/STBI_MALLOC/STBIW_MALLOC hooks.
+ */
+void *pqoi_malloc(size_t size);
+void *pqoi_realloc(void *ptr, size_t size);
+void pqoi_free(void *ptr);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef PQOI_BANDS_H
+#define PQOI_BANDS_H
+
+#include <stddef.h>
+
+/**
+ * Number of online processors, at least 1.
+ */
+int pqoi_cpu_count(void);
+
+/**
+ * Number of bands to split n_items items into on n_threads threads: n_threads,
+ * or one per processor for 0, but never more than there are items and at least 1.
+ */
+int pqoi_band_count(size_t n_items, int n_threads);
+
+/**
+ * Run fn on every band, each on a thread of its own. The calling thread takes
+ * the first band, and any band whose thread can't be started. Returns once every
+ * band is done.
+ *
+ * bands: n_bands structs of band_size bytes, fn gets a pointer to one
+ */
+void pqoi_run_bands(void *(*fn)(void *), void *bands, size_t band_size, int n_bands);
+
+#endif
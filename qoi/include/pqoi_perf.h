@@ -0,0 +1,86 @@
+#ifndef PQOI_PERF_H
+#define PQOI_PERF_H
+
+#include <stdio.h>
+
+/**
+ * Hardware counters around the cpu stages of a conversion (png decode, qoi encode,
+ * merge, png encode, the cpu encoders), read through perf_event_open on Linux.
+ *
+ * The counters follow the whole process including the threads a stage starts, so
+ * a stage also gets whatever other threads do while it runs. Without permission
+ * (perf_event_paranoid, containers), without a PMU or off Linux the counters stay
+ * closed without an error, only the wall time of the stages is kept and the
+ * counts print as '-'.
+ */
+enum {
+    PQOI_PERF_CYCLES,
+    PQOI_PERF_INSTRUCTIONS,
+    PQOI_PERF_LLC_MISSES,
+    PQOI_PERF_BRANCH_MISSES,
+    PQOI_PERF_EVENTS
+};
+
+#define PQOI_PERF_MAX_STAGES 16
+
+typedef struct pqoi_perf_stage {
+    const char *name;
+    unsigned int runs;
+    double seconds;
+    unsigned long long counts[PQOI_PERF_EVENTS];
+    unsigned int counted;  // bit i set if counts[i] was counted
+} pqoi_perf_stage_t;
+
+typedef struct pqoi_perf {
+    int fds[PQOI_PERF_EVENTS];  // -1 for a counter that didn't open
+    pqoi_perf_stage_t stages[PQOI_PERF_MAX_STAGES];
+    int n_stages;
+
+    // the stage between pqoi_perf_begin and pqoi_perf_end
+    pqoi_perf_stage_t *current;
+    double begin;
+} pqoi_perf_t;
+
+/**
+ * Open the counters, the ones that can't be opened stay closed without a word.
+ *
+ * Returns the number of counters that opened, 0 when only times are kept
+ */
+int pqoi_perf_init(pqoi_perf_t *perf);
+
+/**
+ * Close the counters.
+ */
+void pqoi_perf_release(pqoi_perf_t *perf);
+
+/**
+ * Start counting for the stage with the given name (a string that outlives perf),
+ * stages don't nest. perf may be NULL, the calls do nothing then.
+ */
+void pqoi_perf_begin(pqoi_perf_t *perf, const char *stage);
+
+/**
+ * Stop counting and add the counts to the stage.
+ *
+ * counts: optional, set to the counts of this run, ~0ULL for closed counters
+ */
+void pqoi_perf_end(pqoi_perf_t *perf, unsigned long long *counts);
+
+/**
+ * Forget the counts of every stage, the counters stay open.
+ */
+void pqoi_perf_reset(pqoi_perf_t *perf);
+
+/**
+ * Add the stages of src to the stages of the same name in dst, e.g. to keep
+ * the aggregate of many images. dst only needs to be zeroed.
+ */
+void pqoi_perf_merge(pqoi_perf_t *dst, const pqoi_perf_t *src);
+
+/**
+ * Print a table of the stages: runs, seconds, cycles, instructions per cycle, LLC
+ * and branch misses, '-' for counters that didn't open.
+ */
+void pqoi_perf_report(const pqoi_perf_t *perf, const char *title, FILE *out);
+
+#endif
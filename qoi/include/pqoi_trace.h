@@ -0,0 +1,92 @@
+#ifndef PQOI_TRACE_H
+#define PQOI_TRACE_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef CL_TARGET_OPENCL_VERSION
+#define CL_TARGET_OPENCL_VERSION 220
+#endif
+#include <CL/cl.h>
+
+/**
+ * Chrome trace event JSON of a conversion, for ui.perfetto.dev or chrome://tracing.
+ *
+ * Host spans (png decode, kernel build, merge, file write) go on the track of the
+ * thread that ran them. Every OpenCL command goes on the track of its queue from
+ * its START to its END profiling time, and the time it spent QUEUED and SUBMITTED
+ * before that goes on a separate async track, so overlapping transfers, kernels
+ * and stalls between images show up side by side. The queues need
+ * CL_QUEUE_PROFILING_ENABLE.
+ *
+ * Device times are moved onto the host clock with the first command: its QUEUED
+ * time is taken as the moment pqoi_trace_command was called for it, right after
+ * it was enqueued.
+ */
+typedef struct pqoi_trace_command pqoi_trace_command_t;
+
+#define PQOI_TRACE_MAX_TRACKS 16
+
+typedef struct pqoi_trace {
+    FILE *out;
+    pthread_mutex_t lock;
+    int n_events;   // events written, every one after the first starts with a comma
+    double origin;  // host seconds of timestamp 0
+
+    // commands whose profiling times aren't known yet, the oldest first
+    pqoi_trace_command_t *pending;
+    pqoi_trace_command_t **pending_end;
+    unsigned long long next_id;  // id of the async QUEUED and SUBMITTED spans
+
+    int calibrated;
+    double device_offset;  // device seconds minus host seconds
+
+    // device tracks by name, host threads get numbered as they show up
+    const char *tracks[PQOI_TRACE_MAX_TRACKS];
+    int n_tracks;
+    int n_threads;
+} pqoi_trace_t;
+
+/**
+ * Create the trace file and write the start of the JSON.
+ *
+ * Returns 1 on success, 0 if the file can't be created
+ */
+int pqoi_trace_open(pqoi_trace_t *trace, const char *path);
+
+/**
+ * Write the commands still pending, waiting for the ones that haven't finished
+ * (commands that failed are left out) and close the JSON and the file.
+ *
+ * Returns 1 if the whole trace got to the file, 0 otherwise
+ */
+int pqoi_trace_close(pqoi_trace_t *trace);
+
+/**
+ * Start a host span. trace may be NULL in all the calls, they do nothing then.
+ *
+ * Returns the start time to hand to pqoi_trace_span
+ */
+double pqoi_trace_begin(const pqoi_trace_t *trace);
+
+/**
+ * Write a host span on the track of the calling thread, from begin to now.
+ *
+ * name: a string that outlives the call, like every name and track here
+ * detail: optional, e.g. the file the span worked on, shown with the span
+ */
+void pqoi_trace_span(pqoi_trace_t *trace, const char *name, const char *detail, double begin);
+
+/**
+ * Add an enqueued command to the trace, called right after it was enqueued.
+ * The trace keeps its own reference to event, the command is written once
+ * it has finished (looked up whenever another command is added, without
+ * waiting) or when the trace is closed.
+ *
+ * event: the event of the command, NULL does nothing
+ * name: what the command does, e.g. "upload" or "encode"
+ * track: the queue it runs on
+ */
+void pqoi_trace_command(pqoi_trace_t *trace, cl_event event, const char *name, const char *track);
+
+#endif
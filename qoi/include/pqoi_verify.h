@@ -0,0 +1,40 @@
+#ifndef PQOI_VERIFY_H
+#define PQOI_VERIFY_H
+
+#include <stddef.h>
+// qoi.h doesn't guard its implementation against a second inclusion
+#ifndef QOI_H
+#include "qoi.h"
+#endif
+
+/**
+ * First pixel in raster order that failed a verification.
+ */
+typedef struct pqoi_mismatch {
+    unsigned int x;
+    unsigned int y;
+    unsigned char expected[4];  // the source pixel, gray expanded
+    unsigned char actual[4];    // the decoded pixel, zero if the row stopped decoding before it
+    const char *reason;
+} pqoi_mismatch_t;
+
+/**
+ * Decode the rows of a parallel encoded image on n_threads threads and compare them
+ * with the pixels they were encoded from.
+ *
+ * Besides the pixels every row has to decode the same with the state a plain QOI
+ * decoder brings from the rows before it: it starts with a literal, only refers to
+ * index slots set in the row, its runs end in the row and it fills its segment exactly.
+ *
+ * bytes: row y starts at bytes + y * stride and is segment_lengths[y] bytes long
+ * pixels: the source with src_channels channels (1 gray, 2 gray + alpha, 3 RGB, 4 RGBA),
+ *         desc->channels are the encoded channels, rows of a desc with QOI_COLOR_YCOCG
+ *         are transformed back before they are compared
+ * n_threads: 0 for one per processor
+ *
+ * Returns 1 if every row checks out, otherwise 0 with the first failure in *mismatch
+ */
+int pqoi_verify_segments(const unsigned char *bytes, size_t stride, const unsigned int *segment_lengths, const qoi_desc *desc,
+    const unsigned char *pixels, int src_channels, int n_threads, pqoi_mismatch_t *mismatch);
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef PQOID_H
+#define PQOID_H
+
+#include <stddef.h>
+// qoi.h doesn't guard its implementation against a second inclusion
+#ifndef QOI_H
+#include "qoi.h"
+#endif
+
+/**
+ * Protocol of the pqoid conversion daemon.
+ *
+ * A client connects to the daemon's Unix domain socket and sends requests one at a time
+ * on the connection, each a pqoid_request_t with the input and the output buffer attached
+ * as two shared memory file descriptors (SCM_RIGHTS). The daemon maps both, converts the
+ * input straight into the output and answers with a pqoid_reply_t. Pixels and encoded
+ * bytes never travel through the socket.
+ *
+ *   PQOID_ENCODE: input width * height * channels pixels (1 gray, 2 gray + alpha, 3 RGB, 4 RGBA),
+ *                 output at least pqoid_max_encoded_size bytes, gets a parallel encoded QOI
+ *   PQOID_DECODE: input a QOI file, output width * height * channels bytes of the header,
+ *                 gets the pixels, on the device if the file carries a segment index
+ *
+ * Only POSIX systems with memfd_create are supported, elsewhere every call fails.
+ */
+#define PQOID_MAGIC \
+    (((unsigned int)'p') << 24 | ((unsigned int)'q') << 16 | \
+     ((unsigned int)'d') <<  8 | ((unsigned int)'1'))
+
+#define PQOID_SOCKET_PATH "/tmp/pqoid.sock"
+
+#define PQOID_ENCODE 1
+#define PQOID_DECODE 2
+
+typedef struct pqoid_request {
+    unsigned int magic;
+    unsigned int op;
+    unsigned int width;     // PQOID_ENCODE only
+    unsigned int height;    // PQOID_ENCODE only
+    unsigned int channels;  // PQOID_ENCODE only
+    unsigned int flags;     // PQOI_WRITE_INDEX, PQOI_VERIFY, PQOI_YCOCG
+    unsigned long long input_size;
+    unsigned long long output_size;
+} pqoid_request_t;
+
+typedef struct pqoid_reply {
+    int status;  // 1 on success
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned long long size;  // bytes written to the output
+} pqoid_reply_t;
+
+/**
+ * Shared memory a client fills and reads back, mapped in both processes.
+ */
+typedef struct pqoid_buffer {
+    int fd;
+    void *data;
+    size_t size;
+} pqoid_buffer_t;
+
+/**
+ * Create and map a shared buffer of size bytes. On Linux it is sealed against
+ * shrinking and growing, the daemon refuses buffers without F_SEAL_SHRINK.
+ *
+ * Returns 1 on success
+ */
+int pqoid_buffer_alloc(pqoid_buffer_t *buffer, size_t size);
+
+/**
+ * Unmap and close a buffer made by pqoid_buffer_alloc.
+ */
+void pqoid_buffer_free(pqoid_buffer_t *buffer);
+
+/**
+ * Connect to the daemon.
+ *
+ * path: socket of the daemon, NULL for $PQOID_SOCKET or PQOID_SOCKET_PATH
+ *
+ * Returns the connection or -1 if no daemon listens there
+ */
+int pqoid_connect(const char *path);
+
+/**
+ * Close a connection made by pqoid_connect.
+ */
+void pqoid_disconnect(int connection);
+
+/**
+ * Returns the output size a PQOID_ENCODE of desc needs
+ */
+size_t pqoid_max_encoded_size(const qoi_desc *desc);
+
+/**
+ * Encode pixels with src_channels channels on the daemon, desc->channels must be
+ * 3 for 1 and 3 source channels and 4 for 2 and 4.
+ *
+ * flags: PQOI_WRITE_INDEX, PQOI_VERIFY, PQOI_YCOCG
+ *
+ * Returns the size of the QOI written to output or 0 on failure
+ */
+size_t pqoid_encode(int connection, const pqoid_buffer_t *pixels, int src_channels, const qoi_desc *desc, int flags, pqoid_buffer_t *output);
+
+/**
+ * Decode the QOI in the first size bytes of data on the daemon into output,
+ * which must hold width * height * channels bytes of its header.
+ * desc is set from the header.
+ *
+ * Returns 1 on success
+ */
+int pqoid_decode(int connection, const pqoid_buffer_t *data, size_t size, pqoid_buffer_t *output, qoi_desc *desc);
+
+/**
+ * Send a request with its two buffers and wait for the reply, the building block of
+ * pqoid_encode and pqoid_decode.
+ *
+ * Returns 1 if a reply arrived, its status tells whether the request succeeded
+ */
+int pqoid_call(int connection, const pqoid_request_t *request, int input_fd, int output_fd, pqoid_reply_t *reply);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef QOI_COLOR_H
+#define QOI_COLOR_H
+
+#include <stddef.h>
+// qoi.h doesn't guard its implementation against a second inclusion
+#ifndef QOI_H
+#include "qoi.h"
+#endif
+
+/**
+ * Reversible color transform of the parallel encoder (PQOI_YCOCG), YCoCg-R in
+ * 8 bit lifting steps, all mod 256 with the halves of co and cg taken as signed:
+ *
+ *   co = r - b,  t = b + co / 2,  cg = g - t,  y = t + cg / 2
+ *
+ * stored as (co, y, cg) in place of (r, g, b) so luma takes the wide green
+ * delta of QOI_OP_LUMA, alpha stays as it is. The steps are undone exactly in
+ * reverse order, the transform loses nothing in 8 bits.
+ *
+ * A file holding transformed pixels has QOI_COLOR_YCOCG set in the colorspace
+ * byte of its header, plain QOI decoders refuse it instead of showing wrong colors.
+ */
+#define QOI_COLOR_YCOCG 0x10
+
+/**
+ * Transform n_px pixels of src with 3 or 4 channels into dst, which may be src.
+ */
+void qoi_color_forward(const unsigned char *src, unsigned char *dst, size_t n_px, int channels);
+
+/**
+ * Undo the transform of n_px pixels with 3 or 4 channels in place, spread over
+ * n_threads threads (0 for one per processor).
+ */
+void qoi_color_inverse(unsigned char *pixels, size_t n_px, int channels, int n_threads);
+
+/**
+ * Decode a file with QOI_COLOR_YCOCG on the cpu, the inverse on n_threads threads.
+ * desc is set from the header without the flag.
+ *
+ * Returns the pixels (released with free) or NULL if the file isn't transformed or doesn't decode
+ */
+void *qoi_color_decode(const void *data, size_t size, qoi_desc *desc, int n_threads);
+
+#endif
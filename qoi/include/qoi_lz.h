@@ -0,0 +1,65 @@
+#ifndef QOI_LZ_H
+#define QOI_LZ_H
+
+#include <stddef.h>
+
+/**
+ * LZ wrapped QOI, a byte oriented LZ stage (LZ4 style) over an encoded image for
+ * I/O bound workloads. All numbers big endian:
+ *
+ *   "qoiz", raw size (32), block size (32), block count (32)
+ *   block table: the compressed size (32) of every block, the high bit set for
+ *                a block stored as it is because it didn't get any smaller
+ *   blocks, each compressing block size bytes of the wrapped file (the last one
+ *   the rest) on its own, so they are compressed and decompressed in parallel
+ *
+ * The wrapped file is any QOI, plain or parallel encoded, header and padding
+ * included. Unwrapping gives it back byte for byte.
+ *
+ * A block is a run of LZ4 style sequences: a token with the literal count in its
+ * high and the match length - 4 in its low nibble (15 continues in the bytes that
+ * follow, every 255 adds one more byte), the literals, then a 16 bit little endian
+ * offset back into the block. The last sequence has literals only.
+ */
+#define QOI_LZ_MAGIC \
+    (((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+     ((unsigned int)'i') <<  8 | ((unsigned int)'z'))
+#define QOI_LZ_HEADER_SIZE 16
+#define QOI_LZ_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Worst case size of a wrapped file of size bytes, dst buffers of
+ * qoi_lz_compress of this size never overflow.
+ *
+ * block_size: 0 for QOI_LZ_DEFAULT_BLOCK_SIZE
+ */
+size_t qoi_lz_bound(size_t size, unsigned int block_size);
+
+/**
+ * Wrap size bytes of a QOI file, its blocks compressed on n_threads threads.
+ *
+ * block_size: 0 for QOI_LZ_DEFAULT_BLOCK_SIZE, smaller blocks give more
+ *             parallelism and fewer matches
+ * n_threads: 0 for one per processor
+ *
+ * Returns the size of the wrapped file in dst or 0 if it doesn't fit into dst_capacity
+ */
+size_t qoi_lz_compress(const void *data, size_t size, unsigned int block_size, int n_threads, void *dst, size_t dst_capacity);
+
+/**
+ * Check the header and block table of a wrapped file.
+ *
+ * Returns the size of the file it wraps or 0 if data isn't a valid wrapped file
+ */
+size_t qoi_lz_raw_size(const void *data, size_t size);
+
+/**
+ * Unwrap a file made by qoi_lz_compress into dst, its blocks decompressed on
+ * n_threads threads (0 for one per processor).
+ *
+ * Returns the size of the unwrapped file or 0 if the file is damaged or
+ * dst_capacity is below qoi_lz_raw_size
+ */
+size_t qoi_lz_decompress(const void *data, size_t size, int n_threads, void *dst, size_t dst_capacity);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef QOI_MMAP_H
+#define QOI_MMAP_H
+
+#include <stddef.h>
+// qoi.h doesn't guard its implementation against a second inclusion
+#ifndef QOI_H
+#include "qoi.h"
+#endif
+
+#define QOI_MAP_POPULATE   1  // fault in every page up front, for decoders touching the file from many threads
+#define QOI_MAP_SEQUENTIAL 2  // hint aggressive read-ahead for a front to back decode
+
+/**
+ * Read-only view of a whole file.
+ */
+typedef struct qoi_mapping {
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    void *file;
+    void *map;
+#endif
+} qoi_mapping_t;
+
+/**
+ * Map a file into memory without copying it.
+ *
+ * flags: combination of QOI_MAP_POPULATE and QOI_MAP_SEQUENTIAL
+ *
+ * Returns 1 on success
+ */
+int qoi_map_file(const char *filename, int flags, qoi_mapping_t *mapping);
+
+/**
+ * Release a mapping made by qoi_map_file.
+ */
+void qoi_unmap_file(qoi_mapping_t *mapping);
+
+/**
+ * Decode a QOI file like qoi_read, but straight from the mapped file
+ * instead of a malloc'd copy of it.
+ *
+ * Returns the decoded pixels (released with QOI_FREE) or NULL on failure
+ */
+void *qoi_read_mapped(const char *filename, qoi_desc *desc, int channels, int flags);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef QOI_OPS_H
+#define QOI_OPS_H
+
+#include <string.h>
+
+/**
+ * The QOI op codes and a decoder of single ops for the cpu decoders outside qoi.h,
+ * whose own ones live in its implementation part. The decoders keep their rules
+ * on top (ops split across chunks, tiles, rows that must stand alone) and share
+ * how an op changes the state.
+ */
+#define QOI_OPS_INDEX  0x00
+#define QOI_OPS_DIFF   0x40
+#define QOI_OPS_LUMA   0x80
+#define QOI_OPS_RUN    0xc0
+#define QOI_OPS_RGB    0xfe
+#define QOI_OPS_RGBA   0xff
+#define QOI_OPS_MASK_2 0xc0
+
+#define QOI_OPS_HASH(px) ((px)[0] * 3 + (px)[1] * 5 + (px)[2] * 7 + (px)[3] * 11)
+
+/**
+ * The state an op decodes against: the pixel before and the index of the pixels seen.
+ */
+typedef struct qoi_op_state {
+    unsigned char index[64][4];
+    unsigned char px[4];
+} qoi_op_state_t;
+
+/**
+ * Reset the state to the start of a stream, a black opaque pixel and an empty index.
+ */
+static inline void qoi_op_state_init(qoi_op_state_t *state){
+    memset(state, 0, sizeof(*state));
+    state->px[3] = 255;
+}
+
+/**
+ * Returns the bytes taken by the op starting with b1
+ */
+static inline int qoi_op_size(int b1){
+    if (b1 == QOI_OPS_RGB) {
+        return 4;
+    }
+    if (b1 == QOI_OPS_RGBA) {
+        return 5;
+    }
+    return (b1 & QOI_OPS_MASK_2) == QOI_OPS_LUMA ? 2 : 1;
+}
+
+/**
+ * Apply one complete op, qoi_op_size(op[0]) bytes, to the state.
+ *
+ * Returns the pixels it stands for: 1, or the length of a run
+ */
+static inline int qoi_op_apply(qoi_op_state_t *state, const unsigned char *op){
+    unsigned char *px = state->px;
+    int b1 = op[0];
+    int run = 1;
+
+    if (b1 == QOI_OPS_RGB) {
+        px[0] = op[1];
+        px[1] = op[2];
+        px[2] = op[3];
+    }
+    else if (b1 == QOI_OPS_RGBA) {
+        px[0] = op[1];
+        px[1] = op[2];
+        px[2] = op[3];
+        px[3] = op[4];
+    }
+    else if ((b1 & QOI_OPS_MASK_2) == QOI_OPS_INDEX) {
+        memcpy(px, state->index[b1], 4);
+    }
+    else if ((b1 & QOI_OPS_MASK_2) == QOI_OPS_DIFF) {
+        px[0] += ((b1 >> 4) & 0x03) - 2;
+        px[1] += ((b1 >> 2) & 0x03) - 2;
+        px[2] += ( b1       & 0x03) - 2;
+    }
+    else if ((b1 & QOI_OPS_MASK_2) == QOI_OPS_LUMA) {
+        int vg = (b1 & 0x3f) - 32;
+        px[0] += vg - 8 + ((op[1] >> 4) & 0x0f);
+        px[1] += vg;
+        px[2] += vg - 8 +  (op[1]       & 0x0f);
+    }
+    else {
+        run = (b1 & 0x3f) + 1;
+    }
+
+    memcpy(state->index[QOI_OPS_HASH(px) % 64], px, 4);
+    return run;
+}
+
+/**
+ * Big endian 32 bit fields of the QOI headers and the containers around them.
+ */
+static inline unsigned int qoi_get_32(const unsigned char *b){
+    return (unsigned int)b[0] << 24 | (unsigned int)b[1] << 16 | (unsigned int)b[2] << 8 | b[3];
+}
+
+static inline void qoi_put_32(unsigned char *o, unsigned int v){
+    o[0] = v >> 24;
+    o[1] = v >> 16;
+    o[2] = v >> 8;
+    o[3] = v;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef QOI_SEQUENCE_H
+#define QOI_SEQUENCE_H
+
+#include <stddef.h>
+// qoi.h doesn't guard its implementation against a second inclusion
+#ifndef QOI_H
+#include "qoi.h"
+#endif
+
+/**
+ * Frame sequence container, all numbers big endian:
+ *
+ *   "qois", width (32), height (32), channels (8), colorspace (8)
+ *   every frame:
+ *     record length (32), the bytes of the frame after this field
+ *     changed row bitmap, (height + 7) / 8 bytes, first row in the high bit of the first byte
+ *     length (32) of every changed row
+ *     the changed rows, each a QOI op stream starting from a reset state like the
+ *     rows of the parallel encoder, unchanged rows are the rows of the frame before
+ *   the usual 8 byte QOI padding after the last frame
+ */
+#define QOI_SEQUENCE_MAGIC \
+    (((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+     ((unsigned int)'i') <<  8 | ((unsigned int)'s'))
+#define QOI_SEQUENCE_HEADER_SIZE 14
+#define QOI_SEQUENCE_BITMAP_SIZE(desc) (((size_t)(desc)->height + 7) / 8)
+
+/**
+ * Decoder state of a sequence, points into the caller's data.
+ */
+typedef struct qoi_sequence_reader {
+    qoi_desc desc;
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+
+    unsigned char *pixels;  // the current frame
+    unsigned int frame;     // frames decoded so far
+} qoi_sequence_reader_t;
+
+/**
+ * Write the container header of a sequence into dst (QOI_SEQUENCE_HEADER_SIZE bytes).
+ */
+void qoi_sequence_write_header(unsigned char *dst, const qoi_desc *desc);
+
+/**
+ * Parse the header of a sequence, data must stay valid while the reader is used.
+ *
+ * Returns 1 on success
+ */
+int qoi_sequence_open(qoi_sequence_reader_t *reader, const void *data, size_t size);
+
+/**
+ * Decode the next frame, only its changed rows are decoded.
+ *
+ * changed_rows: set to the number of rows that differ from the frame before (optional)
+ *
+ * Returns width * height * channels bytes of pixels owned by the reader and valid
+ * until the next call, or NULL after the last frame or on invalid data
+ */
+const unsigned char *qoi_sequence_next(qoi_sequence_reader_t *reader, unsigned int *changed_rows);
+
+/**
+ * Release the frame buffer of the reader.
+ */
+void qoi_sequence_close(qoi_sequence_reader_t *reader);
+
+#endif
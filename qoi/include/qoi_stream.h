@@ -0,0 +1,80 @@
+#ifndef QOI_STREAM_H
+#define QOI_STREAM_H
+
+#include <stddef.h>
+// qoi.h doesn't guard its implementation against a second inclusion
+#ifndef QOI_H
+#include "qoi.h"
+#endif
+#include "qoi_ops.h"
+
+#define QOI_STREAM_HEADER_SIZE 14
+
+typedef struct qoi_stream_decoder qoi_stream_decoder_t;
+
+/**
+ * Called once for every completed row, row points to width * channels bytes
+ * that are only valid until the callback returns.
+ */
+typedef void (*qoi_row_callback)(qoi_stream_decoder_t *decoder, const unsigned char *row, unsigned int y, void *user_data);
+
+/**
+ * Resumable QOI decoder, the compressed bytes are pushed in chunks of any size
+ * as they arrive. Holds one row of pixels and the decoder state, the header,
+ * an op split across two chunks and the run and index carry over between pushes.
+ */
+struct qoi_stream_decoder {
+    qoi_desc desc;  // valid once the header has been pushed
+    int channels;   // of the emitted rows
+
+    int stage;
+    unsigned char pending[QOI_STREAM_HEADER_SIZE];  // header or op split across chunks
+    int pending_len;
+
+    qoi_op_state_t ops;
+    int run;
+
+    unsigned char *row;
+    unsigned int x;
+    unsigned int y;
+
+    qoi_row_callback callback;
+    void *user_data;
+};
+
+/**
+ * channels: 3 or 4 for the rows handed to callback, 0 for the channels of the image
+ *
+ * Returns 1 on success
+ */
+int qoi_stream_decoder_init(qoi_stream_decoder_t *decoder, int channels, qoi_row_callback callback, void *user_data);
+
+/**
+ * Decode the next len bytes of the stream, callback is called for every row
+ * they complete. Bytes after the padding are ignored.
+ *
+ * Returns 1 on success, 0 if the stream is invalid or the row couldn't be allocated
+ */
+int qoi_stream_decoder_push(qoi_stream_decoder_t *decoder, const void *data, size_t len);
+
+/**
+ * Returns 1 once every row of the image has been emitted
+ */
+int qoi_stream_decoder_finished(const qoi_stream_decoder_t *decoder);
+
+/**
+ * Release the row buffer of the decoder.
+ */
+void qoi_stream_decoder_free(qoi_stream_decoder_t *decoder);
+
+/**
+ * Decode n_px pixels of a segment that was encoded from a reset state, like the
+ * rows of the parallel encoder, without reading past len bytes.
+ *
+ * channels: 3 or 4 for the decoded pixels
+ *
+ * Returns the number of bytes the segment took or 0 if it ends early
+ */
+size_t qoi_decode_segment(const void *data, size_t len, unsigned char *pixels, size_t n_px, int channels);
+
+#endif
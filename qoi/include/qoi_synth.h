@@ -0,0 +1,49 @@
+#ifndef QOI_SYNTH_H
+#define QOI_SYNTH_H
+
+#include <stddef.h>
+
+/**
+ * Deterministic synthetic images for scaling and worst case benchmarks. Every
+ * pixel is a function of its position, the size and the seed only, so any band
+ * of rows comes out the same whether it is generated alone, on another thread
+ * or as part of the whole image.
+ */
+enum {
+    QOI_SYNTH_GRADIENT,  // smooth diagonal color ramps, DIFF and LUMA all the way
+    QOI_SYNTH_NOISE,     // every channel random, the entropy worst case
+    QOI_SYNTH_UI,        // flat windows, buttons and text lines like a screenshot
+    QOI_SYNTH_SPRITES,   // round sprites with soft alpha edges on a transparent background
+    QOI_SYNTH_SOLID,     // one color, a single run after the first pixel of every row
+    QOI_SYNTH_COLLIDE,   // colors that share one index slot and never fit DIFF or LUMA
+    QOI_SYNTH_COUNT
+};
+
+/**
+ * Name of a pattern ("gradient", "noise", ...) or NULL past QOI_SYNTH_COUNT.
+ */
+const char *qoi_synth_name(int pattern);
+
+/**
+ * Pattern with the given name.
+ *
+ * Returns the pattern or -1 for an unknown name
+ */
+int qoi_synth_find(const char *name);
+
+/**
+ * Generate n_rows rows from first_row on of a width x height image into dst,
+ * tightly packed with 3 (RGB) or 4 (RGBA) channels.
+ */
+void qoi_synth_rows(int pattern, unsigned int width, unsigned int height, int channels, unsigned int seed,
+    unsigned int first_row, unsigned int n_rows, unsigned char *dst);
+
+/**
+ * Generate a whole image, its bands of rows on n_threads threads (0 for one per processor).
+ *
+ * Returns the pixels (released with free) or NULL for an unknown pattern,
+ * a bad size or out of memory
+ */
+void *qoi_synth_image(int pattern, unsigned int width, unsigned int height, int channels, unsigned int seed, int n_threads);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef QOI_TILES_H
+#define QOI_TILES_H
+
+#include <stddef.h>
+// qoi.h doesn't guard its implementation against a second inclusion
+#ifndef QOI_H
+#include "qoi.h"
+#endif
+
+/**
+ * Tiled container, all numbers big endian:
+ *
+ *   "qoit", width (32), height (32), channels (8), colorspace (8), tile size (32)
+ *   tile offset table: tiles_x * tiles_y + 1 offsets (64) relative to the first tile,
+ *                      the last one is the end of the last tile
+ *   tiles in raster order, each a QOI op stream of its tile_w * tile_h pixels
+ *   starting from the usual QOI state, so every tile decodes on its own
+ *   the usual 8 byte QOI padding
+ *
+ * Tiles on the right and bottom edge are cut to the image.
+ */
+#define QOI_TILES_MAGIC \
+    (((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+     ((unsigned int)'i') <<  8 | ((unsigned int)'t'))
+#define QOI_TILES_HEADER_SIZE 18
+#define QOI_TILES_DEFAULT_SIZE 256
+#define QOI_TILES_MAX_SIZE 4096
+
+/**
+ * An opened tiled image, points into the caller's data.
+ */
+typedef struct qoi_tiled {
+    qoi_desc desc;
+    unsigned int tile_size;
+    unsigned int tiles_x;
+    unsigned int tiles_y;
+    const unsigned char *table;
+    const unsigned char *tiles;
+    size_t tiles_len;
+} qoi_tiled_t;
+
+/**
+ * Number of tiles in a row and a column of an image.
+ */
+#define QOI_TILES_X(desc, tile_size) (((desc)->width + (tile_size) - 1) / (tile_size))
+#define QOI_TILES_Y(desc, tile_size) (((desc)->height + (tile_size) - 1) / (tile_size))
+
+/**
+ * Write the container header of an image into dst (QOI_TILES_HEADER_SIZE bytes).
+ */
+void qoi_tiles_write_header(unsigned char *dst, const qoi_desc *desc, unsigned int tile_size);
+
+/**
+ * Parse the header and the tile offset table of a tiled image, data must stay
+ * valid while the tiled image is used.
+ *
+ * Returns 1 if data holds a valid tiled image
+ */
+int qoi_tiled_open(qoi_tiled_t *tiled, const void *data, size_t size);
+
+/**
+ * Decode the rectangle (x, y, w, h) of a tiled image. Only the tiles
+ * intersecting it are decoded, spread over n_threads threads.
+ *
+ * channels: 3 or 4, 0 for the channels of the image
+ * n_threads: 0 for one per processor
+ *
+ * Returns w * h * channels bytes of pixels (released with free) or NULL on failure
+ */
+void *qoi_tiled_decode_rect(const qoi_tiled_t *tiled, int x, int y, int w, int h, int channels, int n_threads);
+
+#endif
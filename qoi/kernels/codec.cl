@@ -7,20 +7,68 @@
 
 #define QOI_COLOR_HASH(C) (C.rgba.r*3 + C.rgba.g*5 + C.rgba.b*7 + C.rgba.a*11)
 
+// op counters of a row, in the order of PQOI_STAT_* on the host
+#define STAT_RUN        0
+#define STAT_INDEX      1
+#define STAT_DIFF       2
+#define STAT_LUMA       3
+#define STAT_RGB        4
+#define STAT_RGBA       5
+#define STAT_RUN_PIXELS 6
+#define STAT_COUNT      7
+
+// half of an 8 bit value taken as signed, rounded down like an arithmetic shift
+#define HALF_S8(v) ((unsigned char)(((v) >> 1) | ((v) & 0x80)))
+
 typedef union {
 	struct { unsigned char r, g, b, a; } rgba;
 	unsigned int v;
 } qoi_rgba_t;
 
-__kernel void encode(__global unsigned char *pixels, __global unsigned char *bytes, __global unsigned int *chunk_lens, int width, int channels)
+// YCoCg-R of qoi_color.h, (r, g, b) becomes (co, y, cg)
+qoi_rgba_t forward_ycocg(qoi_rgba_t px)
+{
+	unsigned char co = px.rgba.r - px.rgba.b;
+	unsigned char t = px.rgba.b + HALF_S8(co);
+	unsigned char cg = px.rgba.g - t;
+
+	px.rgba.r = co;
+	px.rgba.g = t + HALF_S8(cg);
+	px.rgba.b = cg;
+	return px;
+}
+
+qoi_rgba_t inverse_ycocg(qoi_rgba_t px)
+{
+	unsigned char co = px.rgba.r;
+	unsigned char cg = px.rgba.b;
+	unsigned char t = px.rgba.g - HALF_S8(cg);
+
+	px.rgba.g = cg + t;
+	px.rgba.b = t - HALF_S8(co);
+	px.rgba.r = px.rgba.b + co;
+	return px;
+}
+
+// encode height rows of width pixels into bytes[p...] as one op stream from a reset state, the
+// first row starts at pixels[id] and every next one row_stride bytes further, the state and a
+// run carry on from one row to the next
+// src_channels is the layout of pixels (1 gray, 2 gray + alpha, 3 RGB, 4 RGBA),
+// gray is expanded to RGB here so the host only uploads the source bytes
+// with transform every pixel goes through forward_ycocg as it is read, the ops see the transformed colors
+// with standalone the stream also decodes after any other with a plain QOI decoder, like the rows
+// of the parallel encoder: the first pixel is a literal and only index slots set in this stream
+// are referenced, so nothing depends on the state an earlier one leaves behind
+// stats (may be 0) gets the STAT_COUNT op counters of the stream, they are kept in private memory until the end
+// returns the number of bytes written
+unsigned int encode_rows(__global const unsigned char *pixels, unsigned int id, unsigned int row_stride, int width, int height,
+	__global unsigned char *bytes, unsigned int p, int src_channels, int transform, int standalone, __global unsigned int *stats)
 {
-	// encode pixels
-	int id = get_global_id(0) * width * channels;
-	// byte index, account for tags
-	unsigned int p = get_global_id(0) * width * (channels + 1);
 	unsigned int start = p;
+	unsigned int counts[STAT_COUNT] = {0};
 
 	qoi_rgba_t index[64] = {0};
+	ulong written = 0;
 	qoi_rgba_t px, px_prev;
 
 	int run = 0;
@@ -29,84 +77,257 @@ __kernel void encode(__global unsigned char *pixels, __global unsigned char *byt
 	px_prev.rgba.b = 0;
 	px_prev.rgba.a = 255;
 	px = px_prev;
-	
-	
-	for (int px_pos = 0; px_pos < width * channels; px_pos += channels){
-		px.rgba.r = pixels[id + px_pos + 0];
-		px.rgba.g = pixels[id + px_pos + 1];
-		px.rgba.b = pixels[id + px_pos + 2];
 
-		if (channels == 4) {
-			px.rgba.a = pixels[id + px_pos + 3];
-		}
+	for (int y = 0; y < height; y++, id += row_stride){
+		for (int px_pos = 0; px_pos < width * src_channels; px_pos += src_channels){
+			int first = y == 0 && px_pos == 0;
+			int last = y == height - 1 && px_pos == (width * src_channels) - src_channels;
 
+			if (src_channels < 3) {
+				px.rgba.r = pixels[id + px_pos];
+				px.rgba.g = px.rgba.r;
+				px.rgba.b = px.rgba.r;
 
-		if (px.v == px_prev.v) {
-			run++;
-			if (run == 62 || px_pos == (width * channels) - channels) {
-				bytes[p++] = QOI_OP_RUN | (run - 1);
-				run = 0;
+				if (src_channels == 2) {
+					px.rgba.a = pixels[id + px_pos + 1];
+				}
 			}
-		}
-		else {
-			int index_pos;
+			else {
+				px.rgba.r = pixels[id + px_pos + 0];
+				px.rgba.g = pixels[id + px_pos + 1];
+				px.rgba.b = pixels[id + px_pos + 2];
 
-			if (run > 0) {
-				bytes[p++] = QOI_OP_RUN | (run - 1);
-				run = 0;
+				if (src_channels == 4) {
+					px.rgba.a = pixels[id + px_pos + 3];
+				}
+			}
+			if (transform) {
+				px = forward_ycocg(px);
 			}
 
-			index_pos = QOI_COLOR_HASH(px) % 64;
+			if (first && standalone) {
+				int index_pos = QOI_COLOR_HASH(px) % 64;
+				index[index_pos] = px;
+				written |= (ulong)1 << index_pos;
 
-			if (index[index_pos].v == px.v) {
-				bytes[p++] = QOI_OP_INDEX | index_pos;
+				if (src_channels & 1) {
+					counts[STAT_RGB]++;
+					bytes[p++] = QOI_OP_RGB;
+					bytes[p++] = px.rgba.r;
+					bytes[p++] = px.rgba.g;
+					bytes[p++] = px.rgba.b;
+				}
+				else {
+					counts[STAT_RGBA]++;
+					bytes[p++] = QOI_OP_RGBA;
+					bytes[p++] = px.rgba.r;
+					bytes[p++] = px.rgba.g;
+					bytes[p++] = px.rgba.b;
+					bytes[p++] = px.rgba.a;
+				}
+			}
+			else if (px.v == px_prev.v) {
+				run++;
+				if (run == 62 || last) {
+					counts[STAT_RUN]++;
+					counts[STAT_RUN_PIXELS] += run;
+					bytes[p++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
 			}
 			else {
-				index[index_pos] = px;
+				int index_pos;
 
-				if (px.rgba.a == px_prev.rgba.a){
-					signed char vr = px.rgba.r - px_prev.rgba.r;
-					signed char vg = px.rgba.g - px_prev.rgba.g;
-					signed char vb = px.rgba.b - px_prev.rgba.b;
+				if (run > 0) {
+					counts[STAT_RUN]++;
+					counts[STAT_RUN_PIXELS] += run;
+					bytes[p++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
 
-					signed char vg_r = vr - vg;
-					signed char vg_b = vb - vg;
+				index_pos = QOI_COLOR_HASH(px) % 64;
 
-					if (
-						vr > -3 && vr < 2 &&
-						vg > -3 && vg < 2 &&
-						vb > -3 && vb < 2
-					) {
-						bytes[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
-					}
-					else if (
-						vg_r >  -9 && vg_r <  8 &&
-						vg   > -33 && vg   < 32 &&
-						vg_b >  -9 && vg_b <  8
-					) {
-						bytes[p++] = QOI_OP_LUMA     | (vg   + 32);
-						bytes[p++] = (vg_r + 8) << 4 | (vg_b +  8);
+				if ((!standalone || ((written >> index_pos) & 1)) && index[index_pos].v == px.v) {
+					counts[STAT_INDEX]++;
+					bytes[p++] = QOI_OP_INDEX | index_pos;
+				}
+				else {
+					index[index_pos] = px;
+					written |= (ulong)1 << index_pos;
+
+					if (px.rgba.a == px_prev.rgba.a){
+						signed char vr = px.rgba.r - px_prev.rgba.r;
+						signed char vg = px.rgba.g - px_prev.rgba.g;
+						signed char vb = px.rgba.b - px_prev.rgba.b;
+
+						signed char vg_r = vr - vg;
+						signed char vg_b = vb - vg;
+
+						if (
+							vr > -3 && vr < 2 &&
+							vg > -3 && vg < 2 &&
+							vb > -3 && vb < 2
+						) {
+							counts[STAT_DIFF]++;
+							bytes[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+						}
+						else if (
+							vg_r >  -9 && vg_r <  8 &&
+							vg   > -33 && vg   < 32 &&
+							vg_b >  -9 && vg_b <  8
+						) {
+							counts[STAT_LUMA]++;
+							bytes[p++] = QOI_OP_LUMA     | (vg   + 32);
+							bytes[p++] = (vg_r + 8) << 4 | (vg_b +  8);
+						}
+						else {
+							counts[STAT_RGB]++;
+							bytes[p++] = QOI_OP_RGB;
+							bytes[p++] = px.rgba.r;
+							bytes[p++] = px.rgba.g;
+							bytes[p++] = px.rgba.b;
+						}
 					}
 					else {
-						bytes[p++] = QOI_OP_RGB;
+						counts[STAT_RGBA]++;
+						bytes[p++] = QOI_OP_RGBA;
 						bytes[p++] = px.rgba.r;
 						bytes[p++] = px.rgba.g;
 						bytes[p++] = px.rgba.b;
+						bytes[p++] = px.rgba.a;
 					}
 				}
-				else {
-					bytes[p++] = QOI_OP_RGBA;
-					bytes[p++] = px.rgba.r;
-					bytes[p++] = px.rgba.g;
-					bytes[p++] = px.rgba.b;
-					bytes[p++] = px.rgba.a;
-				}
 			}
+
+			px_prev = px;
 		}
+	}
 
-		px_prev = px;
+	if (stats) {
+		for (int i = 0; i < STAT_COUNT; i++){
+			stats[i] = counts[i];
+		}
 	}
-	
-	chunk_lens[get_global_id(0)] = p - start;
+	return p - start;
 }
 
+// channels is the QOI output (3 or 4) and sets the size of the row slots
+// transform applies the reversible color transform (PQOI_YCOCG) on the fly
+// stats is 0 or takes STAT_COUNT counters for every row (PQOI_STATS)
+__kernel void encode(__global unsigned char *pixels, __global unsigned char *bytes, __global unsigned int *chunk_lens, int width, int channels, int src_channels, int transform,
+	__global unsigned int *stats)
+{
+	int row = get_global_id(0);
+	// byte index, account for tags
+	chunk_lens[row] = encode_rows(pixels, row * width * src_channels, 0, width, 1, bytes, row * width * (channels + 1), src_channels, transform, 1,
+		stats ? stats + row * STAT_COUNT : 0);
+}
+
+// encode only the rows that differ from the same row of the previous frame, unchanged rows
+// get a length of 0 (an encoded row never is empty), has_prev is 0 for the first frame
+__kernel void encode_sequence(__global unsigned char *pixels, __global unsigned char *prev, __global unsigned char *bytes, __global unsigned int *chunk_lens, int width, int channels, int has_prev)
+{
+	int row = get_global_id(0);
+	int id = row * width * channels;
+
+	if (has_prev) {
+		int same = 1;
+		for (int i = 0; i < width * channels && same; i++){
+			same = pixels[id + i] == prev[id + i];
+		}
+		if (same) {
+			chunk_lens[row] = 0;
+			return;
+		}
+	}
+
+	chunk_lens[row] = encode_rows(pixels, id, 0, width, 1, bytes, row * width * (channels + 1), channels, 0, 1, 0);
+}
+
+// inverse of encode: every work item reconstructs one row (segment) from its own offset
+// in the stream, with the same reset state at the start of every row
+// transform undoes the color transform of the file (QOI_COLOR_YCOCG) on the way out
+__kernel void decode(__global const unsigned char *bytes, __global const unsigned int *offsets, __global unsigned char *pixels, int width, int channels, int transform)
+{
+	int row = get_global_id(0);
+	int id = row * width * channels;
+	unsigned int p = offsets[row];
+	unsigned int end = offsets[row + 1];
+
+	qoi_rgba_t index[64] = {0};
+	qoi_rgba_t px;
+
+	int run = 0;
+	px.rgba.r = 0;
+	px.rgba.g = 0;
+	px.rgba.b = 0;
+	px.rgba.a = 255;
+
+	for (int px_pos = 0; px_pos < width * channels; px_pos += channels){
+		if (run > 0) {
+			run--;
+		}
+		else if (p < end) {
+			int b1 = bytes[p++];
+
+			if (b1 == QOI_OP_RGB) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+			}
+			else if (b1 == QOI_OP_RGBA) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+			}
+			else if ((b1 & 0xc0) == QOI_OP_INDEX) {
+				px = index[b1];
+			}
+			else if ((b1 & 0xc0) == QOI_OP_DIFF) {
+				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+				px.rgba.b += ( b1       & 0x03) - 2;
+			}
+			else if ((b1 & 0xc0) == QOI_OP_LUMA) {
+				int b2 = bytes[p++];
+				int vg = (b1 & 0x3f) - 32;
+				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.rgba.g += vg;
+				px.rgba.b += vg - 8 +  (b2       & 0x0f);
+			}
+			else if ((b1 & 0xc0) == QOI_OP_RUN) {
+				run = (b1 & 0x3f);
+			}
+
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+
+		qoi_rgba_t out = transform ? inverse_ycocg(px) : px;
+		pixels[id + px_pos + 0] = out.rgba.r;
+		pixels[id + px_pos + 1] = out.rgba.g;
+		pixels[id + px_pos + 2] = out.rgba.b;
+
+		if (channels == 4) {
+			pixels[id + px_pos + 3] = out.rgba.a;
+		}
+	}
+}
+
+// encode every tile_size x tile_size tile (cut at the right and bottom edge) as one
+// plain QOI op stream, with the state carried across the rows of the tile
+// every work item owns a slot of tile_size * tile_size * (channels + 1) bytes, in unsigned
+// arithmetic as the host allows tiled images of up to 4 GiB of slots
+__kernel void encode_tiles(__global unsigned char *pixels, __global unsigned char *bytes, __global unsigned int *chunk_lens, int width, int height, int channels, int tile_size)
+{
+	int tiles_x = (width + tile_size - 1) / tile_size;
+	int tile = get_global_id(0);
+	int x0 = (tile % tiles_x) * tile_size;
+	int y0 = (tile / tiles_x) * tile_size;
+	int tile_w = min(tile_size, width - x0);
+	int tile_h = min(tile_size, height - y0);
+
+	unsigned int slot = (unsigned int)tile_size * tile_size * (channels + 1);
+	unsigned int id = ((unsigned int)y0 * width + x0) * channels;
+	chunk_lens[tile] = encode_rows(pixels, id, (unsigned int)width * channels, tile_w, tile_h, bytes, (unsigned int)tile * slot, channels, 0, 0, 0);
+}
@@ -1,3 +1,15 @@
+#include "pqoi_alloc.h"
+
+// route the per-image allocations of stb and qoi through the selected allocator
+#define STBI_MALLOC(sz)       pqoi_malloc(sz)
+#define STBI_REALLOC(p, sz)   pqoi_realloc(p, sz)
+#define STBI_FREE(p)          pqoi_free(p)
+#define STBIW_MALLOC(sz)      pqoi_malloc(sz)
+#define STBIW_REALLOC(p, sz)  pqoi_realloc(p, sz)
+#define STBIW_FREE(p)         pqoi_free(p)
+#define QOI_MALLOC(sz)        pqoi_malloc(sz)
+#define QOI_FREE(p)           pqoi_free(p)
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_ONLY_PNG
 #define STBI_NO_LINEAR
@@ -10,37 +22,752 @@
 #include "qoi.h"
 
 #include "parallel_qoi.h"
+#include "ingest.h"
+#include "png_writer.h"
+#include "qoi_mmap.h"
+#include "qoi_tiles.h"
+#include "qoi_lz.h"
+#include "qoi_color.h"
+#include "pqoid.h"
 
 #define STR_ENDS_WITH(S, E) (strcmp(S + strlen(S) - (sizeof(E)-1), E) == 0)
 
+// the trace of --trace or NULL, file wide because load_png runs as the ingest callback
+static pqoi_trace_t *trace;
+
+// decode a png in its own channels, gray and gray + alpha stay as they are
+static void *load_png(const char *path, int *w, int *h, int *channels){
+    double begin = pqoi_trace_begin(trace);
+    void *pixels = (void *)stbi_load(path, w, h, channels, 0);
+    pqoi_trace_span(trace, "png decode", path, begin);
+    return pixels;
+}
+
+// pqoi_session_init with the kernel build in the trace, the session then traces its commands
+static void init_session(pqoi_session_t *session){
+    double begin = pqoi_trace_begin(trace);
+    pqoi_session_init(session);
+    pqoi_trace_span(trace, "build", NULL, begin);
+    session->trace = trace;
+}
+
+// expand gray and gray + alpha to the RGB / RGBA the sequential encoder takes
+// returns pixels (released with pqoi_free), the same pixels for 3 and 4 channels
+static void *expand_channels(const void *pixels, int w, int h, int channels){
+    if (channels >= 3) {
+        return (void *)pixels;
+    }
+
+    int out_channels = PQOI_QOI_CHANNELS(channels);
+    size_t n_px = (size_t)w * h;
+    const unsigned char *src = (const unsigned char *)pixels;
+    unsigned char *out = (unsigned char *)pqoi_malloc(n_px * out_channels);
+    if (!out) {
+        return NULL;
+    }
+
+    unsigned char *o = out;
+    for (size_t i = 0; i < n_px; i++) {
+        o[0] = o[1] = o[2] = src[0];
+        if (channels == 2) {
+            o[3] = src[1];
+        }
+        src += channels;
+        o += out_channels;
+    }
+    return out;
+}
+
+// wrap size bytes of an encoded qoi in the LZ container (see qoi_lz.h) and write it to path
+// returns the size of the file or 0 on failure
+static int write_lz(const char *path, const void *qoi, size_t size){
+    size_t capacity = qoi_lz_bound(size, 0);
+    unsigned char *wrapped = (unsigned char *)malloc(capacity);
+    if (!wrapped) {
+        return 0;
+    }
+
+    clock_t begin = clock();
+    size_t wrapped_size = qoi_lz_compress(qoi, size, 0, 0, wrapped, capacity);
+    clock_t end = clock();
+    printf("LZ stage time: %lfs, %zu -> %zu bytes\n", (double)(end - begin) / CLOCKS_PER_SEC, size, wrapped_size);
+
+    double traced = pqoi_trace_begin(trace);
+    FILE *f = wrapped_size && wrapped_size <= INT_MAX ? fopen(path, "wb") : NULL;
+    int written = 0;
+    if (f) {
+        written = fwrite(wrapped, 1, wrapped_size, f) == wrapped_size ? (int)wrapped_size : 0;
+        written = fclose(f) == 0 ? written : 0;
+    }
+    pqoi_trace_span(trace, "file write", path, traced);
+    free(wrapped);
+    return written;
+}
+
+// encode pixels of any channel count with the sequential encoder, LZ wrapped with lz
+// perf (optional) counts the encoder as a stage
+static int write_qoi_sequential(const char *path, const void *pixels, int w, int h, int channels, int lz, pqoi_perf_t *perf){
+    void *expanded = expand_channels(pixels, w, h, channels);
+    if (!expanded) {
+        return 0;
+    }
+
+    qoi_desc desc = {
+        .width = w,
+        .height = h,
+        .channels = PQOI_QOI_CHANNELS(channels),
+        .colorspace = QOI_SRGB
+    };
+    int written = 0;
+    if (lz) {
+        int size;
+        pqoi_perf_begin(perf, "qoi encode");
+        double traced = pqoi_trace_begin(trace);
+        void *encoded = qoi_encode(expanded, &desc, &size);
+        pqoi_trace_span(trace, "qoi encode", path, traced);
+        pqoi_perf_end(perf, NULL);
+        written = encoded && write_lz(path, encoded, size);
+        QOI_FREE(encoded);
+    }
+    else {
+        pqoi_perf_begin(perf, "qoi write");
+        double traced = pqoi_trace_begin(trace);
+        written = qoi_write(path, expanded, &desc);
+        pqoi_trace_span(trace, "qoi write", path, traced);
+        pqoi_perf_end(perf, NULL);
+    }
+
+    if (expanded != pixels) {
+        pqoi_free(expanded);
+    }
+    return written;
+}
+
+// encode pixels of any channel count on the session, LZ wrapped with lz
+// without it the parallel segments go to the file without being merged
+static int write_qoi_parallel(pqoi_session_t *session, const char *path, const void *pixels, int channels, const qoi_desc *desc, int lz){
+    if (!lz) {
+        return pqoi_write_channels(session, path, pixels, channels, desc);
+    }
+
+    int capacity = pqoi_max_encoded_size(desc);
+    unsigned char *encoded = capacity ? (unsigned char *)malloc(capacity) : NULL;
+    if (!encoded) {
+        return 0;
+    }
+    int size = pqoi_encode_channels_into(session, pixels, channels, desc, encoded, capacity);
+    int written = size && write_lz(path, encoded, size);
+    free(encoded);
+    return written;
+}
+
+// print the op counters of the image the session encoded last (PQOI_STATS), totals first,
+// then the bytes per pixel of up to 32 bands of rows as a heatmap, darker and longer for worse compression
+static void print_stats(const char *name, const pqoi_session_t *session, const qoi_desc *desc){
+    const pqoi_frame_t *frame = &session->frame;
+    unsigned long long totals[PQOI_STAT_COUNT];
+    pqoi_stats_total(frame->stats, desc->height, totals);
+
+    unsigned long long size = 0;
+    for (unsigned int row = 0; row < desc->height; row++) {
+        size += frame->segment_lengths[row];
+    }
+    printf("%s: %ux%u, %llu bytes of segments, %.3f bytes per pixel\n", name, desc->width, desc->height,
+        size, (double)size / ((double)desc->width * desc->height));
+    printf("  RUN %llu (%llu px)  INDEX %llu  DIFF %llu  LUMA %llu  RGB %llu  RGBA %llu\n",
+        totals[PQOI_STAT_RUN], totals[PQOI_STAT_RUN_PIXELS], totals[PQOI_STAT_INDEX], totals[PQOI_STAT_DIFF],
+        totals[PQOI_STAT_LUMA], totals[PQOI_STAT_RGB], totals[PQOI_STAT_RGBA]);
+
+    // a row never takes more than channels + 1 bytes per pixel
+    static const char shades[] = ".:-=+*#%@";
+    double worst = desc->channels + 1;
+    unsigned int n_bands = desc->height < 32 ? desc->height : 32;
+    for (unsigned int band = 0; band < n_bands; band++) {
+        unsigned int first = (unsigned long long)desc->height * band / n_bands;
+        unsigned int last = (unsigned long long)desc->height * (band + 1) / n_bands;
+        unsigned long long band_size = 0;
+        for (unsigned int row = first; row < last; row++) {
+            band_size += frame->segment_lengths[row];
+        }
+
+        double bpp = (double)band_size / ((double)desc->width * (last - first));
+        int len = (int)(bpp / worst * 40 + 0.5);
+        int shade = (int)(bpp / worst * (sizeof(shades) - 2) + 0.5);
+        char bar[41];
+        memset(bar, shades[shade], len);
+        bar[len] = '\0';
+        printf("  rows %5u-%-5u %6.3f |%-40s|\n", first, last - 1, bpp, bar);
+    }
+}
+
+// decode a qoi on the cpu, including files with the color transform of the parallel encoder
+// returns the pixels or NULL, with *heap set when they are released with free instead of QOI_FREE
+static void *decode_qoi_cpu(const void *data, int size, qoi_desc *desc, int *heap){
+    void *pixels = qoi_color_decode(data, size, desc, 0);
+    *heap = pixels != NULL;
+    return pixels ? pixels : qoi_decode(data, size, desc, 0);
+}
+
+// decode a qoi on the device if it carries a segment index, on the cpu otherwise
+// returns the pixels or NULL, with *heap set when they are released with free instead of QOI_FREE
+static void *load_qoi_device(const char *path, qoi_desc *desc, int *heap){
+    *heap = 0;
+    qoi_mapping_t mapping;
+    if (!qoi_map_file(path, QOI_MAP_SEQUENTIAL, &mapping) || mapping.size > INT_MAX) {
+        return NULL;
+    }
+
+    pqoi_session_t session;
+    init_session(&session);
+    void *pixels = pqoi_decode(&session, mapping.data, (int)mapping.size, desc);
+    cl_int err = session.error;
+    pqoi_session_release(&session);
+
+    if (pixels == NULL) {
+        printf(err == CL_SUCCESS ? "%s has no segment index, decoding on the cpu\n" : "%s didn't decode on the device, decoding on the cpu\n", path);
+        pixels = decode_qoi_cpu(mapping.data, (int)mapping.size, desc, heap);
+    }
+
+    qoi_unmap_file(&mapping);
+    return pixels;
+}
+
+// decode a qoi with the color transform of the parallel encoder on the cpu
+// returns the pixels (released with free) or NULL if the file doesn't have it or doesn't decode
+static void *load_qoi_color(const char *path, qoi_desc *desc){
+    qoi_mapping_t mapping;
+    if (!qoi_map_file(path, QOI_MAP_SEQUENTIAL, &mapping)) {
+        return NULL;
+    }
+    void *pixels = qoi_color_decode(mapping.data, mapping.size, desc, 0);
+    qoi_unmap_file(&mapping);
+    return pixels;
+}
+
+// decode a qoi wrapped in the LZ container, on the device with device_decode if it carries a segment index
+// returns NULL if the file isn't wrapped (*wrapped = 0) or doesn't decode,
+// *heap is set when the pixels are released with free instead of QOI_FREE
+static void *load_qoi_lz(const char *path, qoi_desc *desc, int device_decode, int *wrapped, int *heap){
+    *wrapped = 0;
+    *heap = 0;
+    qoi_mapping_t mapping;
+    if (!qoi_map_file(path, QOI_MAP_SEQUENTIAL, &mapping)) {
+        return NULL;
+    }
+
+    size_t size = qoi_lz_raw_size(mapping.data, mapping.size);
+    if (size == 0 || size > INT_MAX) {
+        qoi_unmap_file(&mapping);
+        return NULL;
+    }
+
+    *wrapped = 1;
+    void *pixels = NULL;
+    unsigned char *encoded = (unsigned char *)malloc(size);
+    if (encoded) {
+        clock_t begin = clock();
+        int ok = qoi_lz_decompress(mapping.data, mapping.size, 0, encoded, size) == size;
+        clock_t end = clock();
+        printf("LZ stage time: %lfs, %zu -> %zu bytes\n", (double)(end - begin) / CLOCKS_PER_SEC, mapping.size, size);
+
+        if (ok && device_decode) {
+            pqoi_session_t session;
+            init_session(&session);
+            pixels = pqoi_decode(&session, encoded, (int)size, desc);
+            pqoi_session_release(&session);
+        }
+        if (ok && pixels == NULL) {
+            pixels = decode_qoi_cpu(encoded, (int)size, desc, heap);
+        }
+    }
+
+    free(encoded);
+    qoi_unmap_file(&mapping);
+    return pixels;
+}
+
+// decode the crop (x, y, w, h) of a tiled qoi, w = 0 for the whole image
+// returns the pixels (released with free) or NULL if the file isn't a tiled image
+static void *load_qoi_tiled(const char *path, qoi_desc *desc, const int crop[4]){
+    qoi_mapping_t mapping;
+    if (!qoi_map_file(path, 0, &mapping)) {
+        return NULL;
+    }
+
+    void *pixels = NULL;
+    qoi_tiled_t tiled;
+    if (qoi_tiled_open(&tiled, mapping.data, mapping.size)) {
+        *desc = tiled.desc;
+        if (crop[2] > 0) {
+            desc->width = crop[2];
+            desc->height = crop[3];
+            pixels = qoi_tiled_decode_rect(&tiled, crop[0], crop[1], crop[2], crop[3], 0, 0);
+        }
+        else {
+            pixels = qoi_tiled_decode_rect(&tiled, 0, 0, tiled.desc.width, tiled.desc.height, 0, 0);
+        }
+    }
+
+    qoi_unmap_file(&mapping);
+    return pixels;
+}
+
+// decode a qoi on a running pqoid, the file is read straight into the shared buffer
+// returns the pixels, owned by the buffer pixels, or NULL on failure
+static void *load_qoi_daemon(int connection, const char *path, qoi_desc *desc, pqoid_buffer_t *pixels){
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    pqoid_buffer_t data;
+    unsigned char header[QOI_HEADER_SIZE];
+    int p = 4;
+    int ok = size > QOI_HEADER_SIZE && pqoid_buffer_alloc(&data, size);
+    if (ok) {
+        ok = fread(data.data, 1, size, f) == (size_t)size;
+        memcpy(header, data.data, QOI_HEADER_SIZE);
+    }
+    fclose(f);
+
+    // the output is sized from the header before the daemon sees the file
+    if (ok) {
+        unsigned int width = qoi_read_32(header, &p);
+        unsigned int height = qoi_read_32(header, &p);
+        int channels = header[12];
+        ok = width > 0 && height > 0 && height < QOI_PIXELS_MAX / width && channels >= 3 && channels <= 4 &&
+            pqoid_buffer_alloc(pixels, (size_t)width * height * channels) &&
+            pqoid_decode(connection, &data, size, pixels, desc);
+    }
+    if (size > QOI_HEADER_SIZE) {
+        pqoid_buffer_free(&data);
+    }
+    return ok ? pixels->data : NULL;
+}
+
+// encode on a running pqoid and write the result to path, LZ wrapped here with lz
+// returns the size of the file or 0 on failure
+static int write_qoi_daemon(int connection, const char *path, const void *pixels, int w, int h, int channels, int flags, int lz){
+    qoi_desc desc = {
+        .width = w,
+        .height = h,
+        .channels = PQOI_QOI_CHANNELS(channels),
+        .colorspace = QOI_SRGB
+    };
+    size_t pixels_len = (size_t)w * h * channels;
+
+    pqoid_buffer_t input, output;
+    if (!pqoid_buffer_alloc(&input, pixels_len)) {
+        return 0;
+    }
+    if (!pqoid_buffer_alloc(&output, pqoid_max_encoded_size(&desc))) {
+        pqoid_buffer_free(&input);
+        return 0;
+    }
+
+    memcpy(input.data, pixels, pixels_len);
+    size_t size = pqoid_encode(connection, &input, channels, &desc, flags, &output);
+
+    FILE *f = size && !lz ? fopen(path, "wb") : NULL;
+    if (size && lz) {
+        size = write_lz(path, output.data, size);
+    }
+    else if (f) {
+        if (fwrite(output.data, 1, size, f) != size) {
+            size = 0;
+        }
+        fclose(f);
+    }
+    else {
+        size = 0;
+    }
+
+    pqoid_buffer_free(&input);
+    pqoid_buffer_free(&output);
+    return (int)size;
+}
+
+// convert many pngs to qoi, the pngs are decoded on a thread pool while the encoder
+// works through the ones that are ready
+// perf (optional) counts the stages of every image and of all of them, the decoder threads
+// run alongside and are counted in whatever stage is running
+static int convert_batch(const char *out_dir, char mode, int flags, int lz, const char **paths, int n_paths, pqoi_perf_t *perf){
+    pqoi_session_t session;
+    if (mode == 'p') {
+        init_session(&session);
+        session.flags = flags;
+        session.perf = perf;
+    }
+    pqoi_perf_t total = {0};
+
+    // the workers allocate with the system allocator, their pixels are free()d
+    ingest_t ingest;
+    if (ingest_start(&ingest, paths, n_paths, 0, 0, load_png) != 0) {
+        puts("Couldn't start the decoder threads");
+        return 1;
+    }
+
+    pqoi_arena_t arena;
+    pqoi_arena_init(&arena, 0, 0);
+    pqoi_set_allocator(&arena.allocator);
+
+    int failed = 0;
+    ingest_image_t image;
+    while (ingest_next(&ingest, &image)) {
+        if (image.pixels == NULL) {
+            printf("Couldn't load/decode %s\n", image.path);
+            failed++;
+            continue;
+        }
+
+        qoi_desc desc = {
+            .width = image.width,
+            .height = image.height,
+            .channels = PQOI_QOI_CHANNELS(image.channels),
+            .colorspace = QOI_SRGB
+        };
+
+        // <out_dir>/<name>.qoi
+        const char *name = image.path;
+        for (const char *c = image.path; *c; c++) {
+            if (*c == '/' || *c == '\\') {
+                name = c + 1;
+            }
+        }
+        char out_path[4096];
+        snprintf(out_path, sizeof(out_path), "%s/%.*s.qoi", out_dir, (int)(strlen(name) - strlen(".png")), name);
+
+        if (perf) {
+            pqoi_perf_reset(perf);
+        }
+        int written = 0;
+        if (mode == 'p') {
+            written = write_qoi_parallel(&session, out_path, image.pixels, image.channels, &desc, lz);
+            if (written && (flags & PQOI_STATS)) {
+                print_stats(image.path, &session, &desc);
+            }
+        }
+        else {
+            written = write_qoi_sequential(out_path, image.pixels, image.width, image.height, image.channels, lz, perf);
+        }
+        if (perf) {
+            pqoi_perf_report(perf, image.path, stdout);
+            pqoi_perf_merge(&total, perf);
+        }
+
+        if (!written) {
+            printf("Couldn't write/encode %s\n", out_path);
+            failed++;
+        }
+
+        free(image.pixels);
+        pqoi_arena_reset(&arena);
+    }
+
+    ingest_stop(&ingest);
+    pqoi_set_allocator(NULL);
+    pqoi_arena_destroy(&arena);
+    if (mode == 'p') {
+        pqoi_session_release(&session);
+    }
+
+    if (perf) {
+        pqoi_perf_report(&total, "all images", stdout);
+    }
+    printf("Converted %d of %d images\n", n_paths - failed, n_paths);
+    return failed ? 1 : 0;
+}
+
+static int file_sink(const void *bytes, size_t len, void *user_data){
+    return fwrite(bytes, 1, len, (FILE *)user_data) == len;
+}
+
+// encode pngs of one size as the frames of a sequence, unchanged rows refer to the frame before
+static int convert_sequence(const char *out_path, const char **paths, int n_paths){
+    FILE *f = fopen(out_path, "wb");
+    if (!f) {
+        printf("Couldn't open %s\n", out_path);
+        return 1;
+    }
+
+    pqoi_session_t session;
+    init_session(&session);
+    // failed until the first frame starts it, finish then skips the padding
+    pqoi_sequence_t sequence = { .failed = 1 };
+    int ok = 1;
+
+    for (int i = 0; i < n_paths && ok; i++) {
+        int w, h, channels;
+        void *pixels = load_png(paths[i], &w, &h, &channels);
+        void *expanded = pixels ? expand_channels(pixels, w, h, channels) : NULL;
+        if (!expanded) {
+            printf("Couldn't load/decode %s\n", paths[i]);
+            ok = 0;
+            break;
+        }
+
+        qoi_desc desc = {
+            .width = w,
+            .height = h,
+            .channels = PQOI_QOI_CHANNELS(channels),
+            .colorspace = QOI_SRGB
+        };
+        if (i == 0) {
+            ok = pqoi_sequence_begin(&sequence, &session, &desc, file_sink, f);
+        }
+        else if (desc.width != sequence.desc.width || desc.height != sequence.desc.height || desc.channels != sequence.desc.channels) {
+            printf("%s doesn't match the size and channels of the first frame\n", paths[i]);
+            ok = 0;
+        }
+
+        int changed = ok ? pqoi_sequence_push(&sequence, expanded) : -1;
+        if (changed >= 0) {
+            printf("%s: %d of %d rows changed\n", paths[i], changed, h);
+        }
+        ok = changed >= 0;
+
+        if (expanded != pixels) {
+            pqoi_free(expanded);
+        }
+        stbi_image_free(pixels);
+    }
+
+    ok = pqoi_sequence_finish(&sequence) && ok;
+    pqoi_session_release(&session);
+    ok = fclose(f) == 0 && ok;
+    return ok ? 0 : 1;
+}
+
+// write the rest of the trace of --trace
+// returns 0 if it didn't get to its file
+static int close_trace(void){
+    if (trace == NULL) {
+        return 1;
+    }
+    int ok = pqoi_trace_close(trace);
+    if (!ok) {
+        puts("Couldn't write the trace");
+    }
+    trace = NULL;
+    return ok;
+}
+
 int main(int argc, char **argv){
+    const char *batch_dir = NULL;
+    const char *sequence_path = NULL;
+    int flags = 0;
+    int device_decode = 0;
+    int tile_size = 0;
+    int crop[4] = {0, 0, 0, 0};
+    int use_daemon = 0;
+    int stripes = 0;
+    int use_svm = 0;
+    int use_lz = 0;
+    int use_perf = 0;
+    const char *trace_path = NULL;
+
+    // leading options, the positional arguments follow them
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--batch") == 0 && arg + 1 < argc) {
+            batch_dir = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--sequence") == 0 && arg + 1 < argc) {
+            sequence_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--index") == 0) {
+            flags |= PQOI_WRITE_INDEX;
+        }
+        else if (strcmp(argv[arg], "--daemon") == 0) {
+            use_daemon = 1;
+        }
+        else if (strcmp(argv[arg], "--verify") == 0) {
+            flags |= PQOI_VERIFY;
+        }
+        else if (strcmp(argv[arg], "--device-decode") == 0) {
+            device_decode = 1;
+        }
+        else if (strcmp(argv[arg], "--tiles") == 0 && arg + 1 < argc) {
+            tile_size = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--svm") == 0) {
+            use_svm = 1;
+        }
+        else if (strcmp(argv[arg], "--lz") == 0) {
+            use_lz = 1;
+        }
+        else if (strcmp(argv[arg], "--ycocg") == 0) {
+            flags |= PQOI_YCOCG;
+        }
+        else if (strcmp(argv[arg], "--stats") == 0) {
+            flags |= PQOI_STATS;
+        }
+        else if (strcmp(argv[arg], "--perf") == 0) {
+            use_perf = 1;
+        }
+        else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            trace_path = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--stripes") == 0 && arg + 1 < argc) {
+            stripes = atoi(argv[++arg]);
+        }
+        else if (strcmp(argv[arg], "--crop") == 0 && arg + 1 < argc) {
+            if (sscanf(argv[++arg], "%d,%d,%d,%d", &crop[0], &crop[1], &crop[2], &crop[3]) != 4 || crop[2] <= 0 || crop[3] <= 0) {
+                puts("--crop takes <x>,<y>,<w>,<h>");
+                exit(1);
+            }
+        }
+        else {
+            printf("Unknown option %s\n", argv[arg]);
+            exit(1);
+        }
+    }
+    argv += arg - 1;
+    argc -= arg - 1;
+
+    // hardware counters around the cpu stages, counters the system doesn't allow print as '-'
+    pqoi_perf_t perf_counters;
+    pqoi_perf_t *perf = NULL;
+    if (use_perf) {
+        pqoi_perf_init(&perf_counters);
+        perf = &perf_counters;
+    }
+
+    // an unfinished trace (the conversion exits on an error) still loads, the closing ] is optional
+    pqoi_trace_t trace_file;
+    if (trace_path) {
+        if (!pqoi_trace_open(&trace_file, trace_path)) {
+            printf("Couldn't create %s\n", trace_path);
+            exit(1);
+        }
+        trace = &trace_file;
+    }
+
+    if (sequence_path) {
+        if (argc < 2) {
+            puts("Usage: pconv --sequence <outfile> <frames...>");
+            exit(1);
+        }
+        int status = convert_sequence(sequence_path, (const char **)&argv[1], argc - 1);
+        return close_trace() ? status : 1;
+    }
+
+    if (batch_dir) {
+        if (argc < 3 || (*argv[1] != 's' && *argv[1] != 'p')) {
+            puts("Usage: pconv [--index] [--verify] [--lz] [--ycocg] [--stats] [--perf] [--trace <file.json>] --batch <outdir> <s|p> <infiles...>");
+            exit(1);
+        }
+        if ((flags & PQOI_YCOCG) && *argv[1] != 'p') {
+            puts("--ycocg needs parallel encoding (p)");
+            exit(1);
+        }
+        for (int i = 2; i < argc; i++) {
+            if (!STR_ENDS_WITH(argv[i], ".png")) {
+                printf("Batch mode only converts png files, got %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        int status = convert_batch(batch_dir, *argv[1], flags, use_lz, (const char **)&argv[2], argc - 2, perf);
+        if (perf) {
+            pqoi_perf_release(perf);
+        }
+        return close_trace() ? status : 1;
+    }
+
     if (argc < 4) {
-        puts("Usage: pconv <infile> <outfile>");
+        puts("Usage: pconv [options] <infile> <outfile> <s|p|f>");
+        puts("       pconv [--index] [--verify] [--lz] [--ycocg] [--stats] [--perf] [--trace <file.json>] --batch <outdir> <s|p> <infiles...>");
+        puts("       pconv --sequence <outfile> <frames...>");
+        puts("Options:");
+        puts("  --index          append a segment index to parallel encoded qoi files");
+        puts("  --verify         decode parallel encoded qoi output again and compare it with the input");
+        puts("  --device-decode  decode indexed qoi input with the OpenCL decoder");
+        puts("  --tiles <size>   write parallel encoded qoi output as independent tiles");
+        puts("  --stripes <n>    overlap upload, encode and download of n row stripes of the image");
+        puts("  --svm            encode through shared virtual memory on OpenCL 2.x devices");
+        puts("  --lz             wrap qoi output in the LZ container, smaller files for I/O bound work");
+        puts("  --ycocg          encode parallel qoi output in a reversible color transform, pconv decodes it");
+        puts("  --stats          print the op counts and a per-row heatmap of parallel encoded qoi output");
+        puts("  --perf           print cycles, instructions, LLC and branch misses of the cpu stages (Linux perf events)");
+        puts("  --trace <json>   write a Chrome trace of the host stages and OpenCL commands for ui.perfetto.dev");
+        puts("  --crop x,y,w,h   decode only this rectangle of tiled qoi input");
+        puts("  --daemon         convert on a running pqoid ($PQOID_SOCKET or " PQOID_SOCKET_PATH ")");
         puts("Examples:");
         puts("  pconv input.png output.qoi s");
         puts("  pconv input.qoi output.png s");
         puts("  pconv input.qoi output.png p");
+        puts("  pconv input.qoi output.png f   (fast preview png)");
+        puts("  pconv --index input.png output.qoi p");
+        puts("  pconv --verify input.png output.qoi p");
+        puts("  pconv --device-decode input.qoi output.png p");
+        puts("  pconv --tiles 256 input.png output.qoi p");
+        puts("  pconv --stripes 4 input.png output.qoi p");
+        puts("  pconv --lz input.png output.qoi p");
+        puts("  pconv --ycocg input.png output.qoi p");
+        puts("  pconv --stats input.png output.qoi p");
+        puts("  pconv --perf input.png output.qoi s");
+        puts("  pconv --trace trace.json --batch out/ p a.png b.png c.png");
+        puts("  pconv --crop 1024,512,800,600 input.qoi crop.png f");
+        puts("  pconv --daemon input.png output.qoi p");
+        puts("  pconv --batch out/ p a.png b.png c.png");
         exit(1);
     }
 
-    void *pixels = NULL;
-    int w, h, channels;
-    if (STR_ENDS_WITH(argv[1], ".png")) {
-        if(!stbi_info(argv[1], &w, &h, &channels)) {
-            printf("Couldn't read header %s\n", argv[1]);
-            exit(1);
-        }
+    // the buffers of this image come from the arena and are released at once, except decoded
+    // pixels the tile and color decoders allocate themselves (heap_pixels)
+    pqoi_arena_t arena;
+    pqoi_arena_init(&arena, 0, 0);
+    pqoi_set_allocator(&arena.allocator);
 
-        // Force all odd encodings to be RGBA
-        if(channels != 3) {
-            channels = 4;
+    // the daemon has its kernels built already, without one everything runs here
+    int daemon = -1;
+    pqoid_buffer_t daemon_pixels = { .fd = -1 };
+    if (use_daemon) {
+        daemon = pqoid_connect(NULL);
+        if (daemon < 0) {
+            puts("No pqoid daemon is listening, converting in this process");
         }
+    }
 
-        pixels = (void *)stbi_load(argv[1], &w, &h, NULL, channels);
+    void *pixels = NULL;
+    int heap_pixels = 0;
+    int w, h, channels;
+    if (STR_ENDS_WITH(argv[1], ".png")) {
+        pqoi_perf_begin(perf, "png decode");
+        pixels = load_png(argv[1], &w, &h, &channels);
+        pqoi_perf_end(perf, NULL);
     }
     else if (STR_ENDS_WITH(argv[1], ".qoi")) {
         qoi_desc desc;
-        pixels = qoi_read(argv[1], &desc, 0);
+        // tiled and LZ containers are told apart by their magic
+        int wrapped = 0;
+        pixels = load_qoi_tiled(argv[1], &desc, crop);
+        heap_pixels = pixels != NULL;
+        if (pixels == NULL && crop[2] == 0) {
+            pixels = load_qoi_lz(argv[1], &desc, device_decode, &wrapped, &heap_pixels);
+        }
+        if (pixels == NULL && !wrapped) {
+            if (crop[2] > 0) {
+                printf("--crop needs a tiled image containing the rectangle, %s isn't one\n", argv[1]);
+                exit(1);
+            }
+            else if (daemon >= 0) {
+                pixels = load_qoi_daemon(daemon, argv[1], &desc, &daemon_pixels);
+            }
+            else if (device_decode) {
+                pixels = load_qoi_device(argv[1], &desc, &heap_pixels);
+            }
+            else {
+                pixels = qoi_read_mapped(argv[1], &desc, 0, QOI_MAP_SEQUENTIAL);
+                if (pixels == NULL) {
+                    pixels = load_qoi_color(argv[1], &desc);
+                    heap_pixels = pixels != NULL;
+                }
+            }
+        }
         channels = desc.channels;
         w = desc.width;
         h = desc.height;
@@ -53,25 +780,73 @@ int main(int argc, char **argv){
 
     int encoded = 0;
     if (STR_ENDS_WITH(argv[2], ".png")) {
-        encoded = stbi_write_png(argv[2], w, h, channels, pixels, 0);
+        pqoi_perf_begin(perf, "png encode");
+        double traced = pqoi_trace_begin(trace);
+        if (*argv[3] == 'p'){
+            encoded = png_write_parallel(argv[2], pixels, w, h, channels, 0);
+        }
+        else if (*argv[3] == 'f'){
+            // previews: one guessed filter per row and a short match search
+            encoded = png_write(argv[2], pixels, w, h, channels, &(png_options_t){
+                .n_threads = 0,
+                .filter = PNG_FILTER_HEURISTIC,
+                .level = PNG_LEVEL_FAST
+            });
+        }
+        else{
+            encoded = stbi_write_png(argv[2], w, h, channels, pixels, 0);
+        }
+        pqoi_trace_span(trace, "png encode", argv[2], traced);
+        pqoi_perf_end(perf, NULL);
     }
     else if (STR_ENDS_WITH(argv[2], ".qoi")) {
 
+        if (use_lz && tile_size > 0) {
+            puts("--lz doesn't wrap tiled output");
+            exit(1);
+        }
+        if ((flags & PQOI_YCOCG) && (*argv[3] != 'p' || tile_size > 0)) {
+            puts("--ycocg needs parallel encoding (p) without tiles");
+            exit(1);
+        }
+
         if (*argv[3] == 's'){
-            encoded = qoi_write(argv[2], pixels, &(qoi_desc){
-                .width = w,
-                .height = h, 
-                .channels = channels,
-                .colorspace = QOI_SRGB
-            });
+            encoded = write_qoi_sequential(argv[2], pixels, w, h, channels, use_lz, perf);
+        }
+        else if (*argv[3] == 'p' && daemon >= 0 && tile_size == 0) {
+            encoded = write_qoi_daemon(daemon, argv[2], pixels, w, h, channels, flags, use_lz);
         }
         else if (*argv[3] == 'p'){
-            encoded = parallel_qoi_write(argv[2], pixels, &(qoi_desc){
+            pqoi_session_t session;
+            init_session(&session);
+            session.flags = flags;
+            session.stripes = stripes > 0 ? stripes : 0;
+            session.perf = perf;
+            if (use_svm && !pqoi_session_enable_svm(&session)) {
+                puts("The device has no shared virtual memory, using buffers");
+            }
+            qoi_desc desc = {
                 .width = w,
                 .height = h, 
-                .channels = channels,
+                .channels = PQOI_QOI_CHANNELS(channels),
                 .colorspace = QOI_SRGB
-            });
+            };
+            if (tile_size > 0) {
+                // the tile kernel takes RGB / RGBA only
+                void *expanded = expand_channels(pixels, w, h, channels);
+                encoded = expanded && pqoi_write_tiled(&session, argv[2], expanded, &desc, tile_size);
+                if (expanded != pixels) {
+                    pqoi_free(expanded);
+                }
+            }
+            else {
+                // gray stays gray until the kernel reads it
+                encoded = write_qoi_parallel(&session, argv[2], pixels, channels, &desc, use_lz);
+                if (encoded && (flags & PQOI_STATS)) {
+                    print_stats(argv[1], &session, &desc);
+                }
+            }
+            pqoi_session_release(&session);
         }
         else{
             printf("Invalid argument '%c'! Use 's' for sequential or 'p' for parallel encoding of the image!\n", argv[3]);
@@ -84,6 +859,20 @@ int main(int argc, char **argv){
         exit(1);
     }
 
-    free(pixels);
+    if (perf) {
+        pqoi_perf_report(perf, argv[1], stdout);
+        pqoi_perf_release(perf);
+    }
+    if (!close_trace()) {
+        exit(1);
+    }
+
+    if (heap_pixels) {
+        free(pixels);
+    }
+    pqoid_buffer_free(&daemon_pixels);
+    pqoid_disconnect(daemon);
+    pqoi_set_allocator(NULL);
+    pqoi_arena_destroy(&arena);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,344 @@
+#define QOI_IMPLEMENTATION
+#include "qoi.h"
+
+#include "parallel_qoi.h"
+#include "png_writer.h"
+#include "qoi_synth.h"
+#include "pqoi_perf.h"
+
+// image sizes of the corpus and the benchmark, square ones from 16x16 up and extreme aspect ratios.
+// Everything above QOI_PIXELS_MAX is generated but no QOI encoder takes it
+static const unsigned int shapes[][2] = {
+    {16, 16}, {64, 64}, {256, 256}, {1024, 1024}, {2048, 2048}, {4096, 4096},
+    {8192, 8192}, {16384, 16384}, {32768, 32768},
+    {32768, 16}, {16, 32768}, {32768, 256}, {256, 32768}, {32768, 8192}, {8192, 32768}
+};
+#define N_SHAPES ((int)(sizeof(shapes) / sizeof(shapes[0])))
+
+enum { BACKEND_QOI, BACKEND_CPU, BACKEND_OPENCL, BACKEND_STRIPES, N_BACKENDS };
+static const char *backend_names[N_BACKENDS] = { "qoi", "cpu", "opencl", "stripes" };
+
+#define DEFAULT_GEN_PIXELS   (16u << 20)
+#define DEFAULT_BENCH_PIXELS (16u << 20)
+
+// a case is repeated until it has run this long, the fastest run counts
+#define MIN_BENCH_SECONDS 0.25
+#define MAX_BENCH_RUNS 5
+
+// wall clock seconds, the encoders run on threads and the device and clock() would add up
+// the cpu time of all of them
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+// write every pattern in every shape up to max_pixels pixels and both channel counts as png
+static int generate(const char *out_dir, unsigned long long max_pixels, unsigned int seed, int pattern_only){
+    int failed = 0;
+    for (int s = 0; s < N_SHAPES; s++) {
+        unsigned int w = shapes[s][0], h = shapes[s][1];
+        if ((unsigned long long)w * h > max_pixels) {
+            continue;
+        }
+        for (int pattern = 0; pattern < QOI_SYNTH_COUNT; pattern++) {
+            if (pattern_only >= 0 && pattern != pattern_only) {
+                continue;
+            }
+            for (int channels = 3; channels <= 4; channels++) {
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/%s_%ux%u_%d.png", out_dir, qoi_synth_name(pattern), w, h, channels);
+
+                void *pixels = qoi_synth_image(pattern, w, h, channels, seed, 0);
+                int written = pixels && png_write_parallel(path, pixels, w, h, channels, 0);
+                free(pixels);
+                if (!written) {
+                    printf("Couldn't generate %s\n", path);
+                    failed++;
+                    continue;
+                }
+                printf("%s\n", path);
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+// scratch of the cpu backend, the strided segments of one image
+typedef struct cpu_scratch {
+    unsigned char *bytes;
+    unsigned int *lengths;
+} cpu_scratch_t;
+
+// encode pixels once on a backend into dst
+// returns the size of the encoded image or 0 on failure
+static int encode_once(int backend, pqoi_session_t *session, cpu_scratch_t *cpu, const unsigned char *pixels, const qoi_desc *desc,
+    unsigned char *dst, int dst_capacity) {
+
+    switch (backend) {
+    case BACKEND_QOI: {
+        int size = 0;
+        void *encoded = qoi_encode(pixels, desc, &size);
+        if (!encoded) {
+            return 0;
+        }
+        QOI_FREE(encoded);
+        return size;
+    }
+    case BACKEND_CPU:
+        if (!pqoi_cpu_encode(pixels, desc->channels, desc, cpu->bytes, cpu->lengths, 0)) {
+            return 0;
+        }
+        return merge_segments(cpu->bytes, cpu->lengths, desc, 0, dst, dst_capacity);
+    default:
+        session->stripes = backend == BACKEND_STRIPES ? 4 : 0;
+        return pqoi_encode_channels_into(session, pixels, desc->channels, desc, dst, dst_capacity);
+    }
+}
+
+// a csv field of a counter, empty when it wasn't counted
+static void csv_count(FILE *csv, unsigned long long count){
+    if (count == ~0ULL) {
+        fprintf(csv, ",");
+    }
+    else {
+        fprintf(csv, ",%llu", count);
+    }
+}
+
+// time every backend on every pattern, shape and channel count up to max_pixels pixels,
+// one csv line per case and the mean throughput per shape and backend at the end.
+// The hardware counters of the fastest run go along where perf events are allowed
+static int bench(const char *csv_path, unsigned long long max_pixels, unsigned int seed, int pattern_only){
+    FILE *csv = fopen(csv_path, "w");
+    if (!csv) {
+        printf("Couldn't open %s\n", csv_path);
+        return 1;
+    }
+    fprintf(csv, "pattern,width,height,channels,pixels,backend,seconds,mpixels_per_s,bytes,bytes_per_pixel,"
+        "cycles,instructions,llc_misses,branch_misses\n");
+
+    pqoi_perf_t perf;
+    int n_counters = pqoi_perf_init(&perf);
+
+    // a device that doesn't come up leaves its backends out, the cpu ones still run
+    pqoi_session_t session;
+    int has_device = pqoi_session_init(&session);
+
+    double mpps_sum[N_SHAPES][N_BACKENDS] = {{0}};
+    int mpps_count[N_SHAPES][N_BACKENDS] = {{0}};
+
+    // counts of the fastest runs and the pixels they encoded, per backend
+    unsigned long long count_sum[N_BACKENDS][PQOI_PERF_EVENTS] = {{0}};
+    unsigned long long counted_px[N_BACKENDS][PQOI_PERF_EVENTS] = {{0}};
+
+    for (int s = 0; s < N_SHAPES; s++) {
+        unsigned int w = shapes[s][0], h = shapes[s][1];
+        unsigned long long n_px = (unsigned long long)w * h;
+        if (n_px > max_pixels) {
+            continue;
+        }
+        if (h >= QOI_PIXELS_MAX / w) {
+            fprintf(stderr, "%ux%u is above the %u pixels of QOI, skipped\n", w, h, QOI_PIXELS_MAX);
+            continue;
+        }
+
+        for (int pattern = 0; pattern < QOI_SYNTH_COUNT; pattern++) {
+            if (pattern_only >= 0 && pattern != pattern_only) {
+                continue;
+            }
+            for (int channels = 3; channels <= 4; channels++) {
+                qoi_desc desc = { .width = w, .height = h, .channels = channels, .colorspace = QOI_SRGB };
+                int capacity = pqoi_max_encoded_size(&desc);
+                unsigned char *pixels = (unsigned char *)qoi_synth_image(pattern, w, h, channels, seed, 0);
+                unsigned char *dst = capacity ? (unsigned char *)malloc(capacity) : NULL;
+                cpu_scratch_t cpu = {
+                    .bytes = (unsigned char *)malloc(h * PQOI_SEGMENT_STRIDE(&desc)),
+                    .lengths = (unsigned int *)malloc(h * sizeof(unsigned int))
+                };
+                if (!pixels || !dst || !cpu.bytes || !cpu.lengths) {
+                    fprintf(stderr, "Out of memory for %s %ux%u, skipped\n", qoi_synth_name(pattern), w, h);
+                    free(pixels);
+                    free(dst);
+                    free(cpu.bytes);
+                    free(cpu.lengths);
+                    continue;
+                }
+
+                for (int backend = 0; backend < N_BACKENDS; backend++) {
+                    if (!has_device && (backend == BACKEND_OPENCL || backend == BACKEND_STRIPES)) {
+                        continue;
+                    }
+
+                    double best = 0, total = 0;
+                    int size = 0;
+                    unsigned long long counts[PQOI_PERF_EVENTS], best_counts[PQOI_PERF_EVENTS];
+                    for (int run = 0; run < MAX_BENCH_RUNS && (run == 0 || total < MIN_BENCH_SECONDS); run++) {
+                        pqoi_perf_begin(&perf, backend_names[backend]);
+                        double begin = now();
+                        size = encode_once(backend, &session, &cpu, pixels, &desc, dst, capacity);
+                        double seconds = now() - begin;
+                        pqoi_perf_end(&perf, counts);
+                        total += seconds;
+                        if (run == 0 || seconds < best) {
+                            best = seconds;
+                            memcpy(best_counts, counts, sizeof(counts));
+                        }
+                        if (size == 0) {
+                            break;
+                        }
+                    }
+                    if (size == 0) {
+                        fprintf(stderr, "%s failed on %s %ux%u\n", backend_names[backend], qoi_synth_name(pattern), w, h);
+                        continue;
+                    }
+
+                    double mpps = best > 0 ? n_px / best / 1.0e6 : 0;
+                    fprintf(csv, "%s,%u,%u,%d,%llu,%s,%.6f,%.2f,%d,%.4f", qoi_synth_name(pattern), w, h, channels, n_px,
+                        backend_names[backend], best, mpps, size, (double)size / n_px);
+                    for (int e = 0; e < PQOI_PERF_EVENTS; e++) {
+                        csv_count(csv, best_counts[e]);
+                        if (best_counts[e] != ~0ULL) {
+                            count_sum[backend][e] += best_counts[e];
+                            counted_px[backend][e] += n_px;
+                        }
+                    }
+                    fprintf(csv, "\n");
+                    fflush(csv);
+                    fprintf(stderr, "%-8s %5ux%-5u %d  %-7s %10.2f MP/s %8.3f bytes/px\n", qoi_synth_name(pattern), w, h, channels,
+                        backend_names[backend], mpps, (double)size / n_px);
+                    mpps_sum[s][backend] += mpps;
+                    mpps_count[s][backend]++;
+                }
+
+                free(pixels);
+                free(dst);
+                free(cpu.bytes);
+                free(cpu.lengths);
+            }
+        }
+    }
+    pqoi_session_release(&session);
+    pqoi_perf_release(&perf);
+
+    // the throughput curves, one column per backend, the shapes by pixel count
+    int order[N_SHAPES];
+    for (int s = 0; s < N_SHAPES; s++) {
+        int i = s;
+        while (i > 0 && (unsigned long long)shapes[order[i - 1]][0] * shapes[order[i - 1]][1] > (unsigned long long)shapes[s][0] * shapes[s][1]) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = s;
+    }
+    fprintf(stderr, "\nmean MP/s over the patterns and channel counts\n%-12s %12s", "size", "pixels");
+    for (int backend = 0; backend < N_BACKENDS; backend++) {
+        fprintf(stderr, " %10s", backend_names[backend]);
+    }
+    fprintf(stderr, "\n");
+    for (int i = 0; i < N_SHAPES; i++) {
+        int s = order[i];
+        int any = 0;
+        for (int backend = 0; backend < N_BACKENDS; backend++) {
+            any |= mpps_count[s][backend] > 0;
+        }
+        if (!any) {
+            continue;
+        }
+
+        char size[32];
+        snprintf(size, sizeof(size), "%ux%u", shapes[s][0], shapes[s][1]);
+        fprintf(stderr, "%-12s %12llu", size, (unsigned long long)shapes[s][0] * shapes[s][1]);
+        for (int backend = 0; backend < N_BACKENDS; backend++) {
+            if (mpps_count[s][backend]) {
+                fprintf(stderr, " %10.2f", mpps_sum[s][backend] / mpps_count[s][backend]);
+            }
+            else {
+                fprintf(stderr, " %10s", "-");
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+
+    // what the fastest runs cost the cpu per pixel over all cases, without counters only the times above
+    if (n_counters > 0) {
+        fprintf(stderr, "\nhardware counters of the fastest runs, the process with all its threads\n%-8s %10s %6s %16s %16s\n",
+            "backend", "cycles/px", "IPC", "LLC misses/kpx", "br misses/kpx");
+        for (int backend = 0; backend < N_BACKENDS; backend++) {
+            const unsigned long long *sum = count_sum[backend], *px = counted_px[backend];
+            fprintf(stderr, "%-8s", backend_names[backend]);
+            if (px[PQOI_PERF_CYCLES]) {
+                fprintf(stderr, " %10.2f", (double)sum[PQOI_PERF_CYCLES] / px[PQOI_PERF_CYCLES]);
+            }
+            else {
+                fprintf(stderr, " %10s", "-");
+            }
+            if (px[PQOI_PERF_CYCLES] && px[PQOI_PERF_INSTRUCTIONS] == px[PQOI_PERF_CYCLES] && sum[PQOI_PERF_CYCLES]) {
+                fprintf(stderr, " %6.2f", (double)sum[PQOI_PERF_INSTRUCTIONS] / sum[PQOI_PERF_CYCLES]);
+            }
+            else {
+                fprintf(stderr, " %6s", "-");
+            }
+            for (int e = PQOI_PERF_LLC_MISSES; e <= PQOI_PERF_BRANCH_MISSES; e++) {
+                if (px[e]) {
+                    fprintf(stderr, " %16.2f", 1000.0 * sum[e] / px[e]);
+                }
+                else {
+                    fprintf(stderr, " %16s", "-");
+                }
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+
+    return fclose(csv) == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv){
+    unsigned long long max_pixels = 0;
+    unsigned int seed = 1;
+    int pattern = -1;
+
+    int arg = 1;
+    const char *mode = arg < argc ? argv[arg++] : "";
+    const char *path = arg < argc ? argv[arg++] : NULL;
+    for (; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--max-pixels") == 0 && arg + 1 < argc) {
+            max_pixels = strtoull(argv[++arg], NULL, 10);
+        }
+        else if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc) {
+            seed = (unsigned int)strtoul(argv[++arg], NULL, 10);
+        }
+        else if (strcmp(argv[arg], "--pattern") == 0 && arg + 1 < argc) {
+            pattern = qoi_synth_find(argv[++arg]);
+            if (pattern < 0) {
+                printf("Unknown pattern %s\n", argv[arg]);
+                exit(1);
+            }
+        }
+        else {
+            path = NULL;
+            break;
+        }
+    }
+
+    if (path && strcmp(mode, "gen") == 0) {
+        return generate(path, max_pixels ? max_pixels : DEFAULT_GEN_PIXELS, seed, pattern);
+    }
+    if (path && strcmp(mode, "bench") == 0) {
+        return bench(path, max_pixels ? max_pixels : DEFAULT_BENCH_PIXELS, seed, pattern);
+    }
+
+    puts("Usage: pqoibench gen <outdir> [options]");
+    puts("       pqoibench bench <results.csv> [options]");
+    puts("gen writes the synthetic corpus as <pattern>_<w>x<h>_<channels>.png, bench times");
+    puts("every encoder on it and prints the throughput per image size (the encoders print");
+    puts("their own timings on stdout, the benchmark reports on stderr). Where Linux perf");
+    puts("events are allowed the csv also gets the cycles, instructions, LLC and branch misses");
+    puts("of every case and the report their cost per pixel.");
+    puts("Options:");
+    puts("  --max-pixels <n>  largest image in pixels, 16777216 by default, 1073741824 for 32768x32768");
+    puts("  --pattern <name>  gradient, noise, ui, sprites, solid or collide only");
+    puts("  --seed <n>        another deterministic set of images");
+    exit(1);
+}
@@ -0,0 +1,292 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // F_GET_SEALS
+#endif
+
+#define QOI_IMPLEMENTATION
+#include "qoi.h"
+
+#include "parallel_qoi.h"
+#include "pqoid.h"
+#include "qoi_stream.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// warm sessions shared by the connections, a request takes one for as long as it runs
+typedef struct session_pool {
+    pqoi_session_t *sessions;
+    int *free_list;
+    int n_free;
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+} session_pool_t;
+
+static session_pool_t pool;
+
+static pqoi_session_t *take_session(void){
+    pthread_mutex_lock(&pool.lock);
+    while (pool.n_free == 0) {
+        pthread_cond_wait(&pool.available, &pool.lock);
+    }
+    pqoi_session_t *session = &pool.sessions[pool.free_list[--pool.n_free]];
+    pthread_mutex_unlock(&pool.lock);
+    return session;
+}
+
+static void give_session(pqoi_session_t *session){
+    pthread_mutex_lock(&pool.lock);
+    pool.free_list[pool.n_free++] = (int)(session - pool.sessions);
+    pthread_cond_signal(&pool.available);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// receive the next request with its two buffers
+// returns 1 on success, 0 once the client hung up or sent something else
+static int receive_request(int connection, pqoid_request_t *request, int *input_fd, int *output_fd){
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+
+    struct iovec iov = { .iov_base = request, .iov_len = sizeof(*request) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+
+    ssize_t got;
+    do {
+        got = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+
+    *input_fd = *output_fd = -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+        int fds[2];
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        *input_fd = fds[0];
+        *output_fd = fds[1];
+    }
+
+    if (got != (ssize_t)sizeof(*request) || request->magic != PQOID_MAGIC || *input_fd < 0) {
+        if (*input_fd >= 0) {
+            close(*input_fd);
+            close(*output_fd);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// map size bytes of a client buffer, refusing buffers shorter than the client claims
+// on Linux the buffer must be sealed against shrinking, or the client could truncate it
+// under the mapping and the daemon would die of SIGBUS
+// returns the mapping or NULL
+static void *map_buffer(int fd, size_t size, int prot){
+#ifdef F_GET_SEALS
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        return NULL;
+    }
+#endif
+    struct stat st;
+    if (size == 0 || fstat(fd, &st) != 0 || (unsigned long long)st.st_size < size) {
+        return NULL;
+    }
+    void *data = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    return data == MAP_FAILED ? NULL : data;
+}
+
+static void encode_request(const pqoid_request_t *request, const unsigned char *input, unsigned char *output, pqoid_reply_t *reply){
+    int src_channels = request->channels;
+    qoi_desc desc = {
+        .width = request->width,
+        .height = request->height,
+        .channels = PQOI_QOI_CHANNELS(src_channels),
+        .colorspace = QOI_SRGB
+    };
+    if (src_channels < 1 || src_channels > 4 || pqoi_max_encoded_size(&desc) == 0 ||
+        request->input_size < (unsigned long long)desc.width * desc.height * src_channels) {
+        return;
+    }
+
+    pqoi_session_t *session = take_session();
+    session->flags = request->flags & (PQOI_WRITE_INDEX | PQOI_VERIFY | PQOI_YCOCG);
+    int capacity = request->output_size > INT_MAX ? INT_MAX : (int)request->output_size;
+    int size = pqoi_encode_channels_into(session, input, src_channels, &desc, output, capacity);
+    give_session(session);
+
+    reply->status = size > 0;
+    reply->width = desc.width;
+    reply->height = desc.height;
+    reply->channels = desc.channels;
+    reply->size = size;
+}
+
+static void decode_request(const pqoid_request_t *request, const unsigned char *input, unsigned char *output, pqoid_reply_t *reply){
+    qoi_desc desc;
+    if (request->input_size > INT_MAX || !pqoi_read_header(input, (int)request->input_size, &desc)) {
+        return;
+    }
+    size_t pixels_len = (size_t)desc.width * desc.height * desc.channels;
+    if (pixels_len > request->output_size) {
+        return;
+    }
+
+    int transformed = (desc.colorspace & QOI_COLOR_YCOCG) != 0;
+    pqoi_session_t *session = take_session();
+    int ok = pqoi_decode_into(session, input, (int)request->input_size, &desc, output, pixels_len);
+    give_session(session);
+
+    // without a segment index the whole image is one stream for the cpu
+    if (!ok) {
+        ok = qoi_decode_segment(input + QOI_HEADER_SIZE, request->input_size - QOI_HEADER_SIZE, output,
+            (size_t)desc.width * desc.height, desc.channels) != 0;
+        if (ok && transformed) {
+            qoi_color_inverse(output, (size_t)desc.width * desc.height, desc.channels, 0);
+        }
+    }
+
+    reply->status = ok;
+    reply->width = desc.width;
+    reply->height = desc.height;
+    reply->channels = desc.channels;
+    reply->size = ok ? pixels_len : 0;
+}
+
+static void *serve_connection(void *arg){
+    int connection = (int)(intptr_t)arg;
+    pqoid_request_t request;
+    int input_fd, output_fd;
+
+    while (receive_request(connection, &request, &input_fd, &output_fd)) {
+        pqoid_reply_t reply;
+        memset(&reply, 0, sizeof(reply));
+
+        unsigned char *input = (unsigned char *)map_buffer(input_fd, request.input_size, PROT_READ);
+        unsigned char *output = (unsigned char *)map_buffer(output_fd, request.output_size, PROT_READ | PROT_WRITE);
+        if (input && output) {
+            if (request.op == PQOID_ENCODE) {
+                encode_request(&request, input, output, &reply);
+            }
+            else if (request.op == PQOID_DECODE) {
+                decode_request(&request, input, output, &reply);
+            }
+        }
+
+        if (input) {
+            munmap(input, request.input_size);
+        }
+        if (output) {
+            munmap(output, request.output_size);
+        }
+        close(input_fd);
+        close(output_fd);
+
+        if (send(connection, &reply, sizeof(reply), MSG_NOSIGNAL) != (ssize_t)sizeof(reply)) {
+            break;
+        }
+    }
+
+    close(connection);
+    return NULL;
+}
+
+int main(int argc, char **argv){
+    int n_sessions = 1;
+    const char *path = NULL;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--sessions") == 0 && arg + 1 < argc) {
+            n_sessions = atoi(argv[++arg]);
+        }
+        else if (strncmp(argv[arg], "--", 2) != 0 && path == NULL) {
+            path = argv[arg];
+        }
+        else {
+            puts("Usage: pqoid [--sessions <n>] [socket]");
+            puts("Serves pconv --daemon and other pqoid clients on socket,");
+            puts("$PQOID_SOCKET or " PQOID_SOCKET_PATH " by default.");
+            exit(1);
+        }
+    }
+    if (path == NULL) {
+        path = getenv("PQOID_SOCKET");
+    }
+    if (path == NULL) {
+        path = PQOID_SOCKET_PATH;
+    }
+    if (n_sessions < 1) {
+        n_sessions = 1;
+    }
+
+    // a client that disappears mid reply must not take the daemon with it
+    signal(SIGPIPE, SIG_IGN);
+
+    pool.sessions = (pqoi_session_t *)calloc(n_sessions, sizeof(pqoi_session_t));
+    pool.free_list = (int *)calloc(n_sessions, sizeof(int));
+    if (!pool.sessions || !pool.free_list) {
+        puts("Out of memory");
+        exit(1);
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.available, NULL);
+
+    // every kernel is built once here instead of once per conversion,
+    // a session without OpenCL still serves its requests on the cpu
+    for (int i = 0; i < n_sessions; i++) {
+        if (!pqoi_session_init(&pool.sessions[i])) {
+            printf("OpenCL session %d encodes on the cpu\n", i);
+        }
+        pool.free_list[pool.n_free++] = i;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Socket path %s is too long\n", path);
+        exit(1);
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        printf("Couldn't listen on %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    printf("pqoid listening on %s with %d session(s)\n", path, n_sessions);
+    fflush(stdout);
+
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            printf("accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, (void *)(intptr_t)connection) != 0) {
+            close(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(listener);
+    for (int i = 0; i < n_sessions; i++) {
+        pqoi_session_release(&pool.sessions[i]);
+    }
+    return 1;
+}
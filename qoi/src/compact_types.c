@@ -3,15 +3,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-void get_platform(ocl_res_t *ocl){
+int get_platform(ocl_res_t *ocl){
     ocl->err = clGetPlatformIDs(1, &ocl->platform_id, &ocl->n_platforms);
     if (ocl->err != CL_SUCCESS) {
         printf("[ERROR] Error calling clGetPlatformIDs. Error code: %d :: %s\n", ocl->err, get_error_msg(ocl->err));
-        exit(1);
+        return 0;
     }
+    return 1;
 }
 
-void get_device(ocl_res_t *ocl){
+int get_device(ocl_res_t *ocl){
     ocl->err = clGetDeviceIDs(
         ocl->platform_id,
         CL_DEVICE_TYPE_GPU,
@@ -21,36 +22,40 @@ void get_device(ocl_res_t *ocl){
     );
     if (ocl->err != CL_SUCCESS) {
         printf("[ERROR] Error calling clGetDeviceIDs. Error code: %d :: %s\n", ocl->err, get_error_msg(ocl->err));
-        exit(1);
+        return 0;
     }
+    return 1;
 }
 
-void create_context(ocl_res_t *ocl){
+int create_context(ocl_res_t *ocl){
 	ocl->context = clCreateContext(NULL, ocl->n_devices, &ocl->device_id, NULL, NULL, &ocl->err);
     if (ocl->err != CL_SUCCESS) {
         printf("[ERROR] Error creating context. Error code: %d :: %s\n", ocl->err, get_error_msg(ocl->err));
-        exit(1);
+        return 0;
     }
+    return 1;
 }
 
-void load_kernel_code(ocl_res_t *ocl, const char* path){
+int load_kernel_code(ocl_res_t *ocl, const char* path){
 	int error_code;
 	ocl->kernel_code = load_kernel_source(path, &error_code);
     if (error_code != 0) {
         printf("[ERROR] Source code loading error!\n");
-        exit(1);
+        return 0;
     }
+    return 1;
 }
 
-void create_program(ocl_res_t *ocl){
+int create_program(ocl_res_t *ocl){
 	ocl->program = clCreateProgramWithSource(ocl->context, 1, &ocl->kernel_code, NULL, &ocl->err);
     if (ocl->err != CL_SUCCESS) {
         printf("[ERROR] Error creating program. Error code: %d\n :: %s", ocl->err, get_error_msg(ocl->err));
-        exit(1);
+        return 0;
     }
+    return 1;
 }
 
-void build_program(ocl_res_t *ocl, const char *options){
+int build_program(ocl_res_t *ocl, const char *options){
     ocl->err = clBuildProgram(
         ocl->program,
         1,
@@ -86,7 +91,8 @@ void build_program(ocl_res_t *ocl, const char *options){
         printf("Real size : %zu\n", real_size);
         printf("Build log : %s\n", build_log);
         free(build_log);
-        exit(1);
+        ocl->err = CL_BUILD_PROGRAM_FAILURE;
+        return 0;
     }
 
     size_t sizes_param[10];
@@ -101,21 +107,22 @@ void build_program(ocl_res_t *ocl, const char *options){
     //printf("Program info: \n");
     //printf("Real size   : %zu\n", real_size);
     //printf("Binary size : %zu\n", sizes_param[0]);
+    ocl->err = CL_SUCCESS;
+    return 1;
 }
 
 
-void create_kernel(ocl_res_t *ocl, const char *kernel_name){
+int create_kernel(ocl_res_t *ocl, const char *kernel_name){
 	ocl->kernel = clCreateKernel(ocl->program, kernel_name, &ocl->err);
     if (ocl->err != CL_SUCCESS) {
         printf("[ERROR] Error creating kernel. Error code: %d :: %s\n", ocl->err, get_error_msg(ocl->err));
-        exit(1);
+        return 0;
     }
+    return 1;
 }
 
-void init_opencl(ocl_res_t *ocl){
-	get_platform(ocl);
-	get_device(ocl);
-	create_context(ocl);
+int init_opencl(ocl_res_t *ocl){
+	return get_platform(ocl) && get_device(ocl) && create_context(ocl);
 }
 
 const char *get_error_msg(cl_int error) {
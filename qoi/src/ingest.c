@@ -0,0 +1,133 @@
+#include "ingest.h"
+#include "pqoi_bands.h"
+
+#include <stdlib.h>
+
+static void *ingest_worker(void *arg){
+    ingest_t *ingest = (ingest_t *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&ingest->lock);
+        if (ingest->next_path >= ingest->n_paths) {
+            pthread_mutex_unlock(&ingest->lock);
+            return NULL;
+        }
+        int index = ingest->next_path++;
+        pthread_mutex_unlock(&ingest->lock);
+
+        // decode outside of the lock, this is the expensive part
+        ingest_image_t image = {0};
+        image.path = ingest->paths[index];
+        image.index = index;
+        image.pixels = ingest->load(image.path, &image.width, &image.height, &image.channels);
+
+        pthread_mutex_lock(&ingest->lock);
+        while (ingest->count == ingest->capacity && ingest->next_path <= ingest->n_paths) {
+            pthread_cond_wait(&ingest->not_full, &ingest->lock);
+        }
+
+        // stopped while waiting for room
+        if (ingest->next_path > ingest->n_paths) {
+            pthread_mutex_unlock(&ingest->lock);
+            free(image.pixels);
+            return NULL;
+        }
+
+        ingest->queue[(ingest->head + ingest->count) % ingest->capacity] = image;
+        ingest->count++;
+        pthread_cond_signal(&ingest->not_empty);
+        pthread_mutex_unlock(&ingest->lock);
+    }
+}
+
+int ingest_start(ingest_t *ingest, const char **paths, int n_paths, int n_workers, int capacity, ingest_load_fn load){
+    if (n_workers <= 0) {
+        n_workers = pqoi_cpu_count();
+    }
+    if (n_workers > n_paths) {
+        n_workers = n_paths > 0 ? n_paths : 1;
+    }
+    if (capacity <= 0) {
+        capacity = n_workers;
+    }
+
+    ingest->paths = paths;
+    ingest->n_paths = n_paths;
+    ingest->next_path = 0;
+    ingest->delivered = 0;
+    ingest->load = load;
+    ingest->capacity = capacity;
+    ingest->head = 0;
+    ingest->count = 0;
+    ingest->n_workers = 0;
+    ingest->queue = (ingest_image_t *)calloc(capacity, sizeof(ingest_image_t));
+    ingest->workers = (pthread_t *)calloc(n_workers, sizeof(pthread_t));
+    if (ingest->queue == NULL || ingest->workers == NULL) {
+        free(ingest->queue);
+        free(ingest->workers);
+        return -1;
+    }
+
+    pthread_mutex_init(&ingest->lock, NULL);
+    pthread_cond_init(&ingest->not_full, NULL);
+    pthread_cond_init(&ingest->not_empty, NULL);
+
+    for (int i = 0; i < n_workers; i++) {
+        if (pthread_create(&ingest->workers[i], NULL, ingest_worker, ingest) != 0) {
+            break;
+        }
+        ingest->n_workers++;
+    }
+
+    if (ingest->n_workers == 0) {
+        ingest_stop(ingest);
+        return -1;
+    }
+    return 0;
+}
+
+int ingest_next(ingest_t *ingest, ingest_image_t *image){
+    pthread_mutex_lock(&ingest->lock);
+    if (ingest->delivered == ingest->n_paths) {
+        pthread_mutex_unlock(&ingest->lock);
+        return 0;
+    }
+
+    while (ingest->count == 0) {
+        pthread_cond_wait(&ingest->not_empty, &ingest->lock);
+    }
+
+    *image = ingest->queue[ingest->head];
+    ingest->head = (ingest->head + 1) % ingest->capacity;
+    ingest->count--;
+    ingest->delivered++;
+    pthread_cond_signal(&ingest->not_full);
+    pthread_mutex_unlock(&ingest->lock);
+    return 1;
+}
+
+void ingest_stop(ingest_t *ingest){
+    // claiming past the end tells the workers to quit
+    pthread_mutex_lock(&ingest->lock);
+    ingest->next_path = ingest->n_paths + 1;
+    pthread_cond_broadcast(&ingest->not_full);
+    pthread_mutex_unlock(&ingest->lock);
+
+    for (int i = 0; i < ingest->n_workers; i++) {
+        pthread_join(ingest->workers[i], NULL);
+    }
+
+    while (ingest->count > 0) {
+        free(ingest->queue[ingest->head].pixels);
+        ingest->head = (ingest->head + 1) % ingest->capacity;
+        ingest->count--;
+    }
+
+    pthread_mutex_destroy(&ingest->lock);
+    pthread_cond_destroy(&ingest->not_full);
+    pthread_cond_destroy(&ingest->not_empty);
+    free(ingest->queue);
+    free(ingest->workers);
+    ingest->queue = NULL;
+    ingest->workers = NULL;
+}
@@ -0,0 +1,660 @@
+#include "png_writer.h"
+#include "pqoi_bands.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 32
+#define MAX_CHAIN_FAST 4
+#define LAZY_LIMIT 32
+
+// the filter heuristic looks at one byte group in this many
+#define SAMPLE_STEP 16
+
+// bands smaller than this aren't worth a thread
+#define BAND_MIN_BYTES (256 * 1024)
+
+#define ADLER_BASE 65521
+#define ADLER_NMAX 5552
+
+typedef struct band {
+    const unsigned char *pixels;
+    int width;
+    int channels;
+    int row_begin;
+    int row_end;
+    int filter;
+    int level;
+
+    // filtered rows of the whole image, begin/end delimit this band
+    unsigned char *filtered;
+    size_t filtered_len;
+    size_t begin;
+    size_t end;
+    int first;
+    int last;
+
+    unsigned char *out;
+    size_t out_len;
+    unsigned int crc;
+    unsigned int adler;
+    int failed;
+} band_t;
+
+typedef struct bit_writer {
+    unsigned char *out;
+    size_t pos;
+    unsigned long long bits;
+    int count;
+} bit_writer_t;
+
+// fixed huffman codes, stored bit reversed for the LSB first stream
+static unsigned short lit_code[288];
+static unsigned char lit_bits[288];
+static unsigned char dist_code_rev[30];
+static unsigned char len_symbol[MAX_MATCH + 1];
+static unsigned char dist_symbol[512];
+static unsigned int crc_table[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static const unsigned short len_base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const unsigned char len_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const unsigned short dist_base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const unsigned char dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+static unsigned int reverse_bits(unsigned int code, int n){
+    unsigned int r = 0;
+    for (int i = 0; i < n; i++) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+static void init_tables(void){
+    for (int v = 0; v < 288; v++) {
+        if (v < 144)      { lit_code[v] = reverse_bits(0x30 + v, 8);          lit_bits[v] = 8; }
+        else if (v < 256) { lit_code[v] = reverse_bits(0x190 + v - 144, 9);   lit_bits[v] = 9; }
+        else if (v < 280) { lit_code[v] = reverse_bits(v - 256, 7);           lit_bits[v] = 7; }
+        else              { lit_code[v] = reverse_bits(0xc0 + v - 280, 8);    lit_bits[v] = 8; }
+    }
+    for (int d = 0; d < 30; d++) {
+        dist_code_rev[d] = reverse_bits(d, 5);
+    }
+
+    for (int s = 0, len = MIN_MATCH; len <= MAX_MATCH; len++) {
+        while (s < 28 && len >= len_base[s + 1]) s++;
+        len_symbol[len] = s;
+    }
+
+    // distances up to 256 index directly, larger ones by (d - 1) >> 7
+    for (int s = 0, d = 1; d <= 256; d++) {
+        while (s < 29 && d >= dist_base[s + 1]) s++;
+        dist_symbol[d - 1] = s;
+    }
+    for (int s = 0, d = 257; d <= WINDOW_SIZE; d += 128) {
+        while (s < 29 && d >= dist_base[s + 1]) s++;
+        dist_symbol[256 + ((d - 1) >> 7)] = s;
+    }
+
+    for (unsigned int n = 0; n < 256; n++) {
+        unsigned int c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static unsigned int crc_update(unsigned int crc, const unsigned char *data, size_t len){
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static unsigned int adler_update(unsigned int adler, const unsigned char *data, size_t len){
+    unsigned int a = adler & 0xffff;
+    unsigned int b = adler >> 16;
+    while (len > 0) {
+        size_t n = len < ADLER_NMAX ? len : ADLER_NMAX;
+        len -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return (b << 16) | a;
+}
+
+// adler of the concatenation, from the adlers of both parts and the length of the second
+static unsigned int adler_combine(unsigned int adler1, unsigned int adler2, size_t len2){
+    unsigned int rem = (unsigned int)(len2 % ADLER_BASE);
+    unsigned int sum1 = adler1 & 0xffff;
+    unsigned int sum2 = (unsigned int)(((unsigned long long)rem * sum1) % ADLER_BASE);
+    sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+    if (sum2 >= (ADLER_BASE << 1)) sum2 -= (ADLER_BASE << 1);
+    if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+    return (sum2 << 16) | sum1;
+}
+
+static void put_bits(bit_writer_t *bw, unsigned int value, int n){
+    bw->bits |= (unsigned long long)value << bw->count;
+    bw->count += n;
+    while (bw->count >= 8) {
+        bw->out[bw->pos++] = (unsigned char)bw->bits;
+        bw->bits >>= 8;
+        bw->count -= 8;
+    }
+}
+
+static void align_byte(bit_writer_t *bw){
+    if (bw->count > 0) {
+        put_bits(bw, 0, 8 - bw->count);
+    }
+}
+
+static void put_literal(bit_writer_t *bw, int v){
+    put_bits(bw, lit_code[v], lit_bits[v]);
+}
+
+static void put_match(bit_writer_t *bw, int len, size_t dist){
+    int ls = len_symbol[len];
+    put_literal(bw, 257 + ls);
+    if (len_extra[ls]) {
+        put_bits(bw, len - len_base[ls], len_extra[ls]);
+    }
+
+    int ds = dist <= 256 ? dist_symbol[dist - 1] : dist_symbol[256 + ((dist - 1) >> 7)];
+    put_bits(bw, dist_code_rev[ds], 5);
+    if (dist_extra[ds]) {
+        put_bits(bw, (unsigned int)(dist - dist_base[ds]), dist_extra[ds]);
+    }
+}
+
+static unsigned char paeth(int a, int b, int c){
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+#ifdef __SSE2__
+// filter the bytes from i up to a multiple of 16, the rest is left to the scalar loops
+static int filter_row_sse2(int type, const unsigned char *row, const unsigned char *prior, int bpp, int i, int len, unsigned char *out){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i a = _mm_loadu_si128((const __m128i *)(row + i - bpp));
+        __m128i pred;
+
+        if (type == 1) {
+            pred = a;
+        }
+        else {
+            __m128i b = _mm_loadu_si128((const __m128i *)(prior + i));
+            if (type == 2) {
+                pred = b;
+            }
+            else if (type == 3) {
+                // floor of the average, avg_epu8 rounds up
+                pred = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            }
+            else {
+                __m128i c = _mm_loadu_si128((const __m128i *)(prior + i - bpp));
+                __m128i halves[2];
+                for (int h = 0; h < 2; h++) {
+                    __m128i a16 = h ? _mm_unpackhi_epi8(a, zero) : _mm_unpacklo_epi8(a, zero);
+                    __m128i b16 = h ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+                    __m128i c16 = h ? _mm_unpackhi_epi8(c, zero) : _mm_unpacklo_epi8(c, zero);
+
+                    // p - a = b - c, p - b = a - c, p - c = (b - c) + (a - c)
+                    __m128i pa = _mm_sub_epi16(b16, c16);
+                    __m128i pb = _mm_sub_epi16(a16, c16);
+                    __m128i pc = _mm_add_epi16(pa, pb);
+                    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+                    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+                    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+                    __m128i use_a = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)), _mm_set1_epi16(-1));
+                    __m128i use_b = _mm_andnot_si128(_mm_cmpgt_epi16(pb, pc), _mm_set1_epi16(-1));
+                    __m128i bc = _mm_or_si128(_mm_and_si128(use_b, b16), _mm_andnot_si128(use_b, c16));
+                    halves[h] = _mm_or_si128(_mm_and_si128(use_a, a16), _mm_andnot_si128(use_a, bc));
+                }
+                pred = _mm_packus_epi16(halves[0], halves[1]);
+            }
+        }
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_sub_epi8(x, pred));
+    }
+    return i;
+}
+#endif
+
+// apply one PNG filter type to a row, prior is NULL for the first row
+static void filter_row(int type, const unsigned char *row, const unsigned char *prior, int bpp, int len, unsigned char *out){
+    int i;
+    if (type == 0 || (type == 2 && !prior)) {
+        memcpy(out, row, len);
+        return;
+    }
+
+    for (i = 0; i < bpp && i < len; i++) {
+        switch (type) {
+        case 1: out[i] = row[i]; break;
+        case 2: out[i] = row[i] - prior[i]; break;
+        case 3: out[i] = row[i] - ((prior ? prior[i] : 0) >> 1); break;
+        case 4: out[i] = row[i] - paeth(0, prior ? prior[i] : 0, 0); break;
+        }
+    }
+
+#ifdef __SSE2__
+    if (prior || type == 1) {
+        i = filter_row_sse2(type, row, prior, bpp, i, len, out);
+    }
+#endif
+
+    switch (type) {
+    case 1:
+        for (; i < len; i++) out[i] = row[i] - row[i - bpp];
+        break;
+    case 2:
+        for (; i < len; i++) out[i] = row[i] - prior[i];
+        break;
+    case 3:
+        for (; i < len; i++) out[i] = row[i] - ((row[i - bpp] + (prior ? prior[i] : 0)) >> 1);
+        break;
+    case 4:
+        for (; i < len; i++) out[i] = row[i] - paeth(row[i - bpp], prior ? prior[i] : 0, prior ? prior[i - bpp] : 0);
+        break;
+    }
+}
+
+// estimate a filter on every SAMPLE_STEP-th pixel of a row, without writing anything
+static long long sample_filter(int type, const unsigned char *row, const unsigned char *prior, int bpp, int len){
+    long long est = 0;
+    for (int i = bpp; i < len; i += SAMPLE_STEP * bpp) {
+        for (int k = i; k < i + bpp && k < len; k++) {
+            unsigned char a = row[k - bpp], b = prior[k], c = prior[k - bpp], pred;
+            switch (type) {
+            case 1: pred = a; break;
+            case 2: pred = b; break;
+            case 3: pred = (a + b) >> 1; break;
+            default: pred = paeth(a, b, c); break;
+            }
+            est += abs((signed char)(row[k] - pred));
+        }
+    }
+    return est;
+}
+
+// choose the filter of a row without running all five over it
+static int guess_filter(const unsigned char *row, const unsigned char *prior, int bpp, int len){
+    if (!prior) {
+        return 1;
+    }
+
+    int best = 1;
+    long long best_est = sample_filter(1, row, prior, bpp, len);
+    static const int candidates[2] = { 2, 4 };
+    for (int k = 0; k < 2; k++) {
+        long long est = sample_filter(candidates[k], row, prior, bpp, len);
+        if (est < best_est) {
+            best_est = est;
+            best = candidates[k];
+        }
+    }
+    return best;
+}
+
+// filter the rows of a band, by default picking per row the filter with the smallest sum of absolute values
+static void *filter_band(void *arg){
+    band_t *band = (band_t *)arg;
+    int len = band->width * band->channels;
+    unsigned char *candidates = (unsigned char *)malloc((size_t)len * 5);
+    if (!candidates) {
+        band->failed = 1;
+        return NULL;
+    }
+
+    for (int y = band->row_begin; y < band->row_end; y++) {
+        const unsigned char *row = band->pixels + (size_t)y * len;
+        const unsigned char *prior = y > 0 ? row - len : NULL;
+        unsigned char *dst = band->filtered + (size_t)y * (len + 1);
+
+        // a single filter goes straight to the output
+        if (band->filter != PNG_FILTER_ADAPTIVE) {
+            int type = band->filter == PNG_FILTER_HEURISTIC ? guess_filter(row, prior, band->channels, len) : band->filter;
+            dst[0] = (unsigned char)type;
+            filter_row(type, row, prior, band->channels, len, dst + 1);
+            continue;
+        }
+
+        int best = 0;
+        long long best_est = -1;
+
+        for (int type = 0; type < 5; type++) {
+            unsigned char *line = candidates + (size_t)type * len;
+            filter_row(type, row, prior, band->channels, len, line);
+
+            long long est = 0;
+            for (int i = 0; i < len; i++) {
+                est += abs((signed char)line[i]);
+            }
+            if (best_est < 0 || est < best_est) {
+                best_est = est;
+                best = type;
+            }
+        }
+
+        dst[0] = (unsigned char)best;
+        memcpy(dst + 1, candidates + (size_t)best * len, len);
+    }
+    free(candidates);
+
+    band->adler = adler_update(1, band->filtered + band->begin, band->end - band->begin);
+    return NULL;
+}
+
+typedef struct matcher {
+    const unsigned char *data;
+    size_t data_len;
+    size_t *head;
+    size_t *prev;
+    size_t next_insert;
+    int max_chain;
+} matcher_t;
+
+static unsigned int hash3(const unsigned char *p){
+    return ((unsigned int)(p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// add every position before pos to the hash chains
+static void insert_until(matcher_t *m, size_t pos){
+    for (; m->next_insert < pos; m->next_insert++) {
+        size_t i = m->next_insert;
+        if (i + MIN_MATCH > m->data_len) {
+            continue;
+        }
+        unsigned int h = hash3(m->data + i);
+        m->prev[i & (WINDOW_SIZE - 1)] = m->head[h];
+        m->head[h] = i + 1;
+    }
+}
+
+static int longest_match(matcher_t *m, size_t pos, size_t end, size_t *dist){
+    size_t limit = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+    if (limit < MIN_MATCH) {
+        return 0;
+    }
+
+    const unsigned char *cur = m->data + pos;
+    size_t candidate = m->head[hash3(cur)];
+    int best = 0;
+
+    for (int chain = m->max_chain; candidate && chain > 0; chain--) {
+        size_t p = candidate - 1;
+        if (pos - p > WINDOW_SIZE) {
+            break;
+        }
+
+        const unsigned char *ref = m->data + p;
+        if ((size_t)best < limit && ref[best] == cur[best]) {
+            size_t len = 0;
+            while (len < limit && ref[len] == cur[len]) {
+                len++;
+            }
+            if ((int)len > best) {
+                best = (int)len;
+                *dist = pos - p;
+                if (len == limit) {
+                    break;
+                }
+            }
+        }
+        candidate = m->prev[p & (WINDOW_SIZE - 1)];
+    }
+
+    return best >= MIN_MATCH ? best : 0;
+}
+
+// deflate the band into fixed huffman blocks, primed with the 32K before it
+static void *deflate_band(void *arg){
+    band_t *band = (band_t *)arg;
+    size_t len = band->end - band->begin;
+
+    // worst case is a 9 bit code per byte, plus zlib header, sync flush and adler
+    band->out = (unsigned char *)malloc(len + len / 8 + 64);
+    matcher_t m;
+    m.head = (size_t *)calloc(HASH_SIZE, sizeof(size_t));
+    m.prev = (size_t *)calloc(WINDOW_SIZE, sizeof(size_t));
+    if (!band->out || !m.head || !m.prev) {
+        free(m.head);
+        free(m.prev);
+        band->failed = 1;
+        return NULL;
+    }
+    m.data = band->filtered;
+    m.data_len = band->filtered_len;
+    m.next_insert = band->begin > WINDOW_SIZE ? band->begin - WINDOW_SIZE : 0;
+    m.max_chain = band->level == PNG_LEVEL_FAST ? MAX_CHAIN_FAST : MAX_CHAIN;
+    int lazy = band->level != PNG_LEVEL_FAST;
+
+    bit_writer_t bw = { band->out, 0, 0, 0 };
+    if (band->first) {
+        bw.out[bw.pos++] = 0x78;  // DEFLATE 32K window
+        bw.out[bw.pos++] = 0x5e;
+    }
+
+    put_bits(&bw, band->last ? 1 : 0, 1);  // BFINAL
+    put_bits(&bw, 1, 2);                   // BTYPE = 1, fixed huffman
+
+    size_t i = band->begin;
+    while (i < band->end) {
+        size_t dist = 0;
+        insert_until(&m, i);
+        int match = longest_match(&m, i, band->end, &dist);
+
+        // lazy matching, prefer a literal when the next position matches longer
+        if (lazy && match && match < LAZY_LIMIT && i + 1 < band->end) {
+            size_t next_dist;
+            insert_until(&m, i + 1);
+            if (longest_match(&m, i + 1, band->end, &next_dist) > match) {
+                match = 0;
+            }
+        }
+
+        if (match) {
+            put_match(&bw, match, dist);
+            i += match;
+        }
+        else {
+            put_literal(&bw, band->filtered[i]);
+            i++;
+        }
+    }
+    put_literal(&bw, 256);  // end of block
+
+    if (!band->last) {
+        // sync flush, an empty stored block brings the stream to a byte boundary
+        put_bits(&bw, 0, 3);
+        align_byte(&bw);
+        put_bits(&bw, 0x0000, 16);
+        put_bits(&bw, 0xffff, 16);
+    }
+    align_byte(&bw);
+
+    free(m.head);
+    free(m.prev);
+
+    band->out_len = bw.pos;
+    band->crc = crc_update(crc_update(0xffffffffu, (const unsigned char *)"IDAT", 4), band->out, band->out_len);
+    return NULL;
+}
+
+static unsigned char *write_32(unsigned char *o, unsigned int v){
+    o[0] = (unsigned char)(v >> 24);
+    o[1] = (unsigned char)(v >> 16);
+    o[2] = (unsigned char)(v >> 8);
+    o[3] = (unsigned char)v;
+    return o + 4;
+}
+
+unsigned char *png_encode(const void *pixels, int width, int height, int channels, const png_options_t *options, int *out_len){
+    static const int color_type[5] = { -1, 0, 4, 2, 6 };
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+    if (
+        pixels == NULL || options == NULL || width <= 0 || height <= 0 || channels < 1 || channels > 4 ||
+        options->filter < PNG_FILTER_HEURISTIC || options->filter > 4
+    ) {
+        return NULL;
+    }
+    pthread_once(&tables_once, init_tables);
+
+    size_t row_len = (size_t)width * channels + 1;
+    size_t filtered_len = row_len * height;
+    unsigned char *filtered = (unsigned char *)malloc(filtered_len);
+    if (!filtered) {
+        return NULL;
+    }
+
+    size_t max_bands = filtered_len / BAND_MIN_BYTES;
+    int n_bands = pqoi_band_count(max_bands < (size_t)height ? max_bands : (size_t)height, options->n_threads);
+
+    band_t *bands = (band_t *)calloc(n_bands, sizeof(band_t));
+    if (!bands) {
+        free(filtered);
+        return NULL;
+    }
+    for (int i = 0; i < n_bands; i++) {
+        band_t *band = &bands[i];
+        band->pixels = (const unsigned char *)pixels;
+        band->width = width;
+        band->channels = channels;
+        band->row_begin = (int)((long long)height * i / n_bands);
+        band->row_end = (int)((long long)height * (i + 1) / n_bands);
+        band->filter = options->filter;
+        band->level = options->level;
+        band->filtered = filtered;
+        band->filtered_len = filtered_len;
+        band->begin = band->row_begin * row_len;
+        band->end = band->row_end * row_len;
+        band->first = i == 0;
+        band->last = i == n_bands - 1;
+    }
+
+    // the dictionary of a band is the end of the previous one, so all filtering comes first
+    pqoi_run_bands(filter_band, bands, sizeof(band_t), n_bands);
+    pqoi_run_bands(deflate_band, bands, sizeof(band_t), n_bands);
+
+    unsigned int adler = 1;
+    size_t total = sizeof(signature) + 12 + 13 + 12;
+    int failed = 0;
+    for (int i = 0; i < n_bands; i++) {
+        failed |= bands[i].failed;
+        adler = adler_combine(adler, bands[i].adler, bands[i].end - bands[i].begin);
+        total += 12 + bands[i].out_len;
+    }
+    total += 4;
+
+    unsigned char *png = failed || total > 0x7fffffff ? NULL : (unsigned char *)malloc(total);
+    if (png) {
+        unsigned char *o = png;
+        memcpy(o, signature, sizeof(signature));
+        o += sizeof(signature);
+
+        unsigned char *chunk = o + 4;
+        o = write_32(o, 13);
+        memcpy(o, "IHDR", 4);
+        o += 4;
+        o = write_32(o, width);
+        o = write_32(o, height);
+        *o++ = 8;
+        *o++ = (unsigned char)color_type[channels];
+        *o++ = 0;
+        *o++ = 0;
+        *o++ = 0;
+        o = write_32(o, crc_update(0xffffffffu, chunk, 17) ^ 0xffffffffu);
+
+        // one IDAT per band, the last one carries the adler of the whole stream
+        for (int i = 0; i < n_bands; i++) {
+            band_t *band = &bands[i];
+            unsigned int crc = band->crc;
+            size_t len = band->out_len;
+
+            o = write_32(o, (unsigned int)(len + (band->last ? 4 : 0)));
+            memcpy(o, "IDAT", 4);
+            memcpy(o + 4, band->out, len);
+            o += 4 + len;
+            if (band->last) {
+                write_32(o, adler);
+                crc = crc_update(crc, o, 4);
+                o += 4;
+            }
+            o = write_32(o, crc ^ 0xffffffffu);
+        }
+
+        o = write_32(o, 0);
+        memcpy(o, "IEND", 4);
+        o = write_32(o + 4, crc_update(0xffffffffu, (const unsigned char *)"IEND", 4) ^ 0xffffffffu);
+        *out_len = (int)(o - png);
+    }
+
+    for (int i = 0; i < n_bands; i++) {
+        free(bands[i].out);
+    }
+    free(bands);
+    free(filtered);
+    return png;
+}
+
+unsigned char *png_encode_parallel(const void *pixels, int width, int height, int channels, int n_threads, int *out_len){
+    png_options_t options = { n_threads, PNG_FILTER_ADAPTIVE, PNG_LEVEL_DEFAULT };
+    return png_encode(pixels, width, height, channels, &options, out_len);
+}
+
+int png_write_parallel(const char *filename, const void *pixels, int width, int height, int channels, int n_threads){
+    png_options_t options = { n_threads, PNG_FILTER_ADAPTIVE, PNG_LEVEL_DEFAULT };
+    return png_write(filename, pixels, width, height, channels, &options);
+}
+
+int png_write(const char *filename, const void *pixels, int width, int height, int channels, const png_options_t *options){
+    int size;
+    unsigned char *png = png_encode(pixels, width, height, channels, options, &size);
+    if (!png) {
+        return 0;
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        free(png);
+        return 0;
+    }
+
+    fwrite(png, 1, size, f);
+    fflush(f);
+    int err = ferror(f);
+    fclose(f);
+
+    free(png);
+    return err ? 0 : size;
+}
@@ -0,0 +1,207 @@
+#include "pqoi_alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#endif
+
+// every allocation is prefixed by its size so realloc knows how much to copy
+#define ALIGNMENT 16
+#define HEADER_SIZE ALIGNMENT
+#define ALIGN_UP(n, a) (((n) + (a) - 1) & ~((size_t)(a) - 1))
+
+static _Thread_local const pqoi_allocator_t *current_allocator = NULL;
+
+static pqoi_arena_block_t *new_block(size_t size, int huge_pages){
+    pqoi_arena_block_t *block = NULL;
+    size_t total = ALIGN_UP(sizeof(pqoi_arena_block_t), ALIGNMENT) + size;
+    int mapped = 0;
+
+#ifdef __linux__
+    if (huge_pages) {
+        total = ALIGN_UP(total, HUGE_PAGE_SIZE);
+        void *p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, total, MADV_HUGEPAGE);
+            block = (pqoi_arena_block_t *)p;
+            mapped = 1;
+        }
+    }
+#else
+    (void)huge_pages;
+#endif
+
+    if (block == NULL) {
+        block = (pqoi_arena_block_t *)malloc(total);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    block->next = NULL;
+    block->size = total - ALIGN_UP(sizeof(pqoi_arena_block_t), ALIGNMENT);
+    block->used = 0;
+    block->mapped = mapped;
+    return block;
+}
+
+static void free_block(pqoi_arena_block_t *block){
+#ifdef __linux__
+    if (block->mapped) {
+        munmap(block, ALIGN_UP(sizeof(pqoi_arena_block_t), ALIGNMENT) + block->size);
+        return;
+    }
+#endif
+    free(block);
+}
+
+static unsigned char *block_data(pqoi_arena_block_t *block){
+    return (unsigned char *)block + ALIGN_UP(sizeof(pqoi_arena_block_t), ALIGNMENT);
+}
+
+static void *arena_alloc(void *ctx, size_t size){
+    pqoi_arena_t *arena = (pqoi_arena_t *)ctx;
+    size_t needed = HEADER_SIZE + ALIGN_UP(size, ALIGNMENT);
+    pqoi_arena_block_t *block = arena->head;
+
+    if (block == NULL || block->size - block->used < needed) {
+        size_t block_size = block ? block->size * 2 : 0;
+        if (block_size < needed) {
+            block_size = needed;
+        }
+
+        pqoi_arena_block_t *grown = new_block(block_size, arena->huge_pages);
+        if (grown == NULL) {
+            return NULL;
+        }
+        grown->next = block;
+        arena->head = block = grown;
+        arena->total += grown->size;
+    }
+
+    unsigned char *p = block_data(block) + block->used;
+    *(size_t *)p = size;
+    block->used += needed;
+
+    arena->last = p + HEADER_SIZE;
+    return arena->last;
+}
+
+static void *arena_realloc(void *ctx, void *ptr, size_t size){
+    pqoi_arena_t *arena = (pqoi_arena_t *)ctx;
+    if (ptr == NULL) {
+        return arena_alloc(ctx, size);
+    }
+
+    size_t *header = (size_t *)((unsigned char *)ptr - HEADER_SIZE);
+    size_t old_size = *header;
+
+    // the most recent allocation can grow or shrink in place
+    if (ptr == arena->last) {
+        pqoi_arena_block_t *block = arena->head;
+        size_t start = (unsigned char *)header - block_data(block);
+        size_t needed = HEADER_SIZE + ALIGN_UP(size, ALIGNMENT);
+        if (block->size - start >= needed) {
+            block->used = start + needed;
+            *header = size;
+            return ptr;
+        }
+    }
+    else if (size <= old_size) {
+        *header = size;
+        return ptr;
+    }
+
+    void *moved = arena_alloc(ctx, size);
+    if (moved == NULL) {
+        return NULL;
+    }
+    memcpy(moved, ptr, old_size < size ? old_size : size);
+    return moved;
+}
+
+static void arena_free(void *ctx, void *ptr){
+    pqoi_arena_t *arena = (pqoi_arena_t *)ctx;
+
+    // only the most recent allocation is given back, the rest waits for the reset
+    if (ptr != NULL && ptr == arena->last) {
+        arena->head->used = (unsigned char *)ptr - HEADER_SIZE - block_data(arena->head);
+        arena->last = NULL;
+    }
+}
+
+void pqoi_arena_init(pqoi_arena_t *arena, size_t initial_size, int huge_pages){
+    memset(arena, 0, sizeof(*arena));
+    arena->huge_pages = huge_pages;
+    arena->allocator.alloc = arena_alloc;
+    arena->allocator.realloc = arena_realloc;
+    arena->allocator.free = arena_free;
+    arena->allocator.ctx = arena;
+
+    if (initial_size > 0) {
+        arena->head = new_block(initial_size, huge_pages);
+        arena->total = arena->head ? arena->head->size : 0;
+    }
+}
+
+void pqoi_arena_reset(pqoi_arena_t *arena){
+    pqoi_arena_block_t *block = arena->head;
+    arena->last = NULL;
+    if (block == NULL) {
+        return;
+    }
+
+    // fold the chain into one block big enough for the whole previous image
+    if (block->next != NULL) {
+        size_t total = arena->total;
+        pqoi_arena_destroy(arena);
+        arena->head = new_block(total, arena->huge_pages);
+        arena->total = arena->head ? arena->head->size : 0;
+        return;
+    }
+
+    block->used = 0;
+}
+
+void pqoi_arena_destroy(pqoi_arena_t *arena){
+    pqoi_arena_block_t *block = arena->head;
+    while (block != NULL) {
+        pqoi_arena_block_t *next = block->next;
+        free_block(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->total = 0;
+    arena->last = NULL;
+}
+
+const pqoi_allocator_t *pqoi_set_allocator(const pqoi_allocator_t *allocator){
+    const pqoi_allocator_t *previous = current_allocator;
+    current_allocator = allocator;
+    return previous;
+}
+
+void *pqoi_malloc(size_t size){
+    if (current_allocator == NULL) {
+        return malloc(size);
+    }
+    return current_allocator->alloc(current_allocator->ctx, size);
+}
+
+void *pqoi_realloc(void *ptr, size_t size){
+    if (current_allocator == NULL) {
+        return realloc(ptr, size);
+    }
+    return current_allocator->realloc(current_allocator->ctx, ptr, size);
+}
+
+void pqoi_free(void *ptr){
+    if (current_allocator == NULL) {
+        free(ptr);
+        return;
+    }
+    current_allocator->free(current_allocator->ctx, ptr);
+}
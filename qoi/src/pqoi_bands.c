@@ -0,0 +1,56 @@
+#include "pqoi_bands.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+int pqoi_cpu_count(void){
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+int pqoi_band_count(size_t n_items, int n_threads){
+    if (n_threads <= 0) {
+        n_threads = pqoi_cpu_count();
+    }
+    if ((size_t)n_threads > n_items) {
+        n_threads = n_items > 0 ? (int)n_items : 1;
+    }
+    return n_threads;
+}
+
+void pqoi_run_bands(void *(*fn)(void *), void *bands, size_t band_size, int n_bands){
+    unsigned char *band = (unsigned char *)bands;
+    pthread_t *threads = n_bands > 1 ? (pthread_t *)malloc(n_bands * sizeof(pthread_t)) : NULL;
+    int *started = n_bands > 1 ? (int *)calloc(n_bands, sizeof(int)) : NULL;
+    int spawn = threads && started;
+
+    for (int i = 1; i < n_bands; i++) {
+        if (spawn && pthread_create(&threads[i], NULL, fn, band + i * band_size) == 0) {
+            started[i] = 1;
+        }
+        else {
+            fn(band + i * band_size);
+        }
+    }
+    fn(band);
+    for (int i = 1; i < n_bands && spawn; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    free(threads);
+    free(started);
+}
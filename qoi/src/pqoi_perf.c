@@ -0,0 +1,201 @@
+#include "pqoi_perf.h"
+
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const unsigned long long configs[PQOI_PERF_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,  // last level cache on the common PMUs
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// a counter of this process and every thread it starts from now on, user space only
+// so it also opens with perf_event_paranoid at 2
+static int open_counter(unsigned long long config){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// the count of a counter, scaled up for the time the kernel had it multiplexed out
+static int read_counter(int fd, unsigned long long *count){
+    unsigned long long values[3];
+    if (read(fd, values, sizeof(values)) != (ssize_t)sizeof(values) || values[2] == 0) {
+        return 0;
+    }
+    *count = values[2] < values[1] ? (unsigned long long)((double)values[0] * values[1] / values[2]) : values[0];
+    return 1;
+}
+#endif
+
+static double now(void){
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+// the stage of that name, added if it is new
+// returns NULL once PQOI_PERF_MAX_STAGES are taken
+static pqoi_perf_stage_t *find_stage(pqoi_perf_t *perf, const char *name){
+    for (int i = 0; i < perf->n_stages; i++) {
+        if (strcmp(perf->stages[i].name, name) == 0) {
+            return &perf->stages[i];
+        }
+    }
+    if (perf->n_stages == PQOI_PERF_MAX_STAGES) {
+        return NULL;
+    }
+    pqoi_perf_stage_t *stage = &perf->stages[perf->n_stages++];
+    memset(stage, 0, sizeof(*stage));
+    stage->name = name;
+    return stage;
+}
+
+int pqoi_perf_init(pqoi_perf_t *perf){
+    memset(perf, 0, sizeof(*perf));
+    int opened = 0;
+    for (int i = 0; i < PQOI_PERF_EVENTS; i++) {
+#ifdef __linux__
+        perf->fds[i] = open_counter(configs[i]);
+#else
+        perf->fds[i] = -1;
+#endif
+        opened += perf->fds[i] >= 0;
+    }
+    return opened;
+}
+
+void pqoi_perf_release(pqoi_perf_t *perf){
+    for (int i = 0; i < PQOI_PERF_EVENTS; i++) {
+#ifdef __linux__
+        if (perf->fds[i] >= 0) {
+            close(perf->fds[i]);
+        }
+#endif
+        perf->fds[i] = -1;
+    }
+}
+
+void pqoi_perf_begin(pqoi_perf_t *perf, const char *stage){
+    if (perf == NULL) {
+        return;
+    }
+    perf->current = find_stage(perf, stage);
+
+#ifdef __linux__
+    for (int i = 0; i < PQOI_PERF_EVENTS; i++) {
+        if (perf->fds[i] >= 0) {
+            ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    perf->begin = now();
+}
+
+void pqoi_perf_end(pqoi_perf_t *perf, unsigned long long *counts){
+    if (perf == NULL) {
+        return;
+    }
+    double seconds = now() - perf->begin;
+
+    unsigned long long run[PQOI_PERF_EVENTS];
+    unsigned int counted = 0;
+    for (int i = 0; i < PQOI_PERF_EVENTS; i++) {
+        run[i] = ~0ULL;
+#ifdef __linux__
+        if (perf->fds[i] >= 0) {
+            ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read_counter(perf->fds[i], &run[i])) {
+                counted |= 1u << i;
+            }
+            else {
+                run[i] = ~0ULL;
+            }
+        }
+#endif
+    }
+
+    pqoi_perf_stage_t *stage = perf->current;
+    if (stage) {
+        stage->runs++;
+        stage->seconds += seconds;
+        for (int i = 0; i < PQOI_PERF_EVENTS; i++) {
+            if (counted & (1u << i)) {
+                stage->counts[i] += run[i];
+            }
+        }
+        stage->counted |= counted;
+    }
+    perf->current = NULL;
+
+    if (counts) {
+        memcpy(counts, run, sizeof(run));
+    }
+}
+
+void pqoi_perf_reset(pqoi_perf_t *perf){
+    perf->n_stages = 0;
+    perf->current = NULL;
+}
+
+void pqoi_perf_merge(pqoi_perf_t *dst, const pqoi_perf_t *src){
+    for (int i = 0; i < src->n_stages; i++) {
+        const pqoi_perf_stage_t *from = &src->stages[i];
+        pqoi_perf_stage_t *to = find_stage(dst, from->name);
+        if (to == NULL) {
+            continue;
+        }
+        to->runs += from->runs;
+        to->seconds += from->seconds;
+        for (int e = 0; e < PQOI_PERF_EVENTS; e++) {
+            to->counts[e] += from->counts[e];
+        }
+        to->counted |= from->counted;
+    }
+}
+
+void pqoi_perf_report(const pqoi_perf_t *perf, const char *title, FILE *out){
+    fprintf(out, "%s\n  %-12s %5s %10s %14s %14s %6s %12s %12s\n", title,
+        "stage", "runs", "seconds", "cycles", "instructions", "IPC", "LLC misses", "br misses");
+
+    for (int i = 0; i < perf->n_stages; i++) {
+        const pqoi_perf_stage_t *stage = &perf->stages[i];
+        fprintf(out, "  %-12s %5u %10.6f", stage->name, stage->runs, stage->seconds);
+        for (int e = 0; e < PQOI_PERF_EVENTS; e++) {
+            int width = e == PQOI_PERF_CYCLES || e == PQOI_PERF_INSTRUCTIONS ? 14 : 12;
+            if (e == PQOI_PERF_LLC_MISSES) {
+                // instructions per cycle between the instructions and the misses
+                unsigned int both = 1u << PQOI_PERF_CYCLES | 1u << PQOI_PERF_INSTRUCTIONS;
+                if ((stage->counted & both) == both && stage->counts[PQOI_PERF_CYCLES]) {
+                    fprintf(out, " %6.2f", (double)stage->counts[PQOI_PERF_INSTRUCTIONS] / stage->counts[PQOI_PERF_CYCLES]);
+                }
+                else {
+                    fprintf(out, " %6s", "-");
+                }
+            }
+            if (stage->counted & (1u << e)) {
+                fprintf(out, " %*llu", width, stage->counts[e]);
+            }
+            else {
+                fprintf(out, " %*s", width, "-");
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
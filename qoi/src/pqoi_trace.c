@@ -0,0 +1,230 @@
+#include "pqoi_trace.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// pids of the two processes of the trace
+#define HOST_PID 1
+#define DEVICE_PID 2
+
+struct pqoi_trace_command {
+    cl_event event;
+    const char *name;
+    const char *track;
+    double enqueued;  // host seconds when the command was added
+    pqoi_trace_command_t *next;
+};
+
+// number of the calling thread in the trace, 0 until its first span
+static _Thread_local int thread_id;
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+// microseconds of a host time since the start of the trace
+static double trace_us(const pqoi_trace_t *trace, double seconds){
+    return (seconds - trace->origin) * 1.0e6;
+}
+
+// start the next event of traceEvents, the caller holds the lock
+static void emit(pqoi_trace_t *trace, const char *format, ...){
+    fputs(trace->n_events++ ? ",\n" : "\n", trace->out);
+    va_list args;
+    va_start(args, format);
+    vfprintf(trace->out, format, args);
+    va_end(args);
+}
+
+static void write_string(FILE *out, const char *s){
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        }
+        else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        }
+        else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// name a track of one of the processes
+static void name_track(pqoi_trace_t *trace, int pid, int tid, const char *format, int number, const char *name){
+    emit(trace, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, tid);
+    if (name) {
+        write_string(trace->out, name);
+    }
+    else {
+        fputc('"', trace->out);
+        fprintf(trace->out, format, number);
+        fputc('"', trace->out);
+    }
+    fputs("}}", trace->out);
+}
+
+// track of a queue on the device, named the first time it shows up
+static int device_track(pqoi_trace_t *trace, const char *track){
+    for (int i = 0; i < trace->n_tracks; i++) {
+        if (strcmp(trace->tracks[i], track) == 0) {
+            return i + 1;
+        }
+    }
+    if (trace->n_tracks == PQOI_TRACE_MAX_TRACKS) {
+        return PQOI_TRACE_MAX_TRACKS + 1;
+    }
+    trace->tracks[trace->n_tracks++] = track;
+    name_track(trace, DEVICE_PID, trace->n_tracks, NULL, 0, track);
+    return trace->n_tracks;
+}
+
+// write a finished command: its run on the queue track and its wait as async spans
+// returns 0 if its profiling times aren't there
+static int write_command(pqoi_trace_t *trace, const pqoi_trace_command_t *command){
+    static const cl_profiling_info infos[4] = {
+        CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END
+    };
+    cl_ulong ns[4];
+    for (int i = 0; i < 4; i++) {
+        if (clGetEventProfilingInfo(command->event, infos[i], sizeof(ns[i]), &ns[i], NULL) != CL_SUCCESS) {
+            return 0;
+        }
+    }
+
+    // the first command ties the device clock to the host clock
+    if (!trace->calibrated) {
+        trace->device_offset = ns[0] / 1.0e9 - command->enqueued;
+        trace->calibrated = 1;
+    }
+    double us[4];
+    for (int i = 0; i < 4; i++) {
+        us[i] = trace_us(trace, ns[i] / 1.0e9 - trace->device_offset);
+    }
+
+    int tid = device_track(trace, command->track);
+    unsigned long long id = ++trace->next_id;
+    emit(trace, "{\"ph\":\"X\",\"cat\":\"opencl\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+        "\"args\":{\"queued_us\":%.3f,\"submitted_us\":%.3f}}",
+        command->name, DEVICE_PID, tid, us[2], us[3] - us[2], us[1] - us[0], us[2] - us[1]);
+    emit(trace, "{\"ph\":\"b\",\"cat\":\"opencl\",\"name\":\"%s queued\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+        command->name, id, DEVICE_PID, tid, us[0]);
+    emit(trace, "{\"ph\":\"e\",\"cat\":\"opencl\",\"name\":\"%s queued\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+        command->name, id, DEVICE_PID, tid, us[1]);
+    emit(trace, "{\"ph\":\"b\",\"cat\":\"opencl\",\"name\":\"%s submitted\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+        command->name, id, DEVICE_PID, tid, us[1]);
+    emit(trace, "{\"ph\":\"e\",\"cat\":\"opencl\",\"name\":\"%s submitted\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+        command->name, id, DEVICE_PID, tid, us[2]);
+    return 1;
+}
+
+// write the pending commands that have finished, with wait after waiting for the others,
+// commands that failed are dropped. The caller holds the lock
+static void write_pending(pqoi_trace_t *trace, int wait){
+    pqoi_trace_command_t **link = &trace->pending;
+    while (*link) {
+        pqoi_trace_command_t *command = *link;
+        if (wait) {
+            clWaitForEvents(1, &command->event);
+        }
+
+        cl_int status;
+        if (clGetEventInfo(command->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL) != CL_SUCCESS) {
+            status = -1;
+        }
+        if (status > CL_COMPLETE) {
+            link = &command->next;
+            continue;
+        }
+
+        if (status == CL_COMPLETE) {
+            write_command(trace, command);
+        }
+        *link = command->next;
+        clReleaseEvent(command->event);
+        free(command);
+    }
+    trace->pending_end = link;
+}
+
+int pqoi_trace_open(pqoi_trace_t *trace, const char *path){
+    memset(trace, 0, sizeof(*trace));
+    trace->out = fopen(path, "w");
+    if (!trace->out) {
+        return 0;
+    }
+    pthread_mutex_init(&trace->lock, NULL);
+    trace->pending_end = &trace->pending;
+    trace->origin = now();
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace->out);
+    emit(trace, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"host\"}}", HOST_PID);
+    emit(trace, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"OpenCL device\"}}", DEVICE_PID);
+    return 1;
+}
+
+int pqoi_trace_close(pqoi_trace_t *trace){
+    pthread_mutex_lock(&trace->lock);
+    write_pending(trace, 1);
+    pthread_mutex_unlock(&trace->lock);
+
+    fputs("\n]}\n", trace->out);
+    int ok = !ferror(trace->out);
+    ok = fclose(trace->out) == 0 && ok;
+    pthread_mutex_destroy(&trace->lock);
+    memset(trace, 0, sizeof(*trace));
+    return ok;
+}
+
+double pqoi_trace_begin(const pqoi_trace_t *trace){
+    return trace ? now() : 0;
+}
+
+void pqoi_trace_span(pqoi_trace_t *trace, const char *name, const char *detail, double begin){
+    if (trace == NULL) {
+        return;
+    }
+    double end = now();
+
+    pthread_mutex_lock(&trace->lock);
+    if (thread_id == 0) {
+        thread_id = ++trace->n_threads;
+        name_track(trace, HOST_PID, thread_id, "thread %d", thread_id, NULL);
+    }
+    emit(trace, "{\"ph\":\"X\",\"cat\":\"host\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+        name, HOST_PID, thread_id, trace_us(trace, begin), (end - begin) * 1.0e6);
+    if (detail) {
+        fputs(",\"args\":{\"detail\":", trace->out);
+        write_string(trace->out, detail);
+        fputc('}', trace->out);
+    }
+    fputc('}', trace->out);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void pqoi_trace_command(pqoi_trace_t *trace, cl_event event, const char *name, const char *track){
+    if (trace == NULL || event == NULL) {
+        return;
+    }
+    double enqueued = now();
+
+    pqoi_trace_command_t *command = (pqoi_trace_command_t *)malloc(sizeof(pqoi_trace_command_t));
+    if (!command) {
+        return;
+    }
+    clRetainEvent(event);
+    *command = (pqoi_trace_command_t){ .event = event, .name = name, .track = track, .enqueued = enqueued };
+
+    pthread_mutex_lock(&trace->lock);
+    *trace->pending_end = command;
+    trace->pending_end = &command->next;
+    write_pending(trace, 0);
+    pthread_mutex_unlock(&trace->lock);
+}
@@ -0,0 +1,218 @@
+#include "pqoi_verify.h"
+#include "pqoi_bands.h"
+#include "qoi_color.h"
+#include "qoi_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct verify_band {
+    const unsigned char *bytes;
+    size_t stride;
+    const unsigned int *segment_lengths;
+    const qoi_desc *desc;
+    const unsigned char *pixels;
+    int src_channels;
+
+    unsigned int first_row;
+    unsigned int n_rows;
+
+    int failed;
+    pqoi_mismatch_t mismatch;
+} verify_band_t;
+
+// offset of the first byte that differs, len if there is none
+static size_t first_difference(const unsigned char *a, const unsigned char *b, size_t len){
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        int differs = _mm_movemask_epi8(eq) ^ 0xffff;
+        if (differs) {
+            return i + __builtin_ctz(differs);
+        }
+    }
+#endif
+    while (i < len && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+// the source row with the encoded channels, gray rows are expanded into scratch
+static const unsigned char *source_row(const verify_band_t *band, unsigned int y, unsigned char *scratch){
+    int src_channels = band->src_channels;
+    unsigned int width = band->desc->width;
+    const unsigned char *src = band->pixels + (size_t)y * width * src_channels;
+    if (src_channels >= 3) {
+        return src;
+    }
+
+    unsigned char *out = scratch;
+    for (unsigned int x = 0; x < width; x++, src += src_channels) {
+        out[0] = out[1] = out[2] = src[0];
+        out += 3;
+        if (src_channels == 2) {
+            *out++ = src[1];
+        }
+    }
+    return scratch;
+}
+
+static void fail(verify_band_t *band, unsigned int x, unsigned int y, const unsigned char *expected, const unsigned char *actual, const char *reason){
+    int channels = band->desc->channels;
+    band->failed = 1;
+    band->mismatch.x = x;
+    band->mismatch.y = y;
+    memset(band->mismatch.expected, 0, 4);
+    memset(band->mismatch.actual, 0, 4);
+    band->mismatch.expected[3] = band->mismatch.actual[3] = 255;
+    memcpy(band->mismatch.expected, expected + (size_t)x * channels, channels);
+    if (actual) {
+        memcpy(band->mismatch.actual, actual + (size_t)x * channels, channels);
+    }
+    band->mismatch.reason = reason;
+}
+
+// decode one row into out, holding it to the rules that keep it independent of the rows before
+// returns NULL if it decodes, otherwise the rule it breaks with the pixel it happened at in *at
+static const char *decode_row(const unsigned char *bytes, size_t len, unsigned int width, int channels, unsigned char *out, unsigned int *at){
+    qoi_op_state_t state;
+    qoi_op_state_init(&state);
+    unsigned long long written = 0;
+    size_t p = 0;
+    unsigned int x = 0;
+
+    while (x < width) {
+        *at = x;
+        if (p >= len) {
+            return "the segment ends early";
+        }
+
+        int b1 = bytes[p];
+        int size = qoi_op_size(b1);
+        if (len - p < (size_t)size) {
+            return "the segment ends early";
+        }
+        // an RGB literal keeps the alpha of the pixel before
+        if (x == 0 && b1 != QOI_OPS_RGBA && !(b1 == QOI_OPS_RGB && channels == 3)) {
+            return "the row doesn't start with a literal";
+        }
+        if ((b1 & QOI_OPS_MASK_2) == QOI_OPS_INDEX && !((written >> b1) & 1)) {
+            return "an index op refers to a slot the row didn't set";
+        }
+
+        unsigned int run = qoi_op_apply(&state, bytes + p);
+        if (run > width - x) {
+            return "a run crosses the end of the row";
+        }
+        p += size;
+        written |= 1ULL << (QOI_OPS_HASH(state.px) % 64);
+
+        for (unsigned int i = 0; i < run; i++, x++) {
+            memcpy(out + (size_t)x * channels, state.px, channels);
+        }
+    }
+
+    *at = width - 1;
+    return p == len ? NULL : "the segment has bytes after its last pixel";
+}
+
+static void *verify_rows(void *arg){
+    verify_band_t *band = (verify_band_t *)arg;
+    unsigned int width = band->desc->width;
+    int channels = band->desc->channels;
+    size_t row_len = (size_t)width * channels;
+
+    unsigned char *decoded = (unsigned char *)malloc(row_len);
+    unsigned char *expanded = band->src_channels < 3 ? (unsigned char *)malloc(row_len) : NULL;
+    if (!decoded || (band->src_channels < 3 && !expanded)) {
+        band->failed = 1;
+        band->mismatch = (pqoi_mismatch_t){ .y = band->first_row, .reason = "out of memory" };
+        free(decoded);
+        free(expanded);
+        return NULL;
+    }
+
+    for (unsigned int y = band->first_row; y < band->first_row + band->n_rows; y++) {
+        const unsigned char *expected = source_row(band, y, expanded);
+        unsigned int at;
+        const char *broken = decode_row(band->bytes + y * band->stride, band->segment_lengths[y], width, channels, decoded, &at);
+        if (broken) {
+            fail(band, at, y, expected, NULL, broken);
+            break;
+        }
+
+        // transformed rows are compared the way a decoder hands them out
+        if (band->desc->colorspace & QOI_COLOR_YCOCG) {
+            qoi_color_inverse(decoded, width, channels, 1);
+        }
+
+        size_t differs = first_difference(decoded, expected, row_len);
+        if (differs < row_len) {
+            fail(band, differs / channels, y, expected, decoded, "the pixel decodes to a different color");
+            break;
+        }
+    }
+
+    free(decoded);
+    free(expanded);
+    return NULL;
+}
+
+int pqoi_verify_segments(const unsigned char *bytes, size_t stride, const unsigned int *segment_lengths, const qoi_desc *desc,
+    const unsigned char *pixels, int src_channels, int n_threads, pqoi_mismatch_t *mismatch) {
+
+    if (bytes == NULL || segment_lengths == NULL || pixels == NULL || desc->width == 0 || desc->height == 0 ||
+        src_channels < 1 || src_channels > 4 || desc->channels != (src_channels & 1 ? 3 : 4)) {
+        if (mismatch) {
+            *mismatch = (pqoi_mismatch_t){ .reason = "invalid arguments" };
+        }
+        return 0;
+    }
+
+    n_threads = pqoi_band_count(desc->height, n_threads);
+    verify_band_t *bands = (verify_band_t *)calloc(n_threads, sizeof(verify_band_t));
+    if (!bands) {
+        if (mismatch) {
+            *mismatch = (pqoi_mismatch_t){ .reason = "out of memory" };
+        }
+        return 0;
+    }
+
+    // contiguous bands, so the first failing band holds the first failing row
+    for (int i = 0; i < n_threads; i++) {
+        unsigned int first = (unsigned long long)desc->height * i / n_threads;
+        unsigned int last = (unsigned long long)desc->height * (i + 1) / n_threads;
+        bands[i] = (verify_band_t){
+            .bytes = bytes,
+            .stride = stride,
+            .segment_lengths = segment_lengths,
+            .desc = desc,
+            .pixels = pixels,
+            .src_channels = src_channels,
+            .first_row = first,
+            .n_rows = last - first
+        };
+    }
+
+    pqoi_run_bands(verify_rows, bands, sizeof(verify_band_t), n_threads);
+
+    int ok = 1;
+    for (int i = 0; i < n_threads; i++) {
+        if (bands[i].failed) {
+            if (mismatch) {
+                *mismatch = bands[i].mismatch;
+            }
+            ok = 0;
+            break;
+        }
+    }
+
+    free(bands);
+    return ok;
+}
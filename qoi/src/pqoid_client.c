@@ -0,0 +1,249 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // memfd_create, F_ADD_SEALS
+#endif
+
+#include "pqoid.h"
+#include "qoi_color.h"
+#include "qoi_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define HEADER_SIZE 14
+#define PADDING_SIZE 8
+
+size_t pqoid_max_encoded_size(const qoi_desc *desc){
+    // the worst case of the parallel encoder with a segment index, see pqoi_max_encoded_size
+    return (size_t)desc->height * desc->width * (desc->channels + 1) + HEADER_SIZE + PADDING_SIZE + ((size_t)desc->height + 2) * 4;
+}
+
+#ifdef _WIN32
+
+int pqoid_buffer_alloc(pqoid_buffer_t *buffer, size_t size){
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->fd = -1;
+    return 0;
+}
+
+void pqoid_buffer_free(pqoid_buffer_t *buffer){
+    (void)buffer;
+}
+
+int pqoid_connect(const char *path){
+    (void)path;
+    return -1;
+}
+
+void pqoid_disconnect(int connection){
+    (void)connection;
+}
+
+int pqoid_call(int connection, const pqoid_request_t *request, int input_fd, int output_fd, pqoid_reply_t *reply){
+    (void)connection;
+    (void)request;
+    (void)input_fd;
+    (void)output_fd;
+    memset(reply, 0, sizeof(*reply));
+    return 0;
+}
+
+#else
+
+int pqoid_buffer_alloc(pqoid_buffer_t *buffer, size_t size){
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->fd = -1;
+    if (size == 0) {
+        return 0;
+    }
+
+#ifdef __linux__
+    int fd = memfd_create("pqoid", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    // an anonymous POSIX shared memory object, unlinked as soon as it's open
+    char name[64];
+    snprintf(name, sizeof(name), "/pqoid-%ld-%p", (long)getpid(), (void *)buffer);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+#endif
+    if (fd < 0) {
+        return 0;
+    }
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return 0;
+    }
+#ifdef __linux__
+    // the daemon maps only buffers that can't change size under it
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+        close(fd);
+        return 0;
+    }
+#endif
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    buffer->fd = fd;
+    buffer->data = data;
+    buffer->size = size;
+    return 1;
+}
+
+void pqoid_buffer_free(pqoid_buffer_t *buffer){
+    if (buffer->data) {
+        munmap(buffer->data, buffer->size);
+    }
+    if (buffer->fd >= 0) {
+        close(buffer->fd);
+    }
+    buffer->data = NULL;
+    buffer->fd = -1;
+    buffer->size = 0;
+}
+
+int pqoid_connect(const char *path){
+    if (path == NULL) {
+        path = getenv("PQOID_SOCKET");
+    }
+    if (path == NULL) {
+        path = PQOID_SOCKET_PATH;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) {
+        return -1;
+    }
+    if (connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+void pqoid_disconnect(int connection){
+    if (connection >= 0) {
+        close(connection);
+    }
+}
+
+int pqoid_call(int connection, const pqoid_request_t *request, int input_fd, int output_fd, pqoid_reply_t *reply){
+    memset(reply, 0, sizeof(*reply));
+
+    // the two buffers ride along with the request as ancillary data
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = { .iov_base = (void *)request, .iov_len = sizeof(*request) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = { input_fd, output_fd };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(connection, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != (ssize_t)sizeof(*request)) {
+        return 0;
+    }
+
+    size_t got = 0;
+    while (got < sizeof(*reply)) {
+        ssize_t n = recv(connection, (char *)reply + got, sizeof(*reply) - got, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        got += n;
+    }
+    return 1;
+}
+
+#endif
+
+size_t pqoid_encode(int connection, const pqoid_buffer_t *pixels, int src_channels, const qoi_desc *desc, int flags, pqoid_buffer_t *output){
+    if (src_channels < 1 || src_channels > 4 || desc->channels != (src_channels & 1 ? 3 : 4) ||
+        pixels->size < (size_t)desc->width * desc->height * src_channels) {
+        return 0;
+    }
+
+    pqoid_request_t request = {
+        .magic = PQOID_MAGIC,
+        .op = PQOID_ENCODE,
+        .width = desc->width,
+        .height = desc->height,
+        .channels = src_channels,
+        .flags = flags,
+        .input_size = pixels->size,
+        .output_size = output->size
+    };
+    pqoid_reply_t reply;
+    if (!pqoid_call(connection, &request, pixels->fd, output->fd, &reply) || reply.status != 1 || reply.size > output->size) {
+        return 0;
+    }
+    return reply.size;
+}
+
+int pqoid_decode(int connection, const pqoid_buffer_t *data, size_t size, pqoid_buffer_t *output, qoi_desc *desc){
+    const unsigned char *bytes = (const unsigned char *)data->data;
+    if (size < HEADER_SIZE || size > data->size) {
+        return 0;
+    }
+
+    desc->width = qoi_get_32(bytes + 4);
+    desc->height = qoi_get_32(bytes + 8);
+    desc->channels = bytes[12];
+    // the daemon hands out transformed images in RGB
+    desc->colorspace = bytes[13] & ~QOI_COLOR_YCOCG;
+    if (output->size < (size_t)desc->width * desc->height * desc->channels) {
+        return 0;
+    }
+
+    pqoid_request_t request = {
+        .magic = PQOID_MAGIC,
+        .op = PQOID_DECODE,
+        .input_size = size,
+        .output_size = output->size
+    };
+    pqoid_reply_t reply;
+    return pqoid_call(connection, &request, data->fd, output->fd, &reply) && reply.status == 1 &&
+        reply.width == desc->width && reply.height == desc->height && reply.channels == desc->channels;
+}
@@ -0,0 +1,115 @@
+#include "qoi_color.h"
+#include "qoi_stream.h"
+#include "pqoi_bands.h"
+#include "qoi_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HEADER_SIZE 14
+#define PADDING_SIZE 8
+#define MAGIC \
+    (((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+     ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
+#define PIXELS_MAX ((unsigned int)400000000)
+
+// half of an 8 bit value taken as signed, rounded down like an arithmetic shift
+#define HALF_S8(v) ((unsigned char)(((v) >> 1) | ((v) & 0x80)))
+
+// pixels of the image handed to one thread of qoi_color_inverse
+typedef struct color_band {
+    unsigned char *pixels;
+    size_t n_px;
+    int channels;
+} color_band_t;
+
+void qoi_color_forward(const unsigned char *src, unsigned char *dst, size_t n_px, int channels){
+    for (size_t i = 0; i < n_px; i++, src += channels, dst += channels) {
+        unsigned char co = src[0] - src[2];
+        unsigned char t = src[2] + HALF_S8(co);
+        unsigned char cg = src[1] - t;
+        unsigned char y = t + HALF_S8(cg);
+
+        dst[0] = co;
+        dst[1] = y;
+        dst[2] = cg;
+        if (channels == 4) {
+            dst[3] = src[3];
+        }
+    }
+}
+
+static void *inverse_band(void *arg){
+    color_band_t *band = (color_band_t *)arg;
+    unsigned char *px = band->pixels;
+    for (size_t i = 0; i < band->n_px; i++, px += band->channels) {
+        unsigned char co = px[0];
+        unsigned char y = px[1];
+        unsigned char cg = px[2];
+
+        unsigned char t = y - HALF_S8(cg);
+        unsigned char g = cg + t;
+        unsigned char b = t - HALF_S8(co);
+
+        px[0] = b + co;
+        px[1] = g;
+        px[2] = b;
+    }
+    return NULL;
+}
+
+void qoi_color_inverse(unsigned char *pixels, size_t n_px, int channels, int n_threads){
+    // not worth a thread below a few rows of a large image
+    int n_bands = pqoi_band_count(n_px / 65536 + 1, n_threads);
+    color_band_t one;
+    color_band_t *bands = n_bands > 1 ? (color_band_t *)calloc(n_bands, sizeof(color_band_t)) : NULL;
+    if (!bands) {
+        bands = &one;
+        n_bands = 1;
+    }
+
+    for (int i = 0; i < n_bands; i++) {
+        size_t first = (unsigned long long)n_px * i / n_bands;
+        size_t last = (unsigned long long)n_px * (i + 1) / n_bands;
+        bands[i] = (color_band_t){ .pixels = pixels + first * channels, .n_px = last - first, .channels = channels };
+    }
+    pqoi_run_bands(inverse_band, bands, sizeof(color_band_t), n_bands);
+
+    if (bands != &one) {
+        free(bands);
+    }
+}
+
+void *qoi_color_decode(const void *data, size_t size, qoi_desc *desc, int n_threads){
+    const unsigned char *bytes = (const unsigned char *)data;
+    if (bytes == NULL || size < HEADER_SIZE + PADDING_SIZE || qoi_get_32(bytes) != MAGIC || !(bytes[13] & QOI_COLOR_YCOCG)) {
+        return NULL;
+    }
+
+    desc->width = qoi_get_32(bytes + 4);
+    desc->height = qoi_get_32(bytes + 8);
+    desc->channels = bytes[12];
+    desc->colorspace = bytes[13] & ~QOI_COLOR_YCOCG;
+    if (
+        desc->width == 0 || desc->height == 0 ||
+        desc->channels < 3 || desc->channels > 4 ||
+        desc->colorspace > 1 ||
+        desc->height >= PIXELS_MAX / desc->width
+    ) {
+        return NULL;
+    }
+
+    // the rows of the parallel encoder decode one after the other like a plain stream
+    size_t n_px = (size_t)desc->width * desc->height;
+    unsigned char *pixels = (unsigned char *)malloc(n_px * desc->channels);
+    if (!pixels) {
+        return NULL;
+    }
+    if (!qoi_decode_segment(bytes + HEADER_SIZE, size - HEADER_SIZE, pixels, n_px, desc->channels)) {
+        free(pixels);
+        return NULL;
+    }
+
+    qoi_color_inverse(pixels, n_px, desc->channels, n_threads);
+    return pixels;
+}
@@ -0,0 +1,377 @@
+#include "qoi_lz.h"
+#include "pqoi_bands.h"
+#include "qoi_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+#define LZ_STORED 0x80000000u
+#define LZ_MAX_BLOCK_SIZE (1u << 30)
+
+// blocks of the file handed to one thread, compressing or decompressing
+typedef struct lz_band {
+    const unsigned char *src;
+    unsigned char *dst;
+    size_t raw_size;
+    unsigned int block_size;
+
+    // compressing: block i goes to dst + i * slot, its size to sizes[i]
+    // decompressing: block i is at src + offsets[i] and goes to dst + i * block_size
+    size_t slot;
+    unsigned int *sizes;
+    const size_t *offsets;
+
+    unsigned int first_block;
+    unsigned int n_blocks;
+    int failed;
+} lz_band_t;
+
+// 4 bytes in host order, only ever compared with each other
+static unsigned int load_32(const unsigned char *p){
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned int hash_4(unsigned int v){
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// worst case of one block: every byte a literal plus the length bytes of one sequence
+static size_t block_bound(size_t len){
+    return len + len / 255 + 16;
+}
+
+static unsigned int block_len(size_t raw_size, unsigned int block_size, unsigned int block){
+    size_t start = (size_t)block * block_size;
+    return raw_size - start < block_size ? (unsigned int)(raw_size - start) : block_size;
+}
+
+static unsigned char *put_length(unsigned char *o, size_t len){
+    while (len >= 255) {
+        *o++ = 255;
+        len -= 255;
+    }
+    *o++ = (unsigned char)len;
+    return o;
+}
+
+// a sequence of n_literals literals and a match of match_len bytes offset bytes back, no match for 0
+static unsigned char *put_sequence(unsigned char *o, const unsigned char *literals, size_t n_literals, size_t offset, size_t match_len){
+    unsigned char *token = o++;
+    *token = (n_literals < 15 ? n_literals : 15) << 4;
+    if (n_literals >= 15) {
+        o = put_length(o, n_literals - 15);
+    }
+    memcpy(o, literals, n_literals);
+    o += n_literals;
+
+    if (match_len) {
+        *o++ = offset;
+        *o++ = offset >> 8;
+        size_t len = match_len - LZ_MIN_MATCH;
+        *token |= len < 15 ? len : 15;
+        if (len >= 15) {
+            o = put_length(o, len - 15);
+        }
+    }
+    return o;
+}
+
+// greedy matches against the last position of every hash, table holds 1 << LZ_HASH_BITS entries
+// returns the compressed size, at most block_bound(len)
+static size_t compress_block(const unsigned char *src, size_t len, unsigned char *dst, unsigned int *table){
+    // positions are stored + 1, 0 is an empty entry
+    memset(table, 0, sizeof(unsigned int) << LZ_HASH_BITS);
+
+    unsigned char *o = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= len) {
+        unsigned int v = load_32(src + i);
+        unsigned int h = hash_4(v);
+        size_t candidate = table[h];
+        table[h] = (unsigned int)i + 1;
+
+        if (candidate && i - (candidate - 1) <= LZ_MAX_OFFSET && load_32(src + candidate - 1) == v) {
+            size_t ref = candidate - 1;
+            size_t match_len = LZ_MIN_MATCH;
+            while (i + match_len < len && src[ref + match_len] == src[i + match_len]) {
+                match_len++;
+            }
+            o = put_sequence(o, src + anchor, i - anchor, i - ref, match_len);
+            i += match_len;
+            anchor = i;
+        }
+        else {
+            // step faster through data that doesn't match, like LZ4 does
+            i += 1 + ((i - anchor) >> 6);
+        }
+    }
+
+    o = put_sequence(o, src + anchor, len - anchor, 0, 0);
+    return o - dst;
+}
+
+// returns 1 if the sequences of src decode to exactly dst_len bytes
+static int decompress_block(const unsigned char *src, size_t len, unsigned char *dst, size_t dst_len){
+    size_t p = 0;
+    size_t o = 0;
+
+    for (;;) {
+        if (p >= len) {
+            return 0;
+        }
+        int token = src[p++];
+
+        size_t n_literals = token >> 4;
+        if (n_literals == 15) {
+            int b;
+            do {
+                if (p >= len) {
+                    return 0;
+                }
+                b = src[p++];
+                n_literals += b;
+            } while (b == 255);
+        }
+        if (n_literals > len - p || n_literals > dst_len - o) {
+            return 0;
+        }
+        memcpy(dst + o, src + p, n_literals);
+        p += n_literals;
+        o += n_literals;
+
+        // only the last sequence ends without a match
+        if (p == len) {
+            return o == dst_len;
+        }
+        if (len - p < 2) {
+            return 0;
+        }
+        size_t offset = src[p] | (size_t)src[p + 1] << 8;
+        p += 2;
+
+        size_t match_len = token & 15;
+        if (match_len == 15) {
+            int b;
+            do {
+                if (p >= len) {
+                    return 0;
+                }
+                b = src[p++];
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match_len > dst_len - o) {
+            return 0;
+        }
+
+        // a match closer than its length repeats the bytes it is copying
+        if (offset >= match_len) {
+            memcpy(dst + o, dst + o - offset, match_len);
+        }
+        else {
+            for (size_t i = 0; i < match_len; i++) {
+                dst[o + i] = dst[o + i - offset];
+            }
+        }
+        o += match_len;
+    }
+}
+
+static void *compress_blocks(void *arg){
+    lz_band_t *band = (lz_band_t *)arg;
+    unsigned int *table = (unsigned int *)malloc(sizeof(unsigned int) << LZ_HASH_BITS);
+    if (!table) {
+        band->failed = 1;
+        return NULL;
+    }
+
+    for (unsigned int i = band->first_block; i < band->first_block + band->n_blocks; i++) {
+        const unsigned char *src = band->src + (size_t)i * band->block_size;
+        unsigned int len = block_len(band->raw_size, band->block_size, i);
+        unsigned char *dst = band->dst + i * band->slot;
+
+        size_t size = compress_block(src, len, dst, table);
+        if (size >= len) {
+            memcpy(dst, src, len);
+            band->sizes[i] = len | LZ_STORED;
+        }
+        else {
+            band->sizes[i] = (unsigned int)size;
+        }
+    }
+
+    free(table);
+    return NULL;
+}
+
+static void *decompress_blocks(void *arg){
+    lz_band_t *band = (lz_band_t *)arg;
+    for (unsigned int i = band->first_block; i < band->first_block + band->n_blocks && !band->failed; i++) {
+        const unsigned char *src = band->src + band->offsets[i];
+        size_t src_len = band->offsets[i + 1] - band->offsets[i];
+        unsigned int len = block_len(band->raw_size, band->block_size, i);
+        unsigned char *dst = band->dst + (size_t)i * band->block_size;
+
+        if (band->sizes[i] & LZ_STORED) {
+            memcpy(dst, src, len);
+        }
+        else {
+            band->failed = !decompress_block(src, src_len, dst, len);
+        }
+    }
+    return NULL;
+}
+
+// run fn over n_blocks blocks split into contiguous bands
+// returns 1 if no band failed
+static int run_blocks(void *(*fn)(void *), lz_band_t *model, unsigned int n_blocks, int n_threads){
+    n_threads = pqoi_band_count(n_blocks, n_threads);
+    lz_band_t *bands = (lz_band_t *)calloc(n_threads, sizeof(lz_band_t));
+    if (!bands) {
+        return 0;
+    }
+
+    for (int i = 0; i < n_threads; i++) {
+        bands[i] = *model;
+        bands[i].first_block = (unsigned long long)n_blocks * i / n_threads;
+        bands[i].n_blocks = (unsigned long long)n_blocks * (i + 1) / n_threads - bands[i].first_block;
+    }
+    pqoi_run_bands(fn, bands, sizeof(lz_band_t), n_threads);
+
+    int ok = 1;
+    for (int i = 0; i < n_threads; i++) {
+        ok &= !bands[i].failed;
+    }
+    free(bands);
+    return ok;
+}
+
+size_t qoi_lz_bound(size_t size, unsigned int block_size){
+    if (block_size == 0) {
+        block_size = QOI_LZ_DEFAULT_BLOCK_SIZE;
+    }
+    size_t n_blocks = (size + block_size - 1) / block_size;
+    return QOI_LZ_HEADER_SIZE + n_blocks * (4 + block_bound(block_size));
+}
+
+size_t qoi_lz_compress(const void *data, size_t size, unsigned int block_size, int n_threads, void *dst, size_t dst_capacity){
+    if (block_size == 0) {
+        block_size = QOI_LZ_DEFAULT_BLOCK_SIZE;
+    }
+    if (data == NULL || dst == NULL || size == 0 || size > 0xffffffffu || block_size > LZ_MAX_BLOCK_SIZE ||
+        dst_capacity < qoi_lz_bound(size, block_size)) {
+        return 0;
+    }
+
+    unsigned int n_blocks = (size + block_size - 1) / block_size;
+    unsigned int *sizes = (unsigned int *)malloc(n_blocks * sizeof(unsigned int));
+    if (!sizes) {
+        return 0;
+    }
+
+    // every block is compressed into a worst case slot first and moved down into place after
+    unsigned char *out = (unsigned char *)dst;
+    size_t data_start = QOI_LZ_HEADER_SIZE + (size_t)n_blocks * 4;
+    lz_band_t model = {
+        .src = (const unsigned char *)data,
+        .dst = out + data_start,
+        .raw_size = size,
+        .block_size = block_size,
+        .slot = block_bound(block_size),
+        .sizes = sizes
+    };
+    if (!run_blocks(compress_blocks, &model, n_blocks, n_threads)) {
+        free(sizes);
+        return 0;
+    }
+
+    qoi_put_32(out, QOI_LZ_MAGIC);
+    qoi_put_32(out + 4, (unsigned int)size);
+    qoi_put_32(out + 8, block_size);
+    qoi_put_32(out + 12, n_blocks);
+
+    size_t p = data_start;
+    for (unsigned int i = 0; i < n_blocks; i++) {
+        size_t len = sizes[i] & ~LZ_STORED;
+        qoi_put_32(out + QOI_LZ_HEADER_SIZE + (size_t)i * 4, sizes[i]);
+        memmove(out + p, model.dst + i * model.slot, len);
+        p += len;
+    }
+
+    free(sizes);
+    return p;
+}
+
+size_t qoi_lz_raw_size(const void *data, size_t size){
+    const unsigned char *bytes = (const unsigned char *)data;
+    if (bytes == NULL || size < QOI_LZ_HEADER_SIZE || qoi_get_32(bytes) != QOI_LZ_MAGIC) {
+        return 0;
+    }
+
+    size_t raw_size = qoi_get_32(bytes + 4);
+    unsigned int block_size = qoi_get_32(bytes + 8);
+    unsigned int n_blocks = qoi_get_32(bytes + 12);
+    if (raw_size == 0 || block_size == 0 || block_size > LZ_MAX_BLOCK_SIZE ||
+        n_blocks != (raw_size + block_size - 1) / block_size || (size - QOI_LZ_HEADER_SIZE) / 4 < n_blocks) {
+        return 0;
+    }
+
+    // the blocks have to fill the rest of the file exactly
+    size_t p = QOI_LZ_HEADER_SIZE + (size_t)n_blocks * 4;
+    for (unsigned int i = 0; i < n_blocks; i++) {
+        unsigned int entry = qoi_get_32(bytes + QOI_LZ_HEADER_SIZE + (size_t)i * 4);
+        size_t len = entry & ~LZ_STORED;
+        if ((entry & LZ_STORED) && len != block_len(raw_size, block_size, i)) {
+            return 0;
+        }
+        if (len > size - p) {
+            return 0;
+        }
+        p += len;
+    }
+    return p == size ? raw_size : 0;
+}
+
+size_t qoi_lz_decompress(const void *data, size_t size, int n_threads, void *dst, size_t dst_capacity){
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t raw_size = qoi_lz_raw_size(data, size);
+    if (raw_size == 0 || dst == NULL || dst_capacity < raw_size) {
+        return 0;
+    }
+
+    unsigned int n_blocks = qoi_get_32(bytes + 12);
+    unsigned int *sizes = (unsigned int *)malloc(n_blocks * sizeof(unsigned int));
+    size_t *offsets = (size_t *)malloc((n_blocks + 1) * sizeof(size_t));
+    if (!sizes || !offsets) {
+        free(sizes);
+        free(offsets);
+        return 0;
+    }
+
+    offsets[0] = QOI_LZ_HEADER_SIZE + (size_t)n_blocks * 4;
+    for (unsigned int i = 0; i < n_blocks; i++) {
+        sizes[i] = qoi_get_32(bytes + QOI_LZ_HEADER_SIZE + (size_t)i * 4);
+        offsets[i + 1] = offsets[i] + (sizes[i] & ~LZ_STORED);
+    }
+
+    lz_band_t model = {
+        .src = bytes,
+        .dst = (unsigned char *)dst,
+        .raw_size = raw_size,
+        .block_size = qoi_get_32(bytes + 8),
+        .sizes = sizes,
+        .offsets = offsets
+    };
+    int ok = run_blocks(decompress_blocks, &model, n_blocks, n_threads);
+
+    free(sizes);
+    free(offsets);
+    return ok ? raw_size : 0;
+}
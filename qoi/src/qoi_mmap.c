@@ -0,0 +1,108 @@
+#include "qoi_mmap.h"
+
+#include <limits.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int qoi_map_file(const char *filename, int flags, qoi_mapping_t *mapping){
+    memset(mapping, 0, sizeof(*mapping));
+
+#ifdef _WIN32
+    (void)flags;
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return 0;
+    }
+
+    HANDLE map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void *data = map ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data) {
+        if (map) CloseHandle(map);
+        CloseHandle(file);
+        return 0;
+    }
+
+    mapping->data = (const unsigned char *)data;
+    mapping->size = (size_t)size.QuadPart;
+    mapping->file = file;
+    mapping->map = map;
+    return 1;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return 0;
+    }
+
+    int map_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (flags & QOI_MAP_POPULATE) {
+        map_flags |= MAP_POPULATE;
+    }
+#endif
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, map_flags, fd, 0);
+    // the mapping stays valid without the descriptor
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    if (flags & QOI_MAP_SEQUENTIAL) {
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+
+    mapping->data = (const unsigned char *)data;
+    mapping->size = (size_t)st.st_size;
+    return 1;
+#endif
+}
+
+void qoi_unmap_file(qoi_mapping_t *mapping){
+    if (!mapping->data) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(mapping->data);
+    CloseHandle((HANDLE)mapping->map);
+    CloseHandle((HANDLE)mapping->file);
+#else
+    munmap((void *)mapping->data, mapping->size);
+#endif
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+void *qoi_read_mapped(const char *filename, qoi_desc *desc, int channels, int flags){
+    qoi_mapping_t mapping;
+    if (!qoi_map_file(filename, flags, &mapping)) {
+        return NULL;
+    }
+
+    void *pixels = NULL;
+    if (mapping.size <= INT_MAX) {
+        pixels = qoi_decode(mapping.data, (int)mapping.size, desc, channels);
+    }
+
+    qoi_unmap_file(&mapping);
+    return pixels;
+}
@@ -0,0 +1,106 @@
+#include "qoi_sequence.h"
+#include "qoi_stream.h"
+#include "qoi_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PADDING_SIZE 8
+
+void qoi_sequence_write_header(unsigned char *dst, const qoi_desc *desc){
+    qoi_put_32(dst, QOI_SEQUENCE_MAGIC);
+    qoi_put_32(dst + 4, desc->width);
+    qoi_put_32(dst + 8, desc->height);
+    dst[12] = desc->channels;
+    dst[13] = desc->colorspace;
+}
+
+int qoi_sequence_open(qoi_sequence_reader_t *reader, const void *data, size_t size){
+    const unsigned char *bytes = (const unsigned char *)data;
+    memset(reader, 0, sizeof(*reader));
+
+    if (bytes == NULL || size < QOI_SEQUENCE_HEADER_SIZE + PADDING_SIZE || qoi_get_32(bytes) != QOI_SEQUENCE_MAGIC) {
+        return 0;
+    }
+
+    reader->desc.width = qoi_get_32(bytes + 4);
+    reader->desc.height = qoi_get_32(bytes + 8);
+    reader->desc.channels = bytes[12];
+    reader->desc.colorspace = bytes[13];
+    if (
+        reader->desc.width == 0 || reader->desc.height == 0 ||
+        reader->desc.channels < 3 || reader->desc.channels > 4 ||
+        reader->desc.colorspace > 1 ||
+        reader->desc.height >= 400000000 / reader->desc.width
+    ) {
+        return 0;
+    }
+
+    // rows that are never sent stay black
+    reader->pixels = (unsigned char *)calloc((size_t)reader->desc.width * reader->desc.height, reader->desc.channels);
+    if (!reader->pixels) {
+        return 0;
+    }
+
+    reader->data = bytes;
+    reader->size = size;
+    reader->pos = QOI_SEQUENCE_HEADER_SIZE;
+    return 1;
+}
+
+const unsigned char *qoi_sequence_next(qoi_sequence_reader_t *reader, unsigned int *changed_rows){
+    const qoi_desc *desc = &reader->desc;
+    size_t end = reader->size - PADDING_SIZE;
+
+    // the padding follows the last frame
+    if (reader->pixels == NULL || end - reader->pos < 4) {
+        return NULL;
+    }
+
+    const unsigned char *record = reader->data + reader->pos + 4;
+    size_t record_len = qoi_get_32(reader->data + reader->pos);
+    size_t bitmap_len = QOI_SEQUENCE_BITMAP_SIZE(desc);
+    if (record_len > end - reader->pos - 4 || record_len < bitmap_len) {
+        return NULL;
+    }
+
+    const unsigned char *bitmap = record;
+    unsigned int n_changed = 0;
+    for (unsigned int y = 0; y < desc->height; y++){
+        n_changed += (bitmap[y >> 3] >> (7 - (y & 7))) & 1;
+    }
+    if ((record_len - bitmap_len) / 4 < n_changed) {
+        return NULL;
+    }
+
+    const unsigned char *lengths = record + bitmap_len;
+    const unsigned char *segment = lengths + (size_t)n_changed * 4;
+    const unsigned char *record_end = record + record_len;
+    size_t row_len = (size_t)desc->width * desc->channels;
+
+    unsigned int i = 0;
+    for (unsigned int y = 0; y < desc->height; y++){
+        if (!((bitmap[y >> 3] >> (7 - (y & 7))) & 1)) {
+            continue;
+        }
+
+        size_t len = qoi_get_32(lengths + (size_t)i++ * 4);
+        if (len > (size_t)(record_end - segment) ||
+            !qoi_decode_segment(segment, len, reader->pixels + y * row_len, desc->width, desc->channels)) {
+            return NULL;
+        }
+        segment += len;
+    }
+
+    reader->pos += 4 + record_len;
+    reader->frame++;
+    if (changed_rows) {
+        *changed_rows = n_changed;
+    }
+    return reader->pixels;
+}
+
+void qoi_sequence_close(qoi_sequence_reader_t *reader){
+    free(reader->pixels);
+    reader->pixels = NULL;
+}
@@ -0,0 +1,170 @@
+#include "qoi_stream.h"
+#include "qoi_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGIC \
+    (((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+     ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
+#define PIXELS_MAX ((unsigned int)400000000)
+
+enum {
+    STAGE_HEADER,
+    STAGE_OPS,
+    STAGE_DONE,
+    STAGE_ERROR
+};
+
+// write the pixels of the current op into the row, handing out every row that fills up
+static void emit_run(qoi_stream_decoder_t *decoder){
+    int channels = decoder->channels;
+    while (decoder->run > 0 && decoder->y < decoder->desc.height) {
+        unsigned int n = decoder->desc.width - decoder->x;
+        if (n > (unsigned int)decoder->run) {
+            n = decoder->run;
+        }
+
+        unsigned char *out = decoder->row + (size_t)decoder->x * channels;
+        for (unsigned int i = 0; i < n; i++) {
+            memcpy(out, decoder->ops.px, channels);
+            out += channels;
+        }
+        decoder->x += n;
+        decoder->run -= n;
+
+        if (decoder->x == decoder->desc.width) {
+            decoder->callback(decoder, decoder->row, decoder->y, decoder->user_data);
+            decoder->x = 0;
+            decoder->y++;
+        }
+    }
+
+    if (decoder->y == decoder->desc.height) {
+        decoder->stage = STAGE_DONE;
+    }
+}
+
+static int read_header(qoi_stream_decoder_t *decoder){
+    const unsigned char *h = decoder->pending;
+    decoder->desc.width = qoi_get_32(h + 4);
+    decoder->desc.height = qoi_get_32(h + 8);
+    decoder->desc.channels = h[12];
+    decoder->desc.colorspace = h[13];
+    decoder->pending_len = 0;
+
+    if (
+        qoi_get_32(h) != MAGIC ||
+        decoder->desc.width == 0 || decoder->desc.height == 0 ||
+        decoder->desc.channels < 3 || decoder->desc.channels > 4 ||
+        decoder->desc.colorspace > 1 ||
+        decoder->desc.height >= PIXELS_MAX / decoder->desc.width
+    ) {
+        return 0;
+    }
+
+    if (decoder->channels == 0) {
+        decoder->channels = decoder->desc.channels;
+    }
+    decoder->row = (unsigned char *)malloc((size_t)decoder->desc.width * decoder->channels);
+    return decoder->row != NULL;
+}
+
+int qoi_stream_decoder_init(qoi_stream_decoder_t *decoder, int channels, qoi_row_callback callback, void *user_data){
+    memset(decoder, 0, sizeof(*decoder));
+    if ((channels != 0 && channels != 3 && channels != 4) || callback == NULL) {
+        decoder->stage = STAGE_ERROR;
+        return 0;
+    }
+
+    decoder->channels = channels;
+    qoi_op_state_init(&decoder->ops);
+    decoder->callback = callback;
+    decoder->user_data = user_data;
+    decoder->stage = STAGE_HEADER;
+    return 1;
+}
+
+int qoi_stream_decoder_push(qoi_stream_decoder_t *decoder, const void *data, size_t len){
+    const unsigned char *bytes = (const unsigned char *)data;
+    const unsigned char *end = bytes + len;
+
+    if (decoder->stage == STAGE_HEADER) {
+        size_t n = QOI_STREAM_HEADER_SIZE - decoder->pending_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(decoder->pending + decoder->pending_len, bytes, n);
+        decoder->pending_len += n;
+        bytes += n;
+
+        if (decoder->pending_len == QOI_STREAM_HEADER_SIZE) {
+            decoder->stage = read_header(decoder) ? STAGE_OPS : STAGE_ERROR;
+        }
+    }
+
+    if (decoder->stage == STAGE_OPS && decoder->pending_len > 0) {
+        // finish the op split across the previous push
+        int size = qoi_op_size(decoder->pending[0]);
+        while (decoder->pending_len < size && bytes < end) {
+            decoder->pending[decoder->pending_len++] = *bytes++;
+        }
+        if (decoder->pending_len == size) {
+            decoder->run = qoi_op_apply(&decoder->ops, decoder->pending);
+            decoder->pending_len = 0;
+            emit_run(decoder);
+        }
+    }
+
+    while (decoder->stage == STAGE_OPS && bytes < end) {
+        int size = qoi_op_size(*bytes);
+        if (end - bytes < size) {
+            memcpy(decoder->pending, bytes, end - bytes);
+            decoder->pending_len = end - bytes;
+            break;
+        }
+
+        decoder->run = qoi_op_apply(&decoder->ops, bytes);
+        bytes += size;
+        emit_run(decoder);
+    }
+
+    // anything past the last pixel is padding or trailing data
+    return decoder->stage != STAGE_ERROR;
+}
+
+size_t qoi_decode_segment(const void *data, size_t len, unsigned char *pixels, size_t n_px, int channels){
+    const unsigned char *bytes = (const unsigned char *)data;
+    qoi_op_state_t state;
+    qoi_op_state_init(&state);
+
+    size_t p = 0;
+    size_t run = 0;
+    while (n_px > 0) {
+        if (run == 0) {
+            if (p >= len || len - p < (size_t)qoi_op_size(bytes[p])) {
+                return 0;
+            }
+            run = qoi_op_apply(&state, bytes + p);
+            p += qoi_op_size(bytes[p]);
+        }
+
+        size_t n = n_px < run ? n_px : run;
+        for (size_t i = 0; i < n; i++) {
+            memcpy(pixels, state.px, channels);
+            pixels += channels;
+        }
+        n_px -= n;
+        run -= n;
+    }
+    return p;
+}
+
+int qoi_stream_decoder_finished(const qoi_stream_decoder_t *decoder){
+    return decoder->stage == STAGE_DONE;
+}
+
+void qoi_stream_decoder_free(qoi_stream_decoder_t *decoder){
+    free(decoder->row);
+    decoder->row = NULL;
+}
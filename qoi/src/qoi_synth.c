@@ -0,0 +1,276 @@
+#include "qoi_synth.h"
+#include "pqoi_bands.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// colors of QOI_SYNTH_COLLIDE, cycled along the rows
+#define COLLIDE_COLORS 16
+
+// cells of the layouts, the pixels of a cell only depend on the cell and the seed
+#define UI_CELL_W 256
+#define UI_CELL_H 192
+#define UI_TITLE_H 20
+#define UI_LINE_H 14
+#define SPRITE_CELL 64
+
+static const char *names[QOI_SYNTH_COUNT] = {
+    "gradient", "noise", "ui", "sprites", "solid", "collide"
+};
+
+// rows of an image handed to one thread of qoi_synth_image
+typedef struct synth_band {
+    int pattern;
+    unsigned int width;
+    unsigned int height;
+    int channels;
+    unsigned int seed;
+    unsigned int first_row;
+    unsigned int n_rows;
+    unsigned char *dst;
+} synth_band_t;
+
+// integer hash with full avalanche, the only source of randomness
+static unsigned int mix(unsigned int v){
+    v ^= v >> 16;
+    v *= 0x7feb352d;
+    v ^= v >> 15;
+    v *= 0x846ca68b;
+    v ^= v >> 16;
+    return v;
+}
+
+static unsigned int hash3(unsigned int a, unsigned int b, unsigned int seed){
+    return mix(a ^ mix(b ^ mix(seed + 0x9e3779b9)));
+}
+
+static void put_px(unsigned char *px, int channels, unsigned int r, unsigned int g, unsigned int b, unsigned int a){
+    px[0] = (unsigned char)r;
+    px[1] = (unsigned char)g;
+    px[2] = (unsigned char)b;
+    if (channels == 4) {
+        px[3] = (unsigned char)a;
+    }
+}
+
+// the QOI index slot of a color, alpha is 255 for RGB
+static int slot(const unsigned char *c){
+    return (c[0] * 3 + c[1] * 5 + c[2] * 7 + c[3] * 11) % 64;
+}
+
+// 1 if b follows a as a DIFF or LUMA op
+static int small_step(const unsigned char *a, const unsigned char *b){
+    if (a[3] != b[3]) {
+        return 0;
+    }
+    signed char vr = b[0] - a[0];
+    signed char vg = b[1] - a[1];
+    signed char vb = b[2] - a[2];
+    signed char vg_r = vr - vg;
+    signed char vg_b = vb - vg;
+    return vg > -33 && vg < 32 && vg_r > -9 && vg_r < 8 && vg_b > -9 && vg_b < 8;
+}
+
+// colors that all hash to slot 0, so every pixel evicts the one before it from the index,
+// and that are too far apart for DIFF and LUMA, the last one included when it wraps around
+static void collide_colors(int channels, unsigned int seed, unsigned char colors[COLLIDE_COLORS][4]){
+    unsigned int k = 0;
+    for (int i = 0; i < COLLIDE_COLORS; i++) {
+        for (;;) {
+            unsigned int v = hash3(i, k++, seed);
+            unsigned char *c = colors[i];
+            c[0] = v;
+            c[1] = v >> 8;
+            c[2] = v >> 16;
+            c[3] = channels == 4 ? v >> 24 : 255;
+            if (slot(c) == 0 &&
+                (i == 0 || (memcmp(c, colors[i - 1], 4) != 0 && !small_step(colors[i - 1], c))) &&
+                (i < COLLIDE_COLORS - 1 || (memcmp(c, colors[0], 4) != 0 && !small_step(c, colors[0])))) {
+                break;
+            }
+        }
+    }
+}
+
+// a window of the UI cell (cx, cy) and what lies at (x, y) inside the cell
+static void ui_px(unsigned int x, unsigned int y, unsigned int seed, unsigned char *rgb){
+    unsigned int cx = x / UI_CELL_W, cy = y / UI_CELL_H;
+    unsigned int ix = x % UI_CELL_W, iy = y % UI_CELL_H;
+    unsigned int cell = hash3(cx, cy, seed);
+
+    // the desktop
+    rgb[0] = 0xe8; rgb[1] = 0xea; rgb[2] = 0xed;
+    if ((cell & 3) == 0) {
+        return;
+    }
+
+    unsigned int left = 4 + (cell >> 2) % 24, top = 4 + (cell >> 7) % 16;
+    unsigned int right = UI_CELL_W - 4 - (cell >> 12) % 24, bottom = UI_CELL_H - 4 - (cell >> 17) % 16;
+    if (ix < left || ix >= right || iy < top || iy >= bottom) {
+        return;
+    }
+
+    // a one pixel border, the title bar in one of a few accent colors, a white body
+    static const unsigned char accents[4][3] = { {0x1f, 0x6f, 0xeb}, {0x2d, 0x2d, 0x30}, {0x10, 0x7c, 0x41}, {0xc4, 0x2b, 0x1c} };
+    if (ix == left || ix == right - 1 || iy == top || iy == bottom - 1) {
+        rgb[0] = 0xa0; rgb[1] = 0xa4; rgb[2] = 0xa8;
+        return;
+    }
+    if (iy < top + UI_TITLE_H) {
+        memcpy(rgb, accents[(cell >> 22) & 3], 3);
+        return;
+    }
+    rgb[0] = rgb[1] = rgb[2] = 0xff;
+
+    // text lines of dark glyph strokes, some lines are buttons instead
+    unsigned int line = (iy - top - UI_TITLE_H) / UI_LINE_H, in_line = (iy - top - UI_TITLE_H) % UI_LINE_H;
+    unsigned int line_hash = hash3(cx * 4096 + line, cy, seed);
+    unsigned int text_end = left + 8 + line_hash % (right - left - 8);
+    if ((line_hash >> 24) % 5 == 0) {
+        if (ix >= left + 8 && ix < left + 72 && in_line >= 1 && in_line < 13) {
+            rgb[0] = 0xdd; rgb[1] = 0xe3; rgb[2] = 0xea;
+        }
+    }
+    else if (ix >= left + 8 && ix < text_end && in_line >= 3 && in_line < 11) {
+        unsigned int glyph = hash3((x / 6) * 16 + in_line, y / UI_LINE_H, seed);
+        if ((glyph & 3) == 0 && x % 6 != 5) {
+            rgb[0] = rgb[1] = rgb[2] = 0x20;
+        }
+    }
+}
+
+// sprite of the cell (x, y) is in, RGBA with the alpha of its soft edge
+static void sprite_px(unsigned int x, unsigned int y, unsigned int seed, unsigned char *rgba){
+    unsigned int cell = hash3(x / SPRITE_CELL, y / SPRITE_CELL, seed);
+    memset(rgba, 0, 4);
+    if (cell % 10 >= 7) {
+        return;
+    }
+
+    int radius = 12 + (cell >> 4) % 18;
+    int cx = SPRITE_CELL / 2 + (int)((cell >> 9) % 9) - 4;
+    int cy = SPRITE_CELL / 2 + (int)((cell >> 13) % 9) - 4;
+    int dx = (int)(x % SPRITE_CELL) - cx, dy = (int)(y % SPRITE_CELL) - cy;
+    int d2 = dx * dx + dy * dy;
+
+    // full inside, fading over the last 4 pixels of the radius
+    int inner = (radius - 4) * (radius - 4), outer = radius * radius;
+    if (d2 >= outer) {
+        return;
+    }
+    rgba[0] = cell >> 17;
+    rgba[1] = 64 + (cell >> 25) + dy * 2;  // shaded top to bottom, never wraps
+    rgba[2] = 255 - (unsigned char)(cell >> 17);
+    rgba[3] = d2 <= inner ? 255 : 255 * (outer - d2) / (outer - inner);
+}
+
+const char *qoi_synth_name(int pattern){
+    return pattern >= 0 && pattern < QOI_SYNTH_COUNT ? names[pattern] : NULL;
+}
+
+int qoi_synth_find(const char *name){
+    for (int i = 0; i < QOI_SYNTH_COUNT; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void qoi_synth_rows(int pattern, unsigned int width, unsigned int height, int channels, unsigned int seed,
+    unsigned int first_row, unsigned int n_rows, unsigned char *dst) {
+
+    unsigned char colors[COLLIDE_COLORS][4];
+    if (pattern == QOI_SYNTH_COLLIDE) {
+        collide_colors(channels, seed, colors);
+    }
+    unsigned int solid = mix(seed);
+
+    unsigned char *px = dst;
+    for (unsigned int y = first_row; y < first_row + n_rows; y++) {
+        for (unsigned int x = 0; x < width; x++, px += channels) {
+            switch (pattern) {
+            case QOI_SYNTH_GRADIENT:
+                put_px(px, channels,
+                    (unsigned long long)x * 256 / width,
+                    (unsigned long long)y * 256 / height,
+                    ((unsigned long long)x + y) * 256 / ((unsigned long long)width + height),
+                    255 - (unsigned long long)y * 128 / height);
+                break;
+            case QOI_SYNTH_NOISE: {
+                unsigned int v = hash3(x, y, seed);
+                put_px(px, channels, v, v >> 8, v >> 16, v >> 24);
+                break;
+            }
+            case QOI_SYNTH_UI: {
+                unsigned char rgb[3];
+                ui_px(x, y, seed, rgb);
+                put_px(px, channels, rgb[0], rgb[1], rgb[2], 255);
+                break;
+            }
+            case QOI_SYNTH_SPRITES: {
+                unsigned char rgba[4];
+                sprite_px(x, y, seed, rgba);
+                if (channels == 4) {
+                    put_px(px, channels, rgba[0], rgba[1], rgba[2], rgba[3]);
+                }
+                else {
+                    // composited over black
+                    put_px(px, channels, rgba[0] * rgba[3] / 255, rgba[1] * rgba[3] / 255, rgba[2] * rgba[3] / 255, 255);
+                }
+                break;
+            }
+            case QOI_SYNTH_SOLID:
+                put_px(px, channels, solid, solid >> 8, solid >> 16, 255);
+                break;
+            case QOI_SYNTH_COLLIDE: {
+                const unsigned char *c = colors[(x + y) % COLLIDE_COLORS];
+                put_px(px, channels, c[0], c[1], c[2], c[3]);
+                break;
+            }
+            }
+        }
+    }
+}
+
+static void *synth_band(void *arg){
+    synth_band_t *band = (synth_band_t *)arg;
+    qoi_synth_rows(band->pattern, band->width, band->height, band->channels, band->seed, band->first_row, band->n_rows, band->dst);
+    return NULL;
+}
+
+void *qoi_synth_image(int pattern, unsigned int width, unsigned int height, int channels, unsigned int seed, int n_threads){
+    if (pattern < 0 || pattern >= QOI_SYNTH_COUNT || width == 0 || height == 0 || channels < 3 || channels > 4 ||
+        (unsigned long long)width * height > (size_t)-1 / 4) {
+        return NULL;
+    }
+
+    size_t row_len = (size_t)width * channels;
+    unsigned char *pixels = (unsigned char *)malloc(row_len * height);
+    if (!pixels) {
+        return NULL;
+    }
+
+    int n_bands = pqoi_band_count(height, n_threads);
+    synth_band_t one;
+    synth_band_t *bands = n_bands > 1 ? (synth_band_t *)calloc(n_bands, sizeof(synth_band_t)) : NULL;
+    if (!bands) {
+        bands = &one;
+        n_bands = 1;
+    }
+
+    for (int i = 0; i < n_bands; i++) {
+        unsigned int first = (unsigned long long)height * i / n_bands;
+        unsigned int last = (unsigned long long)height * (i + 1) / n_bands;
+        bands[i] = (synth_band_t){
+            .pattern = pattern, .width = width, .height = height, .channels = channels, .seed = seed,
+            .first_row = first, .n_rows = last - first, .dst = pixels + first * row_len
+        };
+    }
+    pqoi_run_bands(synth_band, bands, sizeof(synth_band_t), n_bands);
+
+    if (bands != &one) {
+        free(bands);
+    }
+    return pixels;
+}
@@ -0,0 +1,187 @@
+#include "qoi_tiles.h"
+#include "pqoi_bands.h"
+#include "qoi_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_ENTRY_SIZE 8
+#define PADDING_SIZE 8
+#define PIXELS_MAX ((unsigned int)400000000)
+
+typedef struct rect_job {
+    const qoi_tiled_t *tiled;
+    int x, y, w, h;
+    int channels;
+    unsigned char *pixels;
+
+    // the tiles intersecting the rectangle, worker i takes every n_workers-th one starting at i
+    unsigned int tx0, ty0, tiles_x, n_tiles;
+    int worker;
+    int n_workers;
+} rect_job_t;
+
+static size_t get_64(const unsigned char *b){
+    return (size_t)((unsigned long long)qoi_get_32(b) << 32 | qoi_get_32(b + 4));
+}
+
+void qoi_tiles_write_header(unsigned char *dst, const qoi_desc *desc, unsigned int tile_size){
+    qoi_put_32(dst, QOI_TILES_MAGIC);
+    qoi_put_32(dst + 4, desc->width);
+    qoi_put_32(dst + 8, desc->height);
+    dst[12] = desc->channels;
+    dst[13] = desc->colorspace;
+    qoi_put_32(dst + 14, tile_size);
+}
+
+int qoi_tiled_open(qoi_tiled_t *tiled, const void *data, size_t size){
+    const unsigned char *bytes = (const unsigned char *)data;
+    memset(tiled, 0, sizeof(*tiled));
+
+    if (bytes == NULL || size < QOI_TILES_HEADER_SIZE + PADDING_SIZE || qoi_get_32(bytes) != QOI_TILES_MAGIC) {
+        return 0;
+    }
+
+    tiled->desc.width = qoi_get_32(bytes + 4);
+    tiled->desc.height = qoi_get_32(bytes + 8);
+    tiled->desc.channels = bytes[12];
+    tiled->desc.colorspace = bytes[13];
+    tiled->tile_size = qoi_get_32(bytes + 14);
+    if (
+        tiled->desc.width == 0 || tiled->desc.height == 0 ||
+        tiled->desc.height >= PIXELS_MAX / tiled->desc.width ||
+        tiled->tile_size == 0 || tiled->tile_size > QOI_TILES_MAX_SIZE ||
+        tiled->desc.channels < 3 || tiled->desc.channels > 4 ||
+        tiled->desc.colorspace > 1
+    ) {
+        return 0;
+    }
+
+    tiled->tiles_x = QOI_TILES_X(&tiled->desc, tiled->tile_size);
+    tiled->tiles_y = QOI_TILES_Y(&tiled->desc, tiled->tile_size);
+    if (tiled->tiles_x == 0 || tiled->tiles_y == 0) {
+        return 0;
+    }
+    size_t n_tiles = (size_t)tiled->tiles_x * tiled->tiles_y;
+    size_t table_len = (n_tiles + 1) * TABLE_ENTRY_SIZE;
+    if (table_len > size - QOI_TILES_HEADER_SIZE - PADDING_SIZE) {
+        return 0;
+    }
+
+    tiled->table = bytes + QOI_TILES_HEADER_SIZE;
+    tiled->tiles = tiled->table + table_len;
+    tiled->tiles_len = size - QOI_TILES_HEADER_SIZE - PADDING_SIZE - table_len;
+
+    // offsets must run forward and end exactly at the padding
+    size_t prev = 0;
+    for (size_t i = 0; i <= n_tiles; i++) {
+        size_t offset = get_64(tiled->table + i * TABLE_ENTRY_SIZE);
+        if (offset < prev || offset > tiled->tiles_len) {
+            return 0;
+        }
+        prev = offset;
+    }
+    return prev == tiled->tiles_len;
+}
+
+// decode one tile until its last row inside the rectangle, writing only the pixels inside it
+static void decode_tile(const rect_job_t *job, unsigned int tx, unsigned int ty){
+    const qoi_tiled_t *tiled = job->tiled;
+    size_t i = (size_t)ty * tiled->tiles_x + tx;
+    const unsigned char *bytes = tiled->tiles;
+    size_t p = get_64(tiled->table + i * TABLE_ENTRY_SIZE);
+    size_t end = get_64(tiled->table + (i + 1) * TABLE_ENTRY_SIZE);
+
+    int x0 = tx * tiled->tile_size;
+    int y0 = ty * tiled->tile_size;
+    int tile_w = tiled->desc.width - x0 < tiled->tile_size ? (int)(tiled->desc.width - x0) : (int)tiled->tile_size;
+    int tile_h = tiled->desc.height - y0 < tiled->tile_size ? (int)(tiled->desc.height - y0) : (int)tiled->tile_size;
+
+    // rows and columns of the tile that land in the rectangle, in tile coordinates
+    int col_begin = job->x > x0 ? job->x - x0 : 0;
+    int col_end = job->x + job->w - x0 < tile_w ? job->x + job->w - x0 : tile_w;
+    int row_begin = job->y > y0 ? job->y - y0 : 0;
+    int row_end = job->y + job->h - y0 < tile_h ? job->y + job->h - y0 : tile_h;
+
+    qoi_op_state_t state;
+    qoi_op_state_init(&state);
+    int run = 0;
+    int channels = job->channels;
+
+    for (int row = 0; row < row_end; row++) {
+        // rows above the rectangle are only decoded for the state they leave behind
+        int inside = row >= row_begin;
+        unsigned char *out = inside ? job->pixels + ((size_t)(y0 + row - job->y) * job->w + (x0 + col_begin - job->x)) * channels : NULL;
+
+        for (int col = 0; col < tile_w; col++) {
+            // a tile that ends early repeats its last pixel
+            if (run == 0 && p < end && end - p >= (size_t)qoi_op_size(bytes[p])) {
+                run = qoi_op_apply(&state, bytes + p);
+                p += qoi_op_size(bytes[p]);
+            }
+            if (run > 0) {
+                run--;
+            }
+
+            if (inside && col >= col_begin && col < col_end) {
+                memcpy(out, state.px, channels);
+                out += channels;
+            }
+        }
+    }
+}
+
+static void *decode_tiles(void *arg){
+    rect_job_t *job = (rect_job_t *)arg;
+    for (unsigned int i = job->worker; i < job->n_tiles; i += job->n_workers) {
+        decode_tile(job, job->tx0 + i % job->tiles_x, job->ty0 + i / job->tiles_x);
+    }
+    return NULL;
+}
+
+void *qoi_tiled_decode_rect(const qoi_tiled_t *tiled, int x, int y, int w, int h, int channels, int n_threads){
+    if (channels == 0) {
+        channels = tiled->desc.channels;
+    }
+    if (
+        channels < 3 || channels > 4 || w <= 0 || h <= 0 || x < 0 || y < 0 ||
+        (unsigned int)x + w > tiled->desc.width || (unsigned int)y + h > tiled->desc.height
+    ) {
+        return NULL;
+    }
+
+    unsigned char *pixels = (unsigned char *)malloc((size_t)w * h * channels);
+    if (!pixels) {
+        return NULL;
+    }
+
+    unsigned int tx0 = x / tiled->tile_size;
+    unsigned int ty0 = y / tiled->tile_size;
+    unsigned int tiles_x = (x + w - 1) / tiled->tile_size - tx0 + 1;
+    unsigned int tiles_y = (y + h - 1) / tiled->tile_size - ty0 + 1;
+    unsigned int n_tiles = tiles_x * tiles_y;
+
+    n_threads = pqoi_band_count(n_tiles, n_threads);
+    rect_job_t *jobs = (rect_job_t *)malloc(n_threads * sizeof(rect_job_t));
+    if (!jobs) {
+        free(pixels);
+        return NULL;
+    }
+
+    for (int i = 0; i < n_threads; i++) {
+        jobs[i] = (rect_job_t){
+            .tiled = tiled,
+            .x = x, .y = y, .w = w, .h = h,
+            .channels = channels,
+            .pixels = pixels,
+            .tx0 = tx0, .ty0 = ty0, .tiles_x = tiles_x, .n_tiles = n_tiles,
+            .worker = i,
+            .n_workers = n_threads
+        };
+    }
+
+    pqoi_run_bands(decode_tiles, jobs, sizeof(rect_job_t), n_threads);
+
+    free(jobs);
+    return pixels;
+}